@@ -43,8 +43,12 @@ LOCAL_ARM_MODE := arm
 # * 3: Minor normal events get printed. 
 # * 4+: Varying levels of trace */
 
+# Release builds compile all the debugging output out, unless a level
+# is given on the command line (ndk-build FCAM_DEBUG_LEVEL=2) to leave
+# some tracing on in an optimized build.
+
 ifeq ($(NDK_DEBUG),1)
-  LOCAL_CFLAGS += -DFCAM_DEBUG_LEVEL=4
+  FCAM_DEBUG_LEVEL ?= 4
   LOCAL_CFLAGS += -DDEBUG
 else
 ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
@@ -52,6 +56,10 @@ ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
 endif
 endif
 
+ifneq ($(strip $(FCAM_DEBUG_LEVEL)),)
+  LOCAL_CFLAGS += -DFCAM_DEBUG_LEVEL=$(FCAM_DEBUG_LEVEL)
+endif
+
 BUILD_FROM_SRC := $(strip $(PREBUILD))
 BUILD_FCAM_FROM_SRC := $(BUILD_FROM_SRC)
 BUILD_JPEG_FROM_SRC := $(BUILD_FROM_SRC)
@@ -86,17 +94,20 @@ $(call __ndk_info,Rebuilding FCam libraries from sources)
 
 LOCAL_SRC_FILES :=
 LOCAL_SRC_FILES += src/Action.cpp src/AutoExposure.cpp src/AutoFocus.cpp src/AutoWhiteBalance.cpp src/AsyncFile.cpp 
-LOCAL_SRC_FILES += src/Base.cpp src/Device.cpp src/Event.cpp src/Flash.cpp src/Frame.cpp src/Image.cpp 
-LOCAL_SRC_FILES += src/Lens.cpp src/Shot.cpp src/Sensor.cpp src/Time.cpp src/TagValue.cpp 
+LOCAL_SRC_FILES += src/Base.cpp src/Counters.cpp src/Debug.cpp src/Device.cpp src/Event.cpp src/Flash.cpp src/Frame.cpp src/Image.cpp 
+LOCAL_SRC_FILES += src/Lens.cpp src/Platform.cpp src/Shot.cpp src/Sensor.cpp src/Time.cpp src/TagValue.cpp src/TagMapView.cpp
 LOCAL_SRC_FILES += src/processing/DNG.cpp src/processing/TIFF.cpp src/processing/TIFFTags.cpp
 LOCAL_SRC_FILES += src/processing/Dump.cpp src/processing/JPEG.cpp src/processing/Demosaic.cpp src/processing/Color.cpp
+LOCAL_SRC_FILES += src/processing/LUT.cpp src/processing/DemosaicHQ.cpp src/processing/Resample.cpp
+LOCAL_SRC_FILES += src/processing/Burst.cpp
 
 # FCam Tegra files
 LOCAL_SRC_FILES += src/Tegra/AutoFocus.cpp src/Tegra/Shot.cpp
 LOCAL_SRC_FILES += src/Tegra/Platform.cpp src/Tegra/Sensor.cpp src/Tegra/Frame.cpp
 LOCAL_SRC_FILES += src/Tegra/Statistics.cpp
 LOCAL_SRC_FILES += src/Tegra/Lens.cpp src/Tegra/Flash.cpp
-LOCAL_SRC_FILES += src/Tegra/Daemon.cpp src/Tegra/YUV420.cpp
+LOCAL_SRC_FILES += src/Tegra/Daemon.cpp src/Tegra/FramePool.cpp src/Tegra/YUV420.cpp
+LOCAL_SRC_FILES += src/Tegra/LatencyModel.cpp
 
 LOCAL_C_INCLUDES += 
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/external/libjpeg
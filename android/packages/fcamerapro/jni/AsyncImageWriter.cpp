@@ -4,6 +4,7 @@
 #include "FCam/processing/JPEG.h"
 #include "FCam/processing/DNG.h"
 #include "FCam/processing/TIFF.h"
+#include "FCam/processing/Resample.h"
 #include "FCam/FCam.h"
 #include "Common.h"
 #include "HPT.h"
@@ -12,9 +13,6 @@
 #define THUMBNAIL_HEIGHT  288
 #define THUMBNAIL_QUALITY 95
 
-#define THUMBNAIL_BLUR_RADIUS 5
-#define THUMBNAIL_BLUR_NORM   (0x10000/(THUMBNAIL_BLUR_RADIUS*THUMBNAIL_BLUR_RADIUS))
-
 static const char sXmlName[] = "img_%04i.xml";
 static const char sImageName[] = "img_%04i_%02i.%s";
 static const char sThumbnailName[] = "thumb_%04i_%02i.jpg";
@@ -24,11 +22,12 @@ static const char sJpegExt[] = "jpg";
 // ImageSet
 // ===================================================================
 
-ImageSet::ImageSet(int id, const char *outputDirPrefix) : m_outputDirPrefix(outputDirPrefix), m_fileId(id) {
-
+ImageSet::ImageSet(int id, const char *outputDirPrefix) : m_pending(1), m_outputDirPrefix(outputDirPrefix), m_fileId(id) {
+	pthread_mutex_init(&m_lock, 0);
 }
 
 ImageSet::~ImageSet(void) {
+	pthread_mutex_destroy(&m_lock);
 }
 
 void ImageSet::add(const FileFormatDescriptor &ff, const FCam::Frame &frame) {
@@ -36,53 +35,29 @@ void ImageSet::add(const FileFormatDescriptor &ff, const FCam::Frame &frame) {
 	m_frameFormat.push_back(ff);
 }
 
-static void DownsampleChannel(unsigned char *dest, int dstWidth, int dstHeight, unsigned char *src, int srcWidth, int srcHeight) {
-	// XXX: naive sub-sampling
-
-//	int dstindex = 0;
-//	int ty = 0;
-//	int ax = (srcWidth << 16) / dstWidth;
-//	int ay = (srcHeight << 16) / dstHeight;
-//
-//	for (int i = 0; i < dstHeight; i++) {
-//		int srcindex = (ty >> 16) * srcWidth;
-//		int tx = 0;
-//		for (int j = 0; j < dstWidth; j++) {
-//			dest[dstindex++] = src[srcindex + (tx >> 16)];
-//			tx += ax;
-//		}
-//
-//		ty += ay;
-//	}
-
-
-	// XXX: sub-sampling + box-filter
-	int dstindex = 0;
-	int ty = 0;
-	int ax = ((srcWidth - (THUMBNAIL_BLUR_RADIUS & ~1)) << 16) / dstWidth;
-	int ay = ((srcHeight - (THUMBNAIL_BLUR_RADIUS & ~1)) << 16) / dstHeight;
-
-	for (int i = 0; i < dstHeight; i++) {
-		int rowindex = (ty >> 16) * srcWidth;
-		int tx = 0;
-		for (int j = 0; j < dstWidth; j++) {
-			// blur filter
-			int sum = 0;
-			int srcindex = rowindex + (tx >> 16);
-			for (int y = 0; y < THUMBNAIL_BLUR_RADIUS; y++) {
-				for (int x = 0; x < THUMBNAIL_BLUR_RADIUS; x++) {
-					sum += src[srcindex + x];
-				}
-				srcindex += srcWidth;
-			}
-
-			dest[dstindex++] = sum * THUMBNAIL_BLUR_NORM >> 16;
-			tx += ax;
-		}
+int ImageSet::addImage(const FCam::Frame &frame) {
+	ImageInfo info;
+	info.flash = frame.tags().find("flash.brightness") != frame.tags().end();
+	info.gain = frame.gain();
+	info.exposure = frame.exposure();
+	info.whiteBalance = frame.whiteBalance();
 
-		ty += ay;
-	}
+	pthread_mutex_lock(&m_lock);
+	int index = m_images.size();
+	m_images.push_back(info);
+	m_pending++;
+	pthread_mutex_unlock(&m_lock);
+
+	return index;
+}
+
+// Returns true when the last outstanding image (or the close) is done.
+bool ImageSet::release(void) {
+	pthread_mutex_lock(&m_lock);
+	bool done = --m_pending == 0;
+	pthread_mutex_unlock(&m_lock);
 
+	return done;
 }
 
 static void CreateThumbnail(FCam::Image &dest, const FCam::Image &source) {
@@ -91,43 +66,50 @@ static void CreateThumbnail(FCam::Image &dest, const FCam::Image &source) {
 		return;
 	}
 
-	int swidth = source.width();
-	int sheight = source.height();
-	int dwidth = dest.width();
-	int dheight = dest.height();
-	unsigned char *srcdata = source(0, 0);
-	unsigned char *dstdata = dest(0, 0);
-
-	int csize = swidth * sheight;
-	int dcsize = dwidth * dheight;
-
-	// Y
-	DownsampleChannel(dstdata, dwidth, dheight, srcdata, swidth, sheight);
-	// U
-	dstdata += dcsize;
-	srcdata += csize;
-	dwidth >>= 1;
-	dheight >>= 1;
-	swidth >>= 1;
-	sheight >>= 1;
-	DownsampleChannel(dstdata, dwidth, dheight, srcdata, swidth, sheight);
-	// V
-	dstdata += dcsize >> 2;
-	srcdata += csize >> 2;
-	DownsampleChannel(dstdata, dwidth, dheight, srcdata, swidth, sheight);
+	FCam::resample(source, dest, FCam::AreaResample);
 }
 
-void ImageSet::dumpToFileSystem(ASYNC_IMAGE_WRITER_CALLBACK onFileSystemChange) {
+void ImageSet::writeImage(int index, FileFormatDescriptor ff, const FCam::Frame &frame, ASYNC_IMAGE_WRITER_CALLBACK onFileSystemChange) {
 	char fname[128];
 	char buf[128];
 
 	// i/o error support does not exist. This is a to-do for NVidia folks.
-	int icount = m_frames.size();
+	Timer timer;
+
+	// write image
+	switch (ff.getFormat()) {
+	case FileFormatDescriptor::EFormatJPEG:
+		sprintf(fname, sImageName, m_fileId, index, sJpegExt);
+		sprintf(buf, "%s%s", m_outputDirPrefix, fname);
+		FCam::saveJPEG(frame, buf, ff.getQuality());
+		break;
+	}
+
+	// write thumbnail
+	FCam::Image thumbnail(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, FCam::YUV420p);
+	sprintf(fname, sThumbnailName, m_fileId, index);
+	sprintf(buf, "%s%s", m_outputDirPrefix, fname);
+	timer.tic();
+	CreateThumbnail(thumbnail, frame.image());
+	LOG("create thumbnail time: %.3f\n", timer.toc());
+	FCam::saveJPEG(thumbnail, buf, THUMBNAIL_QUALITY);
+
+	// notify fs change
+	if (onFileSystemChange != 0) {
+		onFileSystemChange();
+	}
+}
+
+void ImageSet::writeDescription(ASYNC_IMAGE_WRITER_CALLBACK onFileSystemChange) {
+	char fname[128];
+	char buf[128];
+
+	int icount = m_images.size();
 	if (icount == 0) {
 		return;
 	}
 
-	// output xml file
+	// output xml file, last, so that every file it refers to exists
 	sprintf(fname, sXmlName, m_fileId);
 	sprintf(buf, "%s%s", m_outputDirPrefix, fname);
 
@@ -137,7 +119,7 @@ void ImageSet::dumpToFileSystem(ASYNC_IMAGE_WRITER_CALLBACK onFileSystemChange)
 	fprintf(xml, "<imagestack imagecount=\"%i\">\n", icount);
 
 	for (int i = 0; i < icount; i++) {
-		const FCam::Frame &frame = m_frames[i];
+		const ImageInfo &info = m_images[i];
 
 		fprintf(xml, "<image ");
 		// image name
@@ -147,13 +129,13 @@ void ImageSet::dumpToFileSystem(ASYNC_IMAGE_WRITER_CALLBACK onFileSystemChange)
 		sprintf(fname, sThumbnailName, m_fileId, i);
 		fprintf(xml, "thumbnail=\"%s\" ", fname);
 		// flash on/off
-		fprintf(xml, "flash=\"%i\" ", frame.tags().find("flash.brightness") != frame.tags().end() ? 1 : 0);
+		fprintf(xml, "flash=\"%i\" ", info.flash ? 1 : 0);
 		// gain
-		fprintf(xml, "gain=\"%i\" ", (int)(frame.gain() * 100));
+		fprintf(xml, "gain=\"%i\" ", (int)(info.gain * 100));
 		// exposure
-		fprintf(xml, "exposure=\"%i\" ", frame.exposure());
+		fprintf(xml, "exposure=\"%i\" ", info.exposure);
 		// whitebalance
-		fprintf(xml, "wb=\"%i\" ", frame.whiteBalance());
+		fprintf(xml, "wb=\"%i\" ", info.whiteBalance);
 		fprintf(xml, "/>\n");
 	}
 
@@ -164,37 +146,6 @@ void ImageSet::dumpToFileSystem(ASYNC_IMAGE_WRITER_CALLBACK onFileSystemChange)
 	if (onFileSystemChange != 0) {
 		onFileSystemChange();
 	}
-
-	FCam::Image thumbnail(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, FCam::YUV420p);
-
-	Timer timer;
-
-	// output data files
-	for (int i = 0; i < icount; i++) {
-		const FCam::Frame &frame = m_frames[i];
-
-		// write image
-		switch (m_frameFormat[i].getFormat()) {
-		case FileFormatDescriptor::EFormatJPEG:
-			sprintf(fname, sImageName, m_fileId, i, sJpegExt);
-			sprintf(buf, "%s%s", m_outputDirPrefix, fname);
-            FCam::saveJPEG(frame, buf, m_frameFormat[i].getQuality());
-			break;
-		}
-
-		// write thumbnail
-		sprintf(fname, sThumbnailName, m_fileId, i);
-		sprintf(buf, "%s%s", m_outputDirPrefix, fname);
-		timer.tic();
-		CreateThumbnail(thumbnail, frame.image());
-		LOG("create thumbnail time: %.3f\n", timer.toc());
-        FCam::saveJPEG(thumbnail, buf, THUMBNAIL_QUALITY);
-
-		// notify fs change
-		if (onFileSystemChange != 0) {
-			onFileSystemChange();
-		}
-	}
 }
 
 
@@ -224,14 +175,20 @@ AsyncImageWriter::AsyncImageWriter(const char *outputDirPrefix) {
 	}
 
 	m_onChangedCallback = 0;
-	// launch the work thread
-	pthread_create(&m_thread, 0, AsyncImageWriter::ThreadProc, this);
+	// launch the work threads
+	for (int i = 0; i < IMAGE_WRITER_THREADS; i++) {
+		pthread_create(&m_threads[i], 0, AsyncImageWriter::ThreadProc, this);
+	}
 }
 
 AsyncImageWriter::~AsyncImageWriter(void) {
-	// null ImageSet terminates the work thread
-	m_queue.produce(0);
-	pthread_join(m_thread, 0);
+	// a job without an ImageSet terminates a work thread
+	for (int i = 0; i < IMAGE_WRITER_THREADS; i++) {
+		m_queue.produce(Job());
+	}
+	for (int i = 0; i < IMAGE_WRITER_THREADS; i++) {
+		pthread_join(m_threads[i], 0);
+	}
 
 	delete [] m_outputDirPrefix;
 }
@@ -258,9 +215,31 @@ ImageSet *AsyncImageWriter::newImageSet(void) {
 }
 
 void AsyncImageWriter::push(ImageSet *is) {
-	if (is != 0) {
-		m_queue.produce(is);
+	if (is == 0) {
+		return;
 	}
+
+	for (unsigned int i = 0; i < is->m_frames.size(); i++) {
+		pushFrame(is, is->m_frameFormat[i], is->m_frames[i]);
+	}
+	is->m_frames.clear();
+	is->m_frameFormat.clear();
+	close(is);
+}
+
+void AsyncImageWriter::pushFrame(ImageSet *is, const FileFormatDescriptor &ff, const FCam::Frame &frame) {
+	Job job;
+	job.imageSet = is;
+	job.index = is->addImage(frame);
+	job.format = ff;
+	job.frame = frame;
+	m_queue.produce(job);
+}
+
+void AsyncImageWriter::close(ImageSet *is) {
+	Job job;
+	job.imageSet = is;
+	m_queue.produce(job);
 }
 
 void AsyncImageWriter::setOnFileSystemChangedCallback(ASYNC_IMAGE_WRITER_CALLBACK cb) {
@@ -269,19 +248,29 @@ void AsyncImageWriter::setOnFileSystemChangedCallback(ASYNC_IMAGE_WRITER_CALLBAC
 
 void *AsyncImageWriter::ThreadProc(void *opaque) {
 	AsyncImageWriter *instance = (AsyncImageWriter *)opaque;
-	ImageSet *imageset;
+	Job job;
 
-	while (instance->m_queue.consume(imageset, true)) {
+	for (;;) {
+		instance->m_queue.consume(job, true);
+
+		ImageSet *imageset = job.imageSet;
 		if (imageset == 0) {
 			// end of work, leave
 			break;
 		}
 
-		imageset->dumpToFileSystem(instance->m_onChangedCallback);
-		delete imageset;
+		if (job.index >= 0) {
+			imageset->writeImage(job.index, job.format, job.frame, instance->m_onChangedCallback);
+		}
+		// drop our reference to the frame as soon as it is written
+		job = Job();
+
+		// whoever finishes the set last writes its description
+		if (imageset->release()) {
+			imageset->writeDescription(instance->m_onChangedCallback);
+			delete imageset;
+		}
 	}
 
 	return 0;
 }
-
-
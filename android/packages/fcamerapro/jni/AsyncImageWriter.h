@@ -42,14 +42,35 @@ private:
 	ImageSet(int id, const char *outputDirPrefix);
 	~ImageSet(void);
 
-	void dumpToFileSystem(ASYNC_IMAGE_WRITER_CALLBACK proc);
+	// What the xml description needs to know about each image, so that
+	// frames can be released as soon as they have been written.
+	struct ImageInfo {
+		bool flash;
+		float gain;
+		int exposure, whiteBalance;
+	};
+
+	int addImage(const FCam::Frame &frame);
+	bool release(void);
+	void writeImage(int index, FileFormatDescriptor ff, const FCam::Frame &frame, ASYNC_IMAGE_WRITER_CALLBACK proc);
+	void writeDescription(ASYNC_IMAGE_WRITER_CALLBACK proc);
 
+	// Frames added with add(), waiting for AsyncImageWriter::push()
 	std::vector<FCam::Frame> m_frames;
 	std::vector<FileFormatDescriptor> m_frameFormat;
+
+	std::vector<ImageInfo> m_images;
+	// Images queued but not yet written, plus one until the set is closed
+	int m_pending;
+	pthread_mutex_t m_lock;
 	const char *m_outputDirPrefix;
 	const int m_fileId;
 };
 
+// Number of threads encoding images. Each thread works on one frame at
+// a time, so the frames of a burst are encoded in parallel.
+#define IMAGE_WRITER_THREADS 2
+
 class AsyncImageWriter {
 public:
 	AsyncImageWriter(const char *outputDirPrefix);
@@ -57,16 +78,34 @@ public:
 
 	ImageSet *newImageSet(void);
 
+	// Queue every frame added to the set, and close it.
 	void push(ImageSet *is);
+	// Queue a single frame of a set as soon as it arrives. Call close()
+	// once the last frame has been pushed.
+	void pushFrame(ImageSet *is, const FileFormatDescriptor &ff, const FCam::Frame &frame);
+	// No more frames will be pushed to the set. It is written out and
+	// deleted once all of its images are done.
+	void close(ImageSet *is);
+
 	void setOnFileSystemChangedCallback(ASYNC_IMAGE_WRITER_CALLBACK cb);
 	static void SetFreeFileId(int id);
 
 private:
+	// A frame to write, or (with index -1) the end of an image set
+	struct Job {
+		Job(void) : imageSet(0), index(-1), format(FileFormatDescriptor::EFormatJPEG) { }
+
+		ImageSet *imageSet;
+		int index;
+		FileFormatDescriptor format;
+		FCam::Frame frame;
+	};
+
 	char *m_outputDirPrefix;
-	WorkQueue<ImageSet *> m_queue;
+	WorkQueue<Job> m_queue;
 	ASYNC_IMAGE_WRITER_CALLBACK m_onChangedCallback;
 
-	pthread_t m_thread;
+	pthread_t m_threads[IMAGE_WRITER_THREADS];
 	static void *ThreadProc(void *);
 
 	static int sFreeId;
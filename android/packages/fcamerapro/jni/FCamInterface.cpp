@@ -4,6 +4,7 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
+#include <set>
 #include <FCam/Tegra.h>
 #include "FCamInterface.h"
 #include "AsyncImageWriter.h"
@@ -20,12 +21,12 @@
 #define CAPTURE_IMAGE_WIDTH  2592
 #define CAPTURE_IMAGE_HEIGHT 1936
 
-#define PI_PLANE_SIZE (PREVIEW_IMAGE_WIDTH*PREVIEW_IMAGE_HEIGHT)
-#define PI_U_OFFSET   (PREVIEW_IMAGE_WIDTH*PREVIEW_IMAGE_HEIGHT)
-#define PI_V_OFFSET   (PREVIEW_IMAGE_WIDTH*PREVIEW_IMAGE_HEIGHT+(PREVIEW_IMAGE_WIDTH*PREVIEW_IMAGE_HEIGHT>>2))
-
 #define FPS_UPDATE_PERIOD 500 // in ms
 
+// How long a pipelined burst may take to come in, beyond its exposure
+// times, before it is written out with the frames that did arrive
+#define CAPTURE_TIMEOUT 2000 // in ms
+
 /* GL_OES_egl_image_external */
 #ifndef GL_OES_egl_image_external
 #define GL_OES_egl_image_external 1
@@ -43,6 +44,13 @@ static FCAM_INTERFACE_DATA *sAppData;
 
 static void *FCamAppThread(void *tdata);
 
+static int ViewBufferIndex(const FCam::Tegra::Hal::SharedBuffer *buffer) {
+	for (int i = 0; i < 3; i++) {
+		if (sAppData->viewBuffers[i] == buffer) return i;
+	}
+	return 0;
+}
+
 // ==========================================================================================
 // PUBLIC JNI FUNCTIONS
 // ==========================================================================================
@@ -52,6 +60,10 @@ extern "C" {
 JNIEXPORT int JNICALL Java_com_nvidia_fcamerapro_FCamInterface_lockViewerTexture(JNIEnv *env, jobject thiz) {
 	FCam::Tegra::Hal::SharedBuffer *buffer = sAppData->tripleBuffer->swapFrontBuffer();
 
+	// Keep the sensor from writing into the buffer while it's on screen.
+	sAppData->viewerBufferIndex = ViewBufferIndex(buffer);
+	sAppData->viewerImages[sAppData->viewerBufferIndex].lock();
+
 	GLuint tid;
     glGenTextures(1, &tid);
     glBindTexture(GL_TEXTURE_EXTERNAL_OES, tid);
@@ -72,6 +84,7 @@ JNIEXPORT int JNICALL Java_com_nvidia_fcamerapro_FCamInterface_getViewerTextureT
 
 JNIEXPORT void JNICALL Java_com_nvidia_fcamerapro_FCamInterface_unlockViewerTexture(JNIEnv *env, jobject thiz) {
     glDeleteTextures(1, &sAppData->viewerBufferTexId);
+    sAppData->viewerImages[sAppData->viewerBufferIndex].unlock();
 }
 
 JNIEXPORT void JNICALL Java_com_nvidia_fcamerapro_FCamInterface_setParamInt(JNIEnv *env, jobject thiz, jint param, jint value) {
@@ -137,6 +150,9 @@ JNIEXPORT int JNICALL Java_com_nvidia_fcamerapro_FCamInterface_getParamInt(JNIEn
 	case PARAM_TAKE_PICTURE:
 		rval = sAppData->isCapturing;
 		break;
+	case PARAM_CAPTURE_PIPELINED:
+		rval = sAppData->isCapturePipelined;
+		break;
 	default:
 		ERROR("received unsupported param id (%i)!", paramId);
 	}
@@ -272,9 +288,15 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
 	sAppData->fcamClassRef = env->NewGlobalRef(fcamClassRef);
 	env->DeleteLocalRef(fcamClassRef);
 
-	// Initialize tripple buffer.
-	for (unsigned int i = 0; i < 3; i++)
+	// Initialize tripple buffer. The buffers stay mapped for the lifetime of the app,
+	// and preview frames are delivered straight into them.
+	for (unsigned int i = 0; i < 3; i++) {
 		sAppData->viewBuffers[i] = new FCam::Tegra::Hal::SharedBuffer(PREVIEW_IMAGE_WIDTH, PREVIEW_IMAGE_HEIGHT);
+		uchar *data = (uchar *)sAppData->viewBuffers[i]->lock();
+		sAppData->viewImages[i] = FCam::Image(PREVIEW_IMAGE_WIDTH, PREVIEW_IMAGE_HEIGHT, FCam::YV12, data);
+		sAppData->viewerImages[i] = sAppData->viewImages[i];
+	}
+	sAppData->viewerBufferIndex = 0;
 	sAppData->tripleBuffer = new TripleBuffer<FCam::Tegra::Hal::SharedBuffer>(sAppData->viewBuffers);
 
 	// Initialize default shot parameters.
@@ -290,6 +312,7 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
 	// Set flags
 	sAppData->isCapturing = false;
 	sAppData->isViewerActive = false;
+	sAppData->isCapturePipelined = true;
 	sAppData->isGLInitDone = false;
 
 	return JNI_VERSION_1_4;
@@ -341,15 +364,27 @@ static void OnFileSystemChanged(void) {
 	sAppData->requestQueue.produce(ParamSetRequest(PARAM_PRIV_FS_CHANGED, &value, sizeof(int)));
 }
 
+// A burst requested in pipelined mode that has not been fully delivered
+// yet. The viewfinder keeps streaming, so its frames arrive interleaved
+// with the burst; they are told apart by shot id. If the sensor drops
+// some of the burst, the set is closed at the deadline (in Timer ms).
+typedef struct S_FCAM_PENDING_CAPTURE {
+	ImageSet *imageSet;
+	std::set<int> shotIds;
+	double deadline;
+} FCAM_PENDING_CAPTURE;
+
 static void OnCapture(FCAM_INTERFACE_DATA *tdata, AsyncImageWriter *writer, FCam::Tegra::Sensor &sensor,
-		FCam::Tegra::Flash &flash, FCam::Tegra::Lens &lens) {
+		FCam::Tegra::Flash &flash, FCam::Tegra::Lens &lens, FCAM_PENDING_CAPTURE *pending, double now) {
 	FCAM_SHOT_PARAMS *currentShot = &tdata->currentShot;
 	FCAM_SHOT_PARAMS *previousShot = &tdata->previousShot;
 
-	// Stop streaming and drain frames. It should not be necessary, but let's be safe.
-	sensor.stopStreaming();
-	while (sensor.shotsPending() > 0) {
-		sensor.getFrame();
+	// In blocking mode, stop streaming and drain frames. It should not be necessary, but let's be safe.
+	if (!tdata->isCapturePipelined) {
+		sensor.stopStreaming();
+		while (sensor.shotsPending() > 0) {
+			sensor.getFrame();
+		}
 	}
 
 	// Prepare a new image set.
@@ -361,8 +396,9 @@ static void OnCapture(FCAM_INTERFACE_DATA *tdata, AsyncImageWriter *writer, FCam
     flashAction.brightness = flash.maxBrightness();
 
 	// Request capture for each shot.
+	std::vector<FCam::Shot> burst(currentShot->burstSize);
 	for (int i = 0; i < currentShot->burstSize; i++) {
-	    FCam::Shot shot;
+	    FCam::Shot &shot = burst[i];
 	    shot.exposure = currentShot->captureSet[i].exposure;
 	    shot.gain = currentShot->captureSet[i].gain;
 	    shot.whiteBalance = currentShot->captureSet[i].wb;
@@ -372,11 +408,25 @@ static void OnCapture(FCAM_INTERFACE_DATA *tdata, AsyncImageWriter *writer, FCam
 	    if (currentShot->captureSet[i].flashOn != 0) {
 	        shot.addAction(flashAction);
 	    }
-	    sensor.capture(shot);
+	}
+	sensor.capture(burst);
+
+	if (tdata->isCapturePipelined) {
+		// Frames are handed to the writer by OnCaptureFrame as they arrive.
+		pending->imageSet = is;
+		pending->deadline = now + CAPTURE_TIMEOUT;
+		for (unsigned int i = 0; i < burst.size(); i++) {
+			pending->shotIds.insert(burst[i].id);
+			pending->deadline += burst[i].exposure / 1000.0;
+		}
+		if (pending->shotIds.empty()) {
+			writer->close(is);
+			pending->imageSet = 0;
+		}
+		return;
 	}
 
-    // Currently we pause capture while writing the file. It may be good
-	// to change this in the future so that writing occurs in the background.
+    // Capture is paused until the burst is in; writing still happens in the background.
     FileFormatDescriptor fmt(FileFormatDescriptor::EFormatJPEG, 95);
 	while (sensor.shotsPending() > 0) {
 		is->add(fmt, sensor.getFrame());
@@ -384,6 +434,37 @@ static void OnCapture(FCAM_INTERFACE_DATA *tdata, AsyncImageWriter *writer, FCam
 	writer->push(is);
 }
 
+// Hands a frame of a pending pipelined burst to the writer. Returns false
+// if the frame is not part of the burst.
+static bool OnCaptureFrame(AsyncImageWriter *writer, FCAM_PENDING_CAPTURE *pending, const FCam::Frame &frame) {
+	if (pending->imageSet == 0 || !frame.valid() || pending->shotIds.erase(frame.shot().id) == 0) {
+		return false;
+	}
+
+	writer->pushFrame(pending->imageSet, FileFormatDescriptor(FileFormatDescriptor::EFormatJPEG, 95), frame);
+	if (pending->shotIds.empty()) {
+		// that was the last one
+		writer->close(pending->imageSet);
+		pending->imageSet = 0;
+	}
+	return true;
+}
+
+// Gives up on the rest of a pending pipelined burst once its deadline
+// has passed, e.g. because the sensor dropped some of its frames, and
+// writes out the frames that did arrive. Returns true if it did.
+static bool OnCaptureTimeout(AsyncImageWriter *writer, FCAM_PENDING_CAPTURE *pending, double now) {
+	if (pending->imageSet == 0 || now < pending->deadline) {
+		return false;
+	}
+
+	ERROR("OnCaptureTimeout(): %i frame(s) of the burst never arrived, closing the image set", (int)pending->shotIds.size());
+	pending->shotIds.clear();
+	writer->close(pending->imageSet);
+	pending->imageSet = 0;
+	return true;
+}
+
 // This method is the main workhorse, and is run by the camera thread.
 static void *FCamAppThread(void *ptr) {
 	FCAM_INTERFACE_DATA *tdata = (FCAM_INTERFACE_DATA *)ptr;
@@ -398,10 +479,14 @@ static void *FCamAppThread(void *ptr) {
     FCam::Tegra::Flash flash;
     sensor.attach(&lens);
     sensor.attach(&flash);
+    // If the preview loop falls behind, thin out the viewfinder stream
+    // rather than letting frames queue up.
+    sensor.setDropPolicy(FCam::Sensor::DropAdaptive);
     MyAutoFocus autofocus(&lens);
 
-    FCam::Image previewImage(PREVIEW_IMAGE_WIDTH, PREVIEW_IMAGE_HEIGHT, FCam::YUV420p);
     FCam::Tegra::Shot shot;
+    // The autofocus setting of the shot last passed to sensor.stream
+    bool streamedAutoFocus = false;
 
     // Initialize FPS stat calculation.
     tdata->captureFps = 30; // assuming 30hz
@@ -412,6 +497,10 @@ static void *FCamAppThread(void *ptr) {
     std::queue<ParamSetRequest> taskQueue;
 	ParamSetRequest task;
 
+	// Burst being captured in the background, if any.
+	FCAM_PENDING_CAPTURE pendingCapture;
+	pendingCapture.imageSet = 0;
+
 	for (;;) {
 		FCAM_SHOT_PARAMS *currentShot = &tdata->currentShot;
 		FCAM_SHOT_PARAMS *previousShot = &tdata->previousShot;
@@ -504,18 +593,24 @@ static void *FCamAppThread(void *ptr) {
 				AsyncImageWriter::SetFreeFileId(taskData[0]);
 				break;
 			case PARAM_TAKE_PICTURE:
-				if (writer != 0 && task.getDataAsInt() != 0) { // Don't take picture if we can't write out.
+				// Don't take picture if we can't write out, or if the last burst is still coming in.
+				if (writer != 0 && pendingCapture.imageSet == 0 && task.getDataAsInt() != 0) {
 					// capture begin
 					tdata->isCapturing = true;
 					// notify capture start
 					env->CallVoidMethod(tdata->fcamInstanceRef, tdata->notifyCaptureStart);
-					OnCapture(tdata, writer, sensor, flash, lens);
-					// capture done
-					tdata->isCapturing = false;
-					// notify capture completion
-					env->CallVoidMethod(tdata->fcamInstanceRef, tdata->notifyCaptureComplete);
+					OnCapture(tdata, writer, sensor, flash, lens, &pendingCapture, timer.get());
+					if (pendingCapture.imageSet == 0) {
+						// capture done
+						tdata->isCapturing = false;
+						// notify capture completion
+						env->CallVoidMethod(tdata->fcamInstanceRef, tdata->notifyCaptureComplete);
+					}
 				}
 				break;
+			case PARAM_CAPTURE_PIPELINED:
+				tdata->isCapturePipelined = taskData[0] != 0;
+				break;
 			case PARAM_PRIV_FS_CHANGED:
 				if (taskData[0] != 0) {
 					// notify fs change
@@ -537,13 +632,14 @@ static void *FCamAppThread(void *ptr) {
 			}
 	    }
 
-		if (!tdata->isViewerActive) continue; // Viewer is inactive, so skip capture.
+		// Viewer is inactive, so skip capture, unless a burst is still coming in.
+		if (!tdata->isViewerActive && pendingCapture.imageSet == 0) continue;
 
 		// Setup preview shot parameters.
 	    shot.exposure = currentShot->preview.autoExposure ? previousShot->preview.evaluated.exposure : currentShot->preview.user.exposure;
 	    shot.gain = currentShot->preview.autoGain ? previousShot->preview.evaluated.gain : currentShot->preview.user.gain;
 	    shot.whiteBalance = currentShot->preview.autoWB ? previousShot->preview.evaluated.wb : currentShot->preview.user.wb;
-	    shot.image = previewImage;
+	    shot.image = tdata->viewImages[ViewBufferIndex(tdata->tripleBuffer->getBackBuffer())];
 	    shot.histogram.enabled = true;
 	    shot.histogram.region = FCam::Rect(0, 0, PREVIEW_IMAGE_WIDTH, PREVIEW_IMAGE_HEIGHT);
 	    shot.sharpness.enabled = currentShot->preview.autoFocus;
@@ -551,21 +647,48 @@ static void *FCamAppThread(void *ptr) {
 	    shot.fastMode = true;
 	    shot.clearActions();
 
-	    // If in manual focus mode, and the lens is not at the right place, add an action to move it.
-	    if (!currentShot->preview.autoFocus && previousShot->preview.user.focus != currentShot->preview.user.focus) {
-	    	shot.clearActions();
-            FCam::Lens::FocusAction focusAction(&lens);
-            focusAction.time = 0;
-            focusAction.focus = currentShot->preview.user.focus;
-            shot.addAction(focusAction);
+	    // If in manual focus mode, and the lens is not at the right place, move it.
+	    bool moveLens = !currentShot->preview.autoFocus && previousShot->preview.user.focus != currentShot->preview.user.focus;
+
+	    // Send the shot request to FCam. Once the viewfinder is streaming, only the
+	    // parameters that change from frame to frame are sent, which is much cheaper
+	    // than replacing the streaming shot. Toggling autofocus changes the sharpness
+	    // settings, so that needs a new shot.
+	    if (sensor.streaming() && streamedAutoFocus == currentShot->preview.autoFocus) {
+	    	FCam::Tegra::StreamUpdate update;
+	    	update.setExposure(shot.exposure);
+	    	update.setGain(shot.gain);
+	    	update.setWhiteBalance(shot.whiteBalance);
+	    	update.setImage(shot.image);
+	    	if (moveLens) update.setFocus(&lens, currentShot->preview.user.focus);
+	    	sensor.updateStream(update);
+	    } else {
+	    	// The streaming shot carries no actions, as they would be repeated on every
+	    	// frame until the next new shot, undoing any later focus updates.
+	    	sensor.stream(shot);
+	    	streamedAutoFocus = currentShot->preview.autoFocus;
+	    	if (moveLens) {
+	    		FCam::Tegra::StreamUpdate update;
+	    		update.setFocus(&lens, currentShot->preview.user.focus);
+	    		sensor.updateStream(update);
+	    	}
 	    }
 
-	    // Send the shot request to FCam.
-	    sensor.stream(shot);
-
 	    // Fetch the incoming frame from FCam.
 	    FCam::Frame frame = sensor.getFrame();
 
+	    // Frames of a pipelined burst go straight to the writer.
+	    bool burstFrame = OnCaptureFrame(writer, &pendingCapture, frame);
+	    if (burstFrame || OnCaptureTimeout(writer, &pendingCapture, timer.get())) {
+	    	if (pendingCapture.imageSet == 0) {
+	    		// capture done
+	    		tdata->isCapturing = false;
+	    		// notify capture completion
+	    		env->CallVoidMethod(tdata->fcamInstanceRef, tdata->notifyCaptureComplete);
+	    	}
+	    	if (burstFrame) continue;
+	    }
+
 	    // Process the incoming frame. If autoExposure or autoGain is enabled, update parameters based on the frame.
 	    if (currentShot->preview.autoExposure || currentShot->preview.autoGain) {
 	    	FCam::autoExpose(&shot, frame, sensor.maxGain(), sensor.maxExposure(), sensor.minExposure(), 0.3);
@@ -589,33 +712,34 @@ static void *FCamAppThread(void *ptr) {
 	    // TODO TODO TODO
 	    // TODO TODO TODO
 
-	    // Update histogram data
+	    // Update histogram data. While the sensor is shedding load, some frames come
+	    // without statistics; keep showing the last histogram for those.
 	    const FCam::Histogram &histogram = frame.histogram();
-	    int maxBinValue = 1;
-	    for (int i = 0; i < 64; i++) {
-	    	int currBinValue = histogram(i);
-	    	maxBinValue = (currBinValue > maxBinValue) ? currBinValue : maxBinValue;
-	    	currentShot->histogramData[i * 4] = currBinValue;
-	    }
-	    float norm = 1.0f / maxBinValue;
-	    for (int i = 0; i < 64; i++) {
-	    	currentShot->histogramData[i * 4] *= norm;
-	    	currentShot->histogramData[i * 4 + 1] = 0.0f;
-	    	currentShot->histogramData[i * 4 + 2] = 0.0f;
-	    	currentShot->histogramData[i * 4 + 3] = 0.0f;
+	    if (histogram.valid()) {
+	    	int maxBinValue = 1;
+	    	for (int i = 0; i < 64; i++) {
+	    		int currBinValue = histogram(i);
+	    		maxBinValue = (currBinValue > maxBinValue) ? currBinValue : maxBinValue;
+	    		currentShot->histogramData[i * 4] = currBinValue;
+	    	}
+	    	float norm = 1.0f / maxBinValue;
+	    	for (int i = 0; i < 64; i++) {
+	    		currentShot->histogramData[i * 4] *= norm;
+	    		currentShot->histogramData[i * 4 + 1] = 0.0f;
+	    		currentShot->histogramData[i * 4 + 2] = 0.0f;
+	    		currentShot->histogramData[i * 4 + 3] = 0.0f;
+	    	}
 	    }
 
-	    // Update the frame buffer.
-	    uchar *src = (uchar *)frame.image()(0, 0);
-	    FCam::Tegra::Hal::SharedBuffer *captureBuffer = tdata->tripleBuffer->getBackBuffer();
-	    uchar *dest = (uchar *)captureBuffer->lock();
-
-	    // Note: why do we need to shuffle U and V channels? It seems to be a bug.
-	    memcpy(dest, src, PI_PLANE_SIZE);
-	    memcpy(dest + PI_U_OFFSET, src + PI_V_OFFSET, PI_PLANE_SIZE >> 2);
-	    memcpy(dest + PI_V_OFFSET, src + PI_U_OFFSET, PI_PLANE_SIZE >> 2);
-	    captureBuffer->unlock();
-	    tdata->tripleBuffer->swapBackBuffer();
+	    // Update the frame buffer. The frame was delivered straight into one of the
+	    // view buffers, so there is nothing to copy, just publish it if it landed in
+	    // the back buffer. Frames that were already in flight when the back buffer
+	    // changed land in the spare buffer, which gets shown anyway, or in the front
+	    // buffer, which is locked while on screen, so FCam drops their image data.
+	    FCam::Image backImage = tdata->viewImages[ViewBufferIndex(tdata->tripleBuffer->getBackBuffer())];
+	    if (frame.image().valid() && frame.image()(0, 0) == backImage(0, 0)) {
+	    	tdata->tripleBuffer->swapBackBuffer();
+	    }
 
 	    // Frame capture complete, copy current shot data to previous one
 	    pthread_mutex_lock(&tdata->currentShotLock);
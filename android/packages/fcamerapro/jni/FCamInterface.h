@@ -7,6 +7,7 @@
 #include "TripleBuffer.h"
 #include "ParamSetRequest.h"
 #include "FCam/Tegra/hal/SharedBuffer.h"
+#include "FCam/Image.h"
 
 #define FCAM_MAX_PICTURES_PER_SHOT 16
 
@@ -39,6 +40,11 @@ typedef struct S_FCAM_NATIVE_THREAD_DATA {
 	FCam::Tegra::Hal::SharedBuffer *viewBuffers[3];
 	TripleBuffer<FCam::Tegra::Hal::SharedBuffer> *tripleBuffer;
 	uint viewerBufferTexId;
+	// The view buffers as YV12 images, which the sensor writes preview frames into.
+	// The app thread uses viewImages, the GL thread has its own references in
+	// viewerImages, and locks the one it is displaying.
+	FCam::Image viewImages[3], viewerImages[3];
+	int viewerBufferIndex;
 
 	WorkQueue<ParamSetRequest> requestQueue;
 
@@ -47,6 +53,7 @@ typedef struct S_FCAM_NATIVE_THREAD_DATA {
 	std::string nextShootFileName;
 	float captureFps;
 	bool isCapturing, isViewerActive;
+	bool isCapturePipelined;
 	bool isGLInitDone;
 } FCAM_INTERFACE_DATA;
 
@@ -39,6 +39,7 @@
 #define PARAM_PREVIEW_AUTO_WB_ON       15
 #define PARAM_CAPTURE_FPS              16
 #define PARAM_TAKE_PICTURE             17
+#define PARAM_CAPTURE_PIPELINED        18
 /* [CS478]
  * The constants above are message types parsed by the work thread.
  * (Go look at the giant switch-case statement in FCamInterface.cpp.)
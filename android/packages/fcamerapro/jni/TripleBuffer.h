@@ -1,77 +1,77 @@
 #ifndef _TRIPLEBUFFER_H
 #define _TRIPLEBUFFER_H
 
-#include <pthread.h>
-
+// Triple buffering between one producer (the camera thread, which fills the
+// back buffer) and one consumer (the renderer, which shows the front buffer).
+// The third, spare buffer holds the most recently completed frame until the
+// renderer picks it up.
+//
+// The roles of the three buffers and whether the spare holds a frame not yet
+// shown are packed into one word, which both sides update with
+// compare-and-swap. Neither side ever waits for the other.
 template<class T> class TripleBuffer {
 public:
 	TripleBuffer(T *buffers[3]) {
-		pthread_mutex_init(&m_lock, 0);
-		m_frontBuffer = buffers[0];
-		m_backBuffer = buffers[1];
-		m_spareBuffer = buffers[2];
-		m_updateFrontBuffer = false;
+		for (int i = 0; i < 3; i++) {
+			m_buffers[i] = buffers[i];
+		}
+		m_state = pack(0, 1, 2, false);
 	}
 
 	~TripleBuffer(void) {
-		pthread_mutex_destroy(&m_lock);
 	}
 
 	T *getFrontBuffer(void) {
-		T *rval;
-
-		pthread_mutex_lock(&m_lock);
-		rval = m_frontBuffer;
-		pthread_mutex_unlock(&m_lock);
-
-		return rval;
+		return m_buffers[front(load())];
 	}
 
+	// Called by the consumer: show the latest completed frame, if there is a
+	// new one.
 	T *swapFrontBuffer(void) {
-		T *rval;
-
-		pthread_mutex_lock(&m_lock);
-		if (m_updateFrontBuffer) {
-			rval = m_spareBuffer;
-			m_spareBuffer = m_frontBuffer;
-			m_frontBuffer = rval;
-			m_updateFrontBuffer = false;
-		} else {
-			rval = m_frontBuffer;
-		}
-		pthread_mutex_unlock(&m_lock);
-
-		return rval;
+		int state, newState;
+		do {
+			state = load();
+			if (!updated(state)) {
+				return m_buffers[front(state)];
+			}
+			newState = pack(spare(state), back(state), front(state), false);
+		} while (__sync_val_compare_and_swap(&m_state, state, newState) != state);
+
+		return m_buffers[front(newState)];
 	}
 
+	// Only the producer changes the back buffer, so this needs no
+	// synchronization.
 	T *getBackBuffer(void) {
-		T *rval;
-
-		pthread_mutex_lock(&m_lock);
-		rval = m_backBuffer;
-		pthread_mutex_unlock(&m_lock);
-
-		return rval;
+		return m_buffers[back(load())];
 	}
 
+	// Called by the producer once the back buffer holds a complete frame.
 	T *swapBackBuffer(void) {
-		T *rval;
-
-		pthread_mutex_lock(&m_lock);
-		rval = m_spareBuffer;
-		m_spareBuffer = m_backBuffer;
-		m_backBuffer = rval;
-		m_updateFrontBuffer = true;
-		pthread_mutex_unlock(&m_lock);
+		int state, newState;
+		do {
+			state = load();
+			newState = pack(front(state), spare(state), back(state), true);
+		} while (__sync_val_compare_and_swap(&m_state, state, newState) != state);
 
-		return rval;
+		return m_buffers[back(newState)];
 	}
 
 private:
-	T *m_frontBuffer, *m_backBuffer, *m_spareBuffer;
-	bool m_updateFrontBuffer;
-	pthread_mutex_t m_lock;
+	int load(void) {
+		return __sync_fetch_and_add(&m_state, 0);
+	}
+
+	static int pack(int front, int back, int spare, bool updated) {
+		return front | (back << 2) | (spare << 4) | (updated ? 0x40 : 0);
+	}
+	static int front(int state) { return state & 3; }
+	static int back(int state) { return (state >> 2) & 3; }
+	static int spare(int state) { return (state >> 4) & 3; }
+	static bool updated(int state) { return (state & 0x40) != 0; }
+
+	T *m_buffers[3];
+	volatile int m_state;
 };
 
 #endif
-
@@ -5,63 +5,199 @@
 #include <semaphore.h>
 #include <queue>
 
-template<class T> class WorkQueue {
+// Multiple producer, multiple consumer queue on a fixed ring of slots,
+// so elements are copied into place rather than allocated. Each slot
+// carries a sequence number saying whose turn it is: a slot at position
+// p is free for a producer when its sequence is p, holds an element for
+// a consumer when it is p + 1, and is handed on to position p + Capacity
+// once consumed. Producers and consumers claim positions with a compare
+// and swap, and take no lock. consumeAll() claims every ready element
+// with a single compare and swap.
+//
+// A producer finding the ring full sleeps until a consumer makes room,
+// and a consumer finding it empty in a blocking consume() sleeps until a
+// producer fills a slot. The semaphores are only posted while someone is
+// waiting on them, so neither side makes a system call in the common
+// case.
+template<class T, unsigned int Capacity = 1024> class WorkQueue {
 public:
 	WorkQueue(void) {
-		pthread_mutex_init(&m_lock, 0);
-		sem_init(&m_counterSem, 0, 0);
+		for (unsigned int i = 0; i < Capacity; i++) {
+			m_slots[i].sequence = i;
+		}
+		m_enqueuePos = 0;
+		m_dequeuePos = 0;
+		m_consumersWaiting = 0;
+		m_producersWaiting = 0;
+		sem_init(&m_elementSem, 0, 0);
+		sem_init(&m_roomSem, 0, 0);
 	}
 
 	~WorkQueue(void) {
-		sem_destroy(&m_counterSem);
-		pthread_mutex_destroy(&m_lock);
+		sem_destroy(&m_elementSem);
+		sem_destroy(&m_roomSem);
 	}
 
 	void produce(const T &elem) {
-		pthread_mutex_lock(&m_lock);
-		m_queue.push(elem);
-		sem_post(&m_counterSem);
-		pthread_mutex_unlock(&m_lock);
+		unsigned int pos = load(&m_enqueuePos);
+		Slot *slot;
+		for (;;) {
+			slot = &m_slots[pos % Capacity];
+			int diff = (int)(load(&slot->sequence) - pos);
+			if (diff == 0) {
+				unsigned int seen = __sync_val_compare_and_swap(&m_enqueuePos, pos, pos + 1);
+				if (seen == pos) break;
+				pos = seen;
+			} else if (diff < 0) {
+				// full, wait for a consumer to make room
+				__sync_fetch_and_add(&m_producersWaiting, 1);
+				if ((int)(load(&slot->sequence) - pos) < 0) {
+					sem_wait(&m_roomSem);
+				}
+				__sync_fetch_and_sub(&m_producersWaiting, 1);
+				pos = load(&m_enqueuePos);
+			} else {
+				pos = load(&m_enqueuePos);
+			}
+		}
+
+		slot->elem = elem;
+		publish(&slot->sequence, 1);
+		wake(&m_consumersWaiting, &m_elementSem);
 	}
 
 	bool consume(T &elem, bool blocking = true) {
-		if (blocking) {
-			sem_wait(&m_counterSem);
-		} else {
-			if (sem_trywait(&m_counterSem) != 0) {
+		while (!pop(elem)) {
+			if (!blocking) {
 				return false;
 			}
+			// Announce the wait before looking again, so a producer
+			// either sees us waiting or we see its element.
+			__sync_fetch_and_add(&m_consumersWaiting, 1);
+			if (pop(elem)) {
+				__sync_fetch_and_sub(&m_consumersWaiting, 1);
+				return true;
+			}
+			sem_wait(&m_elementSem);
+			__sync_fetch_and_sub(&m_consumersWaiting, 1);
 		}
-
-		pthread_mutex_lock(&m_lock);
-		elem = m_queue.front();
-		m_queue.pop();
-		pthread_mutex_unlock(&m_lock);
-
 		return true;
 	}
 
+	// Move every element queued so far to the back of queue, without
+	// blocking.
 	void consumeAll(std::queue<T> &queue) {
-		pthread_mutex_lock(&m_lock);
-		queue = m_queue;
-		if (!m_queue.empty()) {
-			m_queue = std::queue<T>();
-			// NVIDIA note: This assumes no concurrent call to consume. Fix?
-			sem_destroy(&m_counterSem);
-			sem_init(&m_counterSem, 0, 0);
+		for (;;) {
+			unsigned int pos = load(&m_dequeuePos);
+			unsigned int ready = 0;
+			while (ready < Capacity && load(&m_slots[(pos + ready) % Capacity].sequence) == pos + ready + 1) {
+				ready++;
+			}
+			if (ready == 0) {
+				return;
+			}
+			if (__sync_val_compare_and_swap(&m_dequeuePos, pos, pos + ready) != pos) {
+				// another consumer got there first
+				continue;
+			}
+			for (unsigned int i = 0; i < ready; i++) {
+				Slot &slot = m_slots[(pos + i) % Capacity];
+				queue.push(slot.elem);
+				slot.elem = T();
+			}
+			// One barrier hands the whole run back to the producers
+			__sync_synchronize();
+			for (unsigned int i = 0; i < ready; i++) {
+				store(&m_slots[(pos + i) % Capacity].sequence, pos + i + Capacity);
+			}
+			__sync_synchronize();
+			wake(&m_producersWaiting, &m_roomSem);
+			return;
 		}
-		pthread_mutex_unlock(&m_lock);
 	}
 
+	// Approximate, as producers and consumers may be busy concurrently.
 	int size(void) {
-		return m_queue.size();
+		return (int)(load(&m_enqueuePos) - load(&m_dequeuePos));
 	}
 
 private:
-	std::queue<T> m_queue;
-	pthread_mutex_t m_lock;
-	sem_t m_counterSem;
-};
+	struct Slot {
+		volatile unsigned int sequence;
+		T elem;
+	};
+
+	// Positions and sequence numbers are read without a barrier, as
+	// the compare and swap that claims a position orders the read
+	// before the element is touched, and the consumers' stores follow
+	// an explicit barrier. ThreadSanitizer can't see that, so give it
+	// atomics instead.
+#if defined(__SANITIZE_THREAD__)
+	static unsigned int load(volatile unsigned int *p) {
+		return __sync_fetch_and_add(p, 0);
+	}
+
+	static void store(volatile unsigned int *p, unsigned int value) {
+		(void)__sync_lock_test_and_set(p, value);
+	}
+#else
+	static unsigned int load(volatile unsigned int *p) {
+		return *p;
+	}
 
+	static void store(volatile unsigned int *p, unsigned int value) {
+		*p = value;
+	}
 #endif
 
+	// Hand a slot to the other side by moving its sequence number on.
+	// Being a full barrier, the add also keeps the following read of
+	// the waiting count from moving ahead of it.
+	static void publish(volatile unsigned int *sequence, unsigned int step) {
+		__sync_add_and_fetch(sequence, step);
+	}
+
+	// Post once for every thread waiting on sem. A thread that finds
+	// what it was waiting for before sleeping leaves a spare post
+	// behind, which only costs the next waiter another look.
+	static void wake(volatile unsigned int *waiting, sem_t *sem) {
+		for (unsigned int n = load(waiting); n > 0; n--) {
+			sem_post(sem);
+		}
+	}
+
+	bool pop(T &elem) {
+		unsigned int pos = load(&m_dequeuePos);
+		Slot *slot;
+		for (;;) {
+			slot = &m_slots[pos % Capacity];
+			int diff = (int)(load(&slot->sequence) - (pos + 1));
+			if (diff == 0) {
+				unsigned int seen = __sync_val_compare_and_swap(&m_dequeuePos, pos, pos + 1);
+				if (seen == pos) break;
+				pos = seen;
+			} else if (diff < 0) {
+				// empty
+				return false;
+			} else {
+				pos = load(&m_dequeuePos);
+			}
+		}
+
+		elem = slot->elem;
+		slot->elem = T();
+		publish(&slot->sequence, Capacity - 1);
+		wake(&m_producersWaiting, &m_roomSem);
+		return true;
+	}
+
+	Slot m_slots[Capacity];
+	volatile unsigned int m_enqueuePos;
+	volatile unsigned int m_dequeuePos;
+	volatile unsigned int m_consumersWaiting;
+	volatile unsigned int m_producersWaiting;
+	sem_t m_elementSem;
+	sem_t m_roomSem;
+};
+
+#endif
@@ -37,6 +37,7 @@ public final class FCamInterface {
 	final static private int PARAM_PREVIEW_AUTO_WB_ON = 15;
 	final static private int PARAM_CAPTURE_FPS = 16;
 	final static private int PARAM_TAKE_PICTURE = 17;
+	final static private int PARAM_CAPTURE_PIPELINED = 18;
 	
 	final static private int SHOT_PARAM_EXPOSURE = 0;
 	final static private int SHOT_PARAM_FOCUS = 1;
@@ -189,6 +190,18 @@ public final class FCamInterface {
 		setParamInt(PARAM_OUTPUT_FILE_ID, id);
 	}
 
+	/* When enabled (the default), the viewfinder keeps running during a
+	 * capture, and the images are encoded in the background as they arrive.
+	 * When disabled, the viewfinder pauses until the whole burst has been
+	 * captured. */
+	public void setPipelinedCapture(boolean enabled) {
+		setParamInt(PARAM_CAPTURE_PIPELINED, enabled ? 1 : 0);
+	}
+
+	public boolean isPipelinedCapture() {
+		return getParamInt(PARAM_CAPTURE_PIPELINED) != 0;
+	}
+
 	/* ====================================================================
 	 * Native Interface. These mare defined in jni/FCamInterface.app.
 	 * ==================================================================== */
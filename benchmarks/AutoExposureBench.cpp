@@ -0,0 +1,144 @@
+// Convergence of metering after sudden changes in scene brightness.
+//
+// A simulated sensor applies exposure and gain changes a fixed number
+// of frames after they are requested, and hands each frame to the
+// application a fixed number of frames after it was requested, with
+// the exposure and gain it was actually taken with. The scene steps
+// through a sequence of brightness levels, holding each one for a
+// while. For autoExpose and for the AutoExposure controller, reports
+// how many frames it takes after each step for the exposure to settle
+// within 10% of where it ends up, and how far it overshoots on the
+// way.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <FCam/AutoExposure.h>
+#include <FCam/Frame.h>
+#include <FCam/Shot.h>
+#include <FCam/Tegra/Platform.h>
+
+static const int latency = 2;       // frames before a change takes effect
+static const int pipelineDepth = 2; // frames before a frame is returned
+static const int segmentFrames = 60;
+static const int buckets = 64;
+
+struct SimFrame : public FCam::_Frame {
+    FCam::Shot _shot;
+    const FCam::Shot &baseShot() const {return _shot;}
+    const FCam::Platform &platform() const {return FCam::Tegra::Platform::instance();}
+};
+
+// A frame of a scene with pixel radiances spread log-uniformly over
+// two decades below level, taken with the given exposure and gain
+static FCam::Frame makeFrame(const FCam::Shot &requested, int exposure, float gain, float level) {
+    SimFrame *f = new SimFrame;
+    f->_shot = requested;
+    f->exposure = exposure;
+    f->gain = gain;
+    f->histogram = FCam::Histogram(buckets, 1, FCam::Rect(0, 0, 640, 480));
+    const int samples = 4000;
+    for (int i = 0; i < samples; i++) {
+        float radiance = level * powf(100.0f, (float)i / samples - 1.0f);
+        float v = radiance * exposure * gain / 20000.0f;
+        int b = (int)(v * buckets);
+        if (b >= buckets) b = buckets - 1;
+        f->histogram(b, 0)++;
+    }
+    return FCam::Frame(f);
+}
+
+struct Stats {
+    int steps;
+    int settleFrames, worstSettleFrames;
+    float overshoot;
+};
+
+template<typename Meter>
+static Stats run(Meter meter, const std::vector<float> &levels) {
+    FCam::Shot shot;
+    shot.exposure = 10000;
+    shot.gain = 1.0f;
+
+    std::vector<FCam::Shot> requested;
+    std::vector<float> brightness;
+    int total = levels.size() * segmentFrames;
+    for (int k = 0; k < total; k++) {
+        // Frame k is requested with the current shot, and exposed
+        // with the shot requested latency frames earlier
+        requested.push_back(shot);
+        const FCam::Shot &applied = requested[k >= latency ? k - latency : 0];
+        brightness.push_back(applied.exposure * applied.gain);
+
+        // Frame k - pipelineDepth comes back now
+        int r = k - pipelineDepth;
+        if (r >= 0) {
+            const FCam::Shot &used = requested[r >= latency ? r - latency : 0];
+            FCam::Frame f = makeFrame(requested[r], used.exposure, used.gain, levels[r / segmentFrames]);
+            meter(&shot, f);
+        }
+    }
+
+    Stats st = {0, 0, 0, 0};
+    for (size_t s = 1; s < levels.size(); s++) {
+        int begin = s * segmentFrames, end = begin + segmentFrames;
+        float final = brightness[end - 1];
+        float before = brightness[begin - 1];
+        int settled = 0;
+        for (int k = end - 1; k >= begin; k--) {
+            if (fabs(logf(brightness[k] / final)) > logf(1.1f)) {
+                settled = k + 1 - begin;
+                break;
+            }
+        }
+        // Overshoot past the final value, relative to the size of the step
+        float worst = 0;
+        for (int k = begin; k < end; k++) {
+            float past = (final > before) ? logf(brightness[k] / final) : logf(final / brightness[k]);
+            float step = fabs(logf(final / before));
+            if (step > 0 && past / step > worst) worst = past / step;
+        }
+        st.steps++;
+        st.settleFrames += settled;
+        if (settled > st.worstSettleFrames) st.worstSettleFrames = settled;
+        if (worst > st.overshoot) st.overshoot = worst;
+    }
+    return st;
+}
+
+struct SimpleMeter {
+    void operator()(FCam::Shot *s, const FCam::Frame &f) {
+        FCam::autoExpose(s, f, 32.0f, 125000, 500, 0.5f);
+    }
+};
+
+struct PredictiveMeter {
+    FCam::AutoExposure *ae;
+    void operator()(FCam::Shot *s, const FCam::Frame &f) {
+        ae->update(s, f);
+    }
+};
+
+static void report(const char *method, const Stats &st) {
+    printf("{\"benchmark\": \"autoexposure\", \"method\": \"%s\", \"steps\": %d, "
+           "\"latency_frames\": %d, \"pipeline_frames\": %d, "
+           "\"mean_settle_frames\": %.1f, \"max_settle_frames\": %d, \"max_overshoot\": %.2f}\n",
+           method, st.steps, latency, pipelineDepth,
+           (float)st.settleFrames / st.steps, st.worstSettleFrames, st.overshoot);
+}
+
+int main(int argc, char **argv) {
+    // Scene brightness steps, from dim indoor to bright and back
+    float sequence[] = {1.0f, 8.0f, 0.5f, 2.0f, 32.0f, 1.0f, 0.25f, 4.0f, 1.5f, 12.0f};
+    std::vector<float> levels(sequence, sequence + sizeof(sequence)/sizeof(sequence[0]));
+
+    SimpleMeter simple;
+    report("autoExpose", run(simple, levels));
+
+    FCam::AutoExposure ae;
+    PredictiveMeter predictive = {&ae};
+    report("AutoExposure", run(predictive, levels));
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Simulated-lens comparison of focus searches.
+//
+// A simulated lens with a fixed focus latency and finite focus speed
+// is driven by a simulated sensor pipeline: frame k is exposed during
+// [k*T, k*T + exposure] and handed to the application pipelineDepth
+// frames later, tagged with the lens position at the start and end of
+// its exposure. The sharpness of a frame peaks at a random focus
+// distance and falls off when the lens is away from it, or moving.
+//
+// Two searches are compared on the same scenes: FCam::AutoFocus, and
+// the kind of full sweep an application does without lens tags, which
+// steps through the range and waits out the worst case latency after
+// each move. Reports frames and simulated milliseconds to focus lock,
+// and the final focus error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <FCam/AutoFocus.h>
+#include <FCam/Lens.h>
+#include <FCam/Frame.h>
+#include <FCam/Tegra/Platform.h>
+
+// Simulated clock, in microseconds
+static int now = 0;
+
+static const int frameTime = 33333;
+static const int exposure = 20000;
+static const int pipelineDepth = 2;
+
+class SimLens : public FCam::Lens {
+public:
+    SimLens(): position(0), moveStart(0), moveEnd(0), from(0) {}
+
+    void setFocus(float f, float speed = -1) {
+        if (f < farFocus()) f = farFocus();
+        if (f > nearFocus()) f = nearFocus();
+        if (speed <= 0) speed = maxFocusSpeed();
+        from = focusAt(now);
+        position = f;
+        moveStart = now + focusLatency();
+        moveEnd = moveStart + (int)(fabs(f - from) / speed * 1000000);
+    }
+
+    float focusAt(int t) const {
+        if (t <= moveStart) return from;
+        if (t >= moveEnd) return position;
+        float alpha = float(t - moveStart) / (moveEnd - moveStart);
+        return from + alpha * (position - from);
+    }
+
+    float getFocus() const {return focusAt(now);}
+    float farFocus() const {return 0.0f;}
+    float nearFocus() const {return 10.0f;}
+    bool focusChanging() const {return now < moveEnd;}
+    int focusLatency() const {return 50000;}
+    float minFocusSpeed() const {return 10.0f;}
+    float maxFocusSpeed() const {return 40.0f;}
+
+    void setZoom(float, float) {}
+    float getZoom() const {return 4.0f;}
+    float minZoom() const {return 4.0f;}
+    float maxZoom() const {return 4.0f;}
+    bool zoomChanging() const {return false;}
+    int zoomLatency() const {return 0;}
+    float minZoomSpeed() const {return 0;}
+    float maxZoomSpeed() const {return 0;}
+
+    void setAperture(float, float) {}
+    float getAperture() const {return 2.8f;}
+    float wideAperture(float) const {return 2.8f;}
+    float narrowAperture(float) const {return 2.8f;}
+    bool apertureChanging() const {return false;}
+    int apertureLatency() const {return 0;}
+    float minApertureSpeed() const {return 0;}
+    float maxApertureSpeed() const {return 0;}
+
+    void tagFrame(FCam::Frame) {}
+    void handleEvent(const FCam::Event &) {}
+
+private:
+    float position;
+    int moveStart, moveEnd;
+    float from;
+};
+
+struct SimFrame : public FCam::_Frame {
+    FCam::Shot _shot;
+    const FCam::Shot &baseShot() const {return _shot;}
+    const FCam::Platform &platform() const {return FCam::Tegra::Platform::instance();}
+};
+
+// Sharpness of a scene in focus at subject diopters, with the lens
+// moving from a to b during the exposure
+static unsigned sharpnessAt(float subject, float a, float b) {
+    float sum = 0;
+    for (int i = 0; i < 4; i++) {
+        float p = a + (b - a) * (i + 0.5f) / 4;
+        float d = p - subject;
+        sum += 100 + 1000 * expf(-d * d / (2 * 0.4f * 0.4f));
+    }
+    float noise = 1.0f + 0.02f * ((rand() % 2001) / 1000.0f - 1.0f);
+    return (unsigned)(sum / 4 * noise);
+}
+
+// Expose frame k and return it as the application would receive it
+static FCam::Frame makeFrame(const SimLens &lens, float subject, int k) {
+    SimFrame *f = new SimFrame;
+    int start = k * frameTime;
+    float a = lens.focusAt(start), b = lens.focusAt(start + exposure);
+    f->sharpness = FCam::SharpnessMap(FCam::Size(16, 12), 3);
+    for (int y = 0; y < 12; y++) {
+        for (int x = 0; x < 16; x++) {
+            unsigned s = sharpnessAt(subject, a, b);
+            for (int c = 0; c < 3; c++) f->sharpness(x, y, c) = s;
+        }
+    }
+    f->tags["lens.initialFocus"] = a;
+    f->tags["lens.finalFocus"] = b;
+    return FCam::Frame(f);
+}
+
+struct Result {
+    int frames;
+    float error;
+};
+
+// Frame k is delivered at the end of frame k + pipelineDepth
+static void deliver(int k) {
+    now = (k + pipelineDepth + 1) * frameTime;
+}
+
+static Result runAutoFocus(float subject) {
+    SimLens lens;
+    FCam::AutoFocus af(&lens);
+    now = 0;
+    af.startSweep();
+    int k = 0;
+    while (!af.focused() && k < 1000) {
+        deliver(k);
+        af.update(makeFrame(lens, subject, k));
+        k++;
+    }
+    Result r = {k, fabs(lens.focusAt(now + 1000000) - subject)};
+    return r;
+}
+
+static Result runSweep(float subject) {
+    SimLens lens;
+    const int steps = 32;
+    float stepSize = (lens.nearFocus() - lens.farFocus()) / steps;
+    // Frames to wait after each move without knowing when the lens
+    // actually arrived: latency, the longest move, and the pipeline
+    int settle = (lens.focusLatency() + (int)(stepSize / lens.maxFocusSpeed() * 1000000) + exposure
+                  + frameTime - 1) / frameTime + pipelineDepth;
+
+    now = 0;
+    int k = 0;
+    float bestPos = 0;
+    unsigned best = 0;
+    for (int i = 0; i <= steps; i++) {
+        float p = lens.farFocus() + i * stepSize;
+        lens.setFocus(p);
+        k += settle;
+        deliver(k);
+        FCam::Frame f = makeFrame(lens, subject, k);
+        k++;
+        unsigned s = f.sharpness()(8, 6);
+        if (s > best) {
+            best = s;
+            bestPos = p;
+        }
+    }
+    lens.setFocus(bestPos);
+    k += settle;
+    Result r = {k, fabs(lens.focusAt(now + 1000000) - subject)};
+    return r;
+}
+
+static void report(const char *method, const std::vector<Result> &results) {
+    double frames = 0, error = 0, worstError = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        frames += results[i].frames;
+        error += results[i].error;
+        if (results[i].error > worstError) worstError = results[i].error;
+    }
+    frames /= results.size();
+    error /= results.size();
+    printf("{\"benchmark\": \"autofocus\", \"method\": \"%s\", \"trials\": %d, "
+           "\"mean_frames\": %.2f, \"mean_ms\": %.1f, \"mean_error_diopters\": %.3f, "
+           "\"max_error_diopters\": %.3f}\n",
+           method, (int)results.size(), frames, frames * frameTime / 1000.0, error, worstError);
+}
+
+int main(int argc, char **argv) {
+    int trials = 200;
+    if (argc > 1) trials = atoi(argv[1]);
+
+    std::vector<Result> af, sweep;
+    for (int i = 0; i < trials; i++) {
+        float subject = 0.5f + 9.0f * i / trials;
+        srand(i);
+        af.push_back(runAutoFocus(subject));
+        srand(i);
+        sweep.push_back(runSweep(subject));
+    }
+
+    report("contrast_hill_climb", af);
+    report("full_sweep", sweep);
+    return 0;
+}
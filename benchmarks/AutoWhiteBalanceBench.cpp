@@ -0,0 +1,191 @@
+// Convergence of white balance after sudden changes in illumination.
+//
+// A simulated sensor renders a scene of mostly gray surfaces with a
+// few strongly colored ones, under a blackbody illuminant, balanced
+// for the white balance requested a fixed number of frames earlier,
+// and hands each frame to the application a fixed number of frames
+// after it was requested. Frames carry a YpUV histogram and the
+// per-region sums the Tegra statistics collection attaches. The
+// illuminant steps through a sequence of color temperatures.
+//
+// Compares autoWhiteBalance with the fixed 500K stepping it used to
+// do from histogram means. Reports how many frames it takes after
+// each step for the white balance to settle within 10 mireds of where
+// it ends up, and how far that is from the real illuminant.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <FCam/AutoWhiteBalance.h>
+#include <FCam/Frame.h>
+#include <FCam/Shot.h>
+#include <FCam/processing/Color.h>
+#include <FCam/Tegra/Platform.h>
+
+static const int latency = 2;       // frames before a change takes effect
+static const int pipelineDepth = 2; // frames before a frame is returned
+static const int segmentFrames = 30;
+static const int buckets = 64;
+static const int regions = 48;
+
+struct SimFrame : public FCam::_Frame {
+    FCam::Shot _shot;
+    const FCam::Shot &baseShot() const {return _shot;}
+    const FCam::Platform &platform() const {return FCam::Tegra::Platform::instance();}
+};
+
+// Linear sRGB of the white of a blackbody at T kelvin, with green 1
+static void whiteRGB(int T, float *rgb) {
+    float x, y;
+    FCam::kelvinToXY(T, &x, &y);
+    float XYZ[3] = {x / y, 1.0f, (1 - x - y) / y};
+    float inv[9];
+    FCam::invert3x3((float *)FCam::RGBtoXYZ, inv);
+    for (int i = 0; i < 3; i++) {
+        rgb[i] = inv[i*3+0]*XYZ[0] + inv[i*3+1]*XYZ[1] + inv[i*3+2]*XYZ[2];
+    }
+    for (int i = 0; i < 3; i++) rgb[i] /= rgb[1];
+}
+
+// Region reflectances: mostly neutral at various levels, and a few
+// large saturated objects
+static void reflectance(int r, float *rgb) {
+    float level = 0.1f + 0.6f * ((r * 7) % regions) / regions;
+    rgb[0] = rgb[1] = rgb[2] = level;
+    if (r % 6 == 1) {rgb[0] = 0.6f; rgb[1] = 0.15f; rgb[2] = 0.1f;}
+    if (r % 6 == 4) {rgb[0] = 0.1f; rgb[1] = 0.4f; rgb[2] = 0.15f;}
+}
+
+static FCam::Frame makeFrame(const FCam::Shot &requested, int wb, int illuminant) {
+    SimFrame *f = new SimFrame;
+    f->_shot = requested;
+    f->whiteBalance = wb;
+    f->histogram = FCam::Histogram(buckets, 3, FCam::Rect(0, 0, 640, 480), FCam::YpUV);
+
+    float light[3], balance[3];
+    whiteRGB(illuminant, light);
+    whiteRGB(wb, balance);
+
+    std::vector<int> sums(regions * 4);
+    for (int r = 0; r < regions; r++) {
+        float rgb[3];
+        reflectance(r, rgb);
+        for (int c = 0; c < 3; c++) {
+            float value = rgb[c] * light[c] / balance[c];
+            if (value > 1) value = 1;
+            if (value < 0) value = 0;
+            rgb[c] = 255 * powf(value, 1 / 2.2f);
+        }
+        float Y = 0.299f * rgb[0] + 0.587f * rgb[1] + 0.114f * rgb[2];
+        float U = 128 + 0.564f * (rgb[2] - Y);
+        float V = 128 + 0.713f * (rgb[0] - Y);
+        const int samples = 100;
+        sums[r*4+0] = samples;
+        sums[r*4+1] = (int)(Y * samples);
+        sums[r*4+2] = (int)(U * samples);
+        sums[r*4+3] = (int)(V * samples);
+        f->histogram((int)Y * buckets / 256, 0) += samples;
+        f->histogram((int)U * buckets / 256, 1) += samples;
+        f->histogram((int)V * buckets / 256, 2) += samples;
+    }
+    f->tags["stats.regionYUV"] = sums;
+    return FCam::Frame(f);
+}
+
+struct Stats {
+    int steps;
+    int settleFrames, worstSettleFrames;
+    float worstError;
+};
+
+static float mireds(float T) {return 1e6f / T;}
+
+template<typename Balancer>
+static Stats run(Balancer balance, const std::vector<int> &illuminants) {
+    FCam::Shot shot;
+    shot.whiteBalance = 5000;
+
+    std::vector<FCam::Shot> requested;
+    std::vector<int> applied;
+    int total = illuminants.size() * segmentFrames;
+    for (int k = 0; k < total; k++) {
+        requested.push_back(shot);
+        applied.push_back(requested[k >= latency ? k - latency : 0].whiteBalance);
+
+        int r = k - pipelineDepth;
+        if (r >= 0) {
+            FCam::Frame f = makeFrame(requested[r], applied[r], illuminants[r / segmentFrames]);
+            balance(&shot, f);
+        }
+    }
+
+    Stats st = {0, 0, 0, 0};
+    for (size_t s = 1; s < illuminants.size(); s++) {
+        int begin = s * segmentFrames, end = begin + segmentFrames;
+        float final = applied[end - 1];
+        int settled = 0;
+        for (int k = end - 1; k >= begin; k--) {
+            if (fabs(mireds(applied[k]) - mireds(final)) > 10) {
+                settled = k + 1 - begin;
+                break;
+            }
+        }
+        float error = fabs(mireds(final) - mireds(illuminants[s]));
+        st.steps++;
+        st.settleFrames += settled;
+        if (settled > st.worstSettleFrames) st.worstSettleFrames = settled;
+        if (error > st.worstError) st.worstError = error;
+    }
+    return st;
+}
+
+// What autoWhiteBalance used to do with a YpUV histogram
+struct FixedStep {
+    void operator()(FCam::Shot *s, const FCam::Frame &f) {
+        const FCam::Histogram &h = f.histogram();
+        float u = 0, v = 0, n = 0;
+        for (unsigned int i = 0; i < h.buckets(); i++) {
+            u += i * h(i, 1);
+            v += i * h(i, 2);
+            n += h(i, 1);
+        }
+        u /= n;
+        v /= n;
+        int wb = f.whiteBalance();
+        if (u - v < -5.0f) wb -= 500;
+        else if (u - v > 5.0f) wb += 500;
+        else return;
+        if (wb < 3200) wb = 3200;
+        if (wb > 7000) wb = 7000;
+        s->whiteBalance = 0.5f * s->whiteBalance + 0.5f * wb;
+    }
+};
+
+struct Solver {
+    void operator()(FCam::Shot *s, const FCam::Frame &f) {
+        FCam::autoWhiteBalance(s, f);
+    }
+};
+
+static void report(const char *method, const Stats &st) {
+    printf("{\"benchmark\": \"autowhitebalance\", \"method\": \"%s\", \"steps\": %d, "
+           "\"latency_frames\": %d, \"pipeline_frames\": %d, "
+           "\"mean_settle_frames\": %.1f, \"max_settle_frames\": %d, \"max_error_mireds\": %.1f}\n",
+           method, st.steps, latency, pipelineDepth,
+           (float)st.settleFrames / st.steps, st.worstSettleFrames, st.worstError);
+}
+
+int main(int argc, char **argv) {
+    // Illuminant steps between tungsten, fluorescent, daylight and shade
+    int sequence[] = {5000, 3300, 6500, 4100, 6900, 3500, 5500, 3300, 4500, 6000};
+    std::vector<int> illuminants(sequence, sequence + sizeof(sequence)/sizeof(sequence[0]));
+
+    FixedStep fixed;
+    report("fixed_step", run(fixed, illuminants));
+
+    Solver solver;
+    report("cct_solve", run(solver, illuminants));
+    return 0;
+}
@@ -0,0 +1,67 @@
+// Cost of the performance counters.
+//
+// Has several threads bump the same Counter as fast as they can, and
+// compares it with a single shared atomic count, which every thread
+// fights over for the same cache line. Also times recording into a
+// Distribution and dumping the registry as JSON. Checks that no
+// increments are lost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <FCam/Counters.h>
+#include <FCam/Time.h>
+
+static const int threads = 4;
+static const int adds = 2000000;
+static const int records = 1000000;
+
+static FCam::Counter counter("bench.sharded");
+static FCam::Distribution distribution("bench.distribution");
+static volatile unsigned long shared = 0;
+
+static void *addSharded(void *) {
+    for (int i = 0; i < adds; i++) counter.add();
+    return 0;
+}
+
+static void *addShared(void *) {
+    for (int i = 0; i < adds; i++) __sync_fetch_and_add(&shared, 1);
+    return 0;
+}
+
+static double run(void *(*body)(void *)) {
+    pthread_t t[threads];
+    FCam::Time start = FCam::Time::now();
+    for (int i = 0; i < threads; i++) pthread_create(&t[i], 0, body, 0);
+    for (int i = 0; i < threads; i++) pthread_join(t[i], 0);
+    return (FCam::Time::now() - start) * 1000.0 / ((double)threads * adds);
+}
+
+int main(int argc, char **argv) {
+    unsigned long long expected = (unsigned long long)threads * adds;
+
+    double sharded = run(addSharded);
+    bool ok = counter.value() == expected;
+    printf("{\"benchmark\": \"counter_add\", \"impl\": \"sharded\", \"threads\": %d, "
+           "\"ns_per_add\": %.2f, \"correct\": %s}\n", threads, sharded, ok ? "true" : "false");
+
+    double single = run(addShared);
+    bool sharedOk = shared == expected;
+    printf("{\"benchmark\": \"counter_add\", \"impl\": \"shared_atomic\", \"threads\": %d, "
+           "\"ns_per_add\": %.2f, \"correct\": %s}\n", threads, single, sharedOk ? "true" : "false");
+
+    FCam::Time start = FCam::Time::now();
+    for (int i = 0; i < records; i++) distribution.record(i & 1023);
+    double recordNs = (FCam::Time::now() - start) * 1000.0 / records;
+    printf("{\"benchmark\": \"distribution_record\", \"ns_per_record\": %.2f}\n", recordNs);
+
+    start = FCam::Time::now();
+    std::string json = FCam::Counters::json();
+    int jsonUs = FCam::Time::now() - start;
+    printf("{\"benchmark\": \"counters_json\", \"us\": %d, \"bytes\": %d}\n", jsonUs, (int)json.size());
+
+    if (!ok || !sharedOk) return 1;
+    return 0;
+}
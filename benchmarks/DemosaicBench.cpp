@@ -0,0 +1,135 @@
+// Quality and speed of the demosaicking methods.
+//
+// Renders a synthetic scene with sharp edges, fine stripes and
+// smooth gradients, samples it through the platform's Bayer pattern,
+// and demosaics it with each method. The reference is the same full
+// color scene put through the same color matrix and tone curve.
+// Reports the PSNR against the reference (over all pixels, and over
+// pixels near edges), and the time taken.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <FCam/processing/Demosaic.h>
+#include <FCam/Frame.h>
+#include <FCam/Time.h>
+#include <FCam/Tegra/Platform.h>
+
+#include "processing/LUT.h"
+
+static const int width = 1288, height = 968;
+
+struct SimFrame : public FCam::_Frame {
+    FCam::Shot _shot;
+    const FCam::Shot &baseShot() const {return _shot;}
+    const FCam::Platform &platform() const {return FCam::Tegra::Platform::instance();}
+};
+
+// Sensor RGB of the scene at a pixel, in the raw range. Most of the
+// detail in real scenes is in luminance, with color varying more
+// slowly, so the scene is a luminance pattern of hard edged discs
+// over a gradient, with slanted stripes of increasing frequency
+// across the bottom, tinted by a smoothly varying color.
+static void scene(int x, int y, float *rgb) {
+    float L = 0.3f + 0.4f * x / width;
+    for (int i = 0; i < 12; i++) {
+        float cx = (i % 4 + 0.5f) * width / 4, cy = (i / 4 + 0.5f) * height / 3;
+        float dx = x - cx, dy = y - cy;
+        if (dx*dx + dy*dy < 90*90) L = (i & 1) ? 0.9f : 0.15f;
+    }
+    if (y > height * 3 / 4) {
+        float f = 0.05f + 0.25f * x / width;
+        L = 0.2f + 0.7f * (0.5f + 0.5f * sinf(f * (x + 0.5f * y)));
+    }
+    float tint[3] = {1.0f + 0.3f * sinf(x * 0.003f), 1.0f, 1.0f + 0.3f * cosf(y * 0.004f)};
+    for (int c = 0; c < 3; c++) rgb[c] = 900 * L * tint[c] / 1.3f;
+}
+
+struct Result {
+    double psnr, edgePsnr, ms;
+};
+
+static Result measure(const FCam::Frame &f, const std::vector<float> &truth, FCam::DemosaicMethod method,
+                      int runs) {
+    FCam::Image out;
+    FCam::Time start = FCam::Time::now();
+    for (int i = 0; i < runs; i++) {
+        out = FCam::demosaic(f, 50.0f, true, 25, 2.2f, method);
+    }
+    double ms = (FCam::Time::now() - start) / 1000.0 / runs;
+
+    // The reference output, with the same crop as demosaic
+    float matrix[12];
+    f.platform().colorMatrix(f.shot().whiteBalance, matrix);
+    shared_ptr<const FCam::ToneLUT> lut = FCam::toneLUT(f, 50.0f, 25, 2.2f);
+    int offX = (width - 8 - out.width()) / 2, offY = (height - 2 - 8 - out.height()) / 2;
+    offX -= offX & 1;
+    offY -= offY & 1;
+    // Tegra sensors are BGGR, which demosaic crops down to GRBG by
+    // dropping the first row
+    offY += 1;
+
+    double err = 0, edgeErr = 0;
+    int n = 0, edgeN = 0;
+    for (unsigned y = 0; y < out.height(); y++) {
+        for (unsigned x = 0; x < out.width(); x++) {
+            int sx = x + offX + 4, sy = y + offY + 4;
+            const float *t = &truth[(sy * width + sx) * 3];
+            // Is there an edge nearby?
+            const float *t2 = &truth[((sy + 2) * width + sx + 2) * 3];
+            bool edge = fabs(t[0] - t2[0]) + fabs(t[1] - t2[1]) + fabs(t[2] - t2[2]) > 100;
+            for (int c = 0; c < 3; c++) {
+                float v = matrix[c*4+0]*t[0] + matrix[c*4+1]*t[1] + matrix[c*4+2]*t[2] + matrix[c*4+3];
+                int i = v < 0 ? 0 : (v > 1023 ? 1023 : (int)(v + 0.5f));
+                float d = (float)(*lut)[i] - out(x, y)[c];
+                err += d*d;
+                if (edge) edgeErr += d*d;
+            }
+            n += 3;
+            if (edge) edgeN += 3;
+        }
+    }
+    Result r = {10 * log10(255.0 * 255.0 / (err / n)), 10 * log10(255.0 * 255.0 / (edgeErr / edgeN)), ms};
+    return r;
+}
+
+static void report(const char *method, const Result &r) {
+    printf("{\"benchmark\": \"demosaic\", \"method\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"psnr_db\": %.2f, \"edge_psnr_db\": %.2f, \"ms\": %.1f}\n",
+           method, width, height, r.psnr, r.edgePsnr, r.ms);
+}
+
+int main(int argc, char **argv) {
+    int runs = 5;
+    if (argc > 1) runs = atoi(argv[1]);
+
+    SimFrame *f = new SimFrame;
+    f->_shot.whiteBalance = 5000;
+    f->image = FCam::Image(width, height, FCam::RAW);
+
+    std::vector<float> truth(width * height * 3);
+    FCam::BayerPattern pattern = f->platform().bayerPattern();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float *rgb = &truth[(y * width + x) * 3];
+            scene(x, y, rgb);
+            // Which color does this pixel see? BGGR: blue at (0,0)
+            int c;
+            bool evenRow = (y & 1) == 0, evenCol = (x & 1) == 0;
+            switch (pattern) {
+            case FCam::BGGR: c = evenRow ? (evenCol ? 2 : 1) : (evenCol ? 1 : 0); break;
+            case FCam::RGGB: c = evenRow ? (evenCol ? 0 : 1) : (evenCol ? 1 : 2); break;
+            case FCam::GBRG: c = evenRow ? (evenCol ? 1 : 2) : (evenCol ? 0 : 1); break;
+            default:         c = evenRow ? (evenCol ? 1 : 0) : (evenCol ? 2 : 1); break;
+            }
+            ((short *)f->image(x, y))[0] = (short)(rgb[c] + 0.5f);
+        }
+    }
+    FCam::Frame frame(f);
+
+    report("fast", measure(frame, truth, FCam::FastDemosaic, runs));
+    report("high_quality", measure(frame, truth, FCam::HighQualityDemosaic, runs));
+    return 0;
+}
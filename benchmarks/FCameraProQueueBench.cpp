@@ -0,0 +1,212 @@
+// Contention between the FCameraPro camera and renderer threads.
+//
+// Runs the triple buffer with a producer swapping the back buffer and a
+// consumer swapping the front buffer as fast as they can, and the work
+// queue with several producers and one consumer draining it in batches.
+// Each is run with the lock-free versions in the app's jni directory and
+// with the mutex-based versions they replaced. Reports the time per
+// operation, and the worst time the renderer waited for a front buffer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <queue>
+
+#include <FCam/Time.h>
+
+#include "TripleBuffer.h"
+#include "WorkQueue.h"
+
+// The mutex-based triple buffer the app used to have
+template<class T> class LockedTripleBuffer {
+public:
+    LockedTripleBuffer(T *buffers[3]) {
+        pthread_mutex_init(&m_lock, 0);
+        m_frontBuffer = buffers[0];
+        m_backBuffer = buffers[1];
+        m_spareBuffer = buffers[2];
+        m_updateFrontBuffer = false;
+    }
+
+    T *swapFrontBuffer(void) {
+        T *rval;
+        pthread_mutex_lock(&m_lock);
+        if (m_updateFrontBuffer) {
+            rval = m_spareBuffer;
+            m_spareBuffer = m_frontBuffer;
+            m_frontBuffer = rval;
+            m_updateFrontBuffer = false;
+        } else {
+            rval = m_frontBuffer;
+        }
+        pthread_mutex_unlock(&m_lock);
+        return rval;
+    }
+
+    T *getBackBuffer(void) {
+        pthread_mutex_lock(&m_lock);
+        T *rval = m_backBuffer;
+        pthread_mutex_unlock(&m_lock);
+        return rval;
+    }
+
+    T *swapBackBuffer(void) {
+        pthread_mutex_lock(&m_lock);
+        T *rval = m_spareBuffer;
+        m_spareBuffer = m_backBuffer;
+        m_backBuffer = rval;
+        m_updateFrontBuffer = true;
+        pthread_mutex_unlock(&m_lock);
+        return rval;
+    }
+
+private:
+    T *m_frontBuffer, *m_backBuffer, *m_spareBuffer;
+    bool m_updateFrontBuffer;
+    pthread_mutex_t m_lock;
+};
+
+// The mutex-based work queue the app used to have
+template<class T> class LockedWorkQueue {
+public:
+    LockedWorkQueue(void) {
+        pthread_mutex_init(&m_lock, 0);
+        sem_init(&m_counterSem, 0, 0);
+    }
+
+    void produce(const T &elem) {
+        pthread_mutex_lock(&m_lock);
+        m_queue.push(elem);
+        sem_post(&m_counterSem);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+    void consumeAll(std::queue<T> &queue) {
+        pthread_mutex_lock(&m_lock);
+        queue = m_queue;
+        if (!m_queue.empty()) {
+            m_queue = std::queue<T>();
+            sem_destroy(&m_counterSem);
+            sem_init(&m_counterSem, 0, 0);
+        }
+        pthread_mutex_unlock(&m_lock);
+    }
+
+private:
+    std::queue<T> m_queue;
+    pthread_mutex_t m_lock;
+    sem_t m_counterSem;
+};
+
+static const int swaps = 1000000;
+static const int producers = 3;
+static const int elements = 300000;
+
+struct Buffer {
+    int frame;
+};
+
+template<class TB> struct TripleBufferRun {
+    TB *tb;
+    int done;
+    double producerNs, consumerNs, worstWaitUs;
+    int framesSeen;
+};
+
+template<class TB> static void *tripleBufferProducer(void *arg) {
+    TripleBufferRun<TB> *run = (TripleBufferRun<TB> *)arg;
+    FCam::Time start = FCam::Time::now();
+    for (int i = 1; i <= swaps; i++) {
+        run->tb->getBackBuffer()->frame = i;
+        run->tb->swapBackBuffer();
+    }
+    run->producerNs = (FCam::Time::now() - start) * 1000.0 / swaps;
+    __sync_lock_test_and_set(&run->done, 1);
+    return 0;
+}
+
+template<class TB> static void *tripleBufferConsumer(void *arg) {
+    TripleBufferRun<TB> *run = (TripleBufferRun<TB> *)arg;
+    int ops = 0, last = 0, seen = 0, worst = 0;
+    FCam::Time start = FCam::Time::now();
+    while (!__sync_fetch_and_add(&run->done, 0)) {
+        FCam::Time t = FCam::Time::now();
+        Buffer *b = run->tb->swapFrontBuffer();
+        int wait = FCam::Time::now() - t;
+        if (wait > worst) worst = wait;
+        if (b->frame != last) {
+            seen++;
+            last = b->frame;
+        }
+        ops++;
+    }
+    run->consumerNs = (FCam::Time::now() - start) * 1000.0 / (ops ? ops : 1);
+    run->worstWaitUs = worst;
+    run->framesSeen = seen;
+    return 0;
+}
+
+template<class TB> static void runTripleBuffer(const char *name) {
+    Buffer buffers[3] = {{0}, {0}, {0}};
+    Buffer *ptrs[3] = {&buffers[0], &buffers[1], &buffers[2]};
+    TB tb(ptrs);
+    TripleBufferRun<TB> run;
+    run.tb = &tb;
+    run.done = 0;
+
+    pthread_t p, c;
+    pthread_create(&c, 0, tripleBufferConsumer<TB>, &run);
+    pthread_create(&p, 0, tripleBufferProducer<TB>, &run);
+    pthread_join(p, 0);
+    pthread_join(c, 0);
+
+    printf("{\"benchmark\": \"triple_buffer\", \"impl\": \"%s\", \"producer_ns_per_swap\": %.1f, "
+           "\"consumer_ns_per_swap\": %.1f, \"consumer_worst_wait_us\": %.0f, \"frames_seen\": %d}\n",
+           name, run.producerNs, run.consumerNs, run.worstWaitUs, run.framesSeen);
+}
+
+template<class Q> static void *queueProducer(void *arg) {
+    Q *q = (Q *)arg;
+    for (int i = 1; i <= elements; i++) q->produce(i);
+    return 0;
+}
+
+template<class Q> static void runQueue(const char *name) {
+    Q q;
+    pthread_t threads[producers];
+    FCam::Time start = FCam::Time::now();
+    for (int i = 0; i < producers; i++) {
+        pthread_create(&threads[i], 0, queueProducer<Q>, &q);
+    }
+
+    long long sum = 0;
+    int received = 0, batches = 0;
+    std::queue<int> batch;
+    while (received < producers * elements) {
+        q.consumeAll(batch);
+        if (batch.empty()) continue;
+        batches++;
+        while (!batch.empty()) {
+            sum += batch.front();
+            batch.pop();
+            received++;
+        }
+    }
+    double ns = (FCam::Time::now() - start) * 1000.0 / received;
+    for (int i = 0; i < producers; i++) pthread_join(threads[i], 0);
+
+    long long expected = (long long)producers * elements * (elements + 1) / 2;
+    printf("{\"benchmark\": \"work_queue\", \"impl\": \"%s\", \"producers\": %d, \"ns_per_element\": %.1f, "
+           "\"batches\": %d, \"correct\": %s}\n",
+           name, producers, ns, batches, sum == expected ? "true" : "false");
+    if (sum != expected) exit(1);
+}
+
+int main(int argc, char **argv) {
+    runTripleBuffer<LockedTripleBuffer<Buffer> >("mutex");
+    runTripleBuffer<TripleBuffer<Buffer> >("lock_free");
+    runQueue<LockedWorkQueue<int> >("mutex");
+    runQueue<WorkQueue<int> >("lock_free");
+    return 0;
+}
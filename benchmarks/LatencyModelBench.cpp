@@ -0,0 +1,145 @@
+// Throughput of bracketed streams through the Tegra daemon's setter.
+//
+// Simulates a sensor whose exposure takes effect a fixed number of
+// captures after it is programmed, fed with a stream that cycles
+// through a three exposure bracket (as for HDR), and runs it through
+// a model of the setter's scheduling: the old one, which programs the next
+// request only and inserts the sensor's nominal latency in bubbles
+// after every change, and the current one, which programs each
+// request as many captures ahead as the LatencyModel says it takes.
+// Reports the captures spent per frame delivered, and how many
+// delivered frames were taken with the wrong exposure. The second
+// scenario gives the setter a wrong nominal latency.
+
+#include <stdio.h>
+#include <deque>
+#include <vector>
+
+#include "Tegra/LatencyModel.h"
+
+static const int captures = 3000;
+// Frames come back from the driver this many captures after being triggered
+static const int inFlight = 3;
+
+struct Request {
+    int exposure;
+    bool wanted;
+};
+
+struct Result {
+    int delivered, bubbles, wrong, learnedAt, latency;
+};
+
+static void generate(std::deque<Request> &queue) {
+    Request a = {10000, true}, b = {20000, true}, c = {40000, true};
+    queue.push_back(a);
+    queue.push_back(b);
+    queue.push_back(c);
+}
+
+static Request bubble(const Request &r) {
+    Request b = r;
+    b.wanted = false;
+    return b;
+}
+
+// The exposure capture k is taken with, given what was in the register
+// at each capture
+static int actual(const std::vector<int> &reg, int k, int trueLatency) {
+    return k - trueLatency >= 0 ? reg[k - trueLatency] : -1;
+}
+
+static void count(Result &r, const Request &req, int exposure) {
+    if (!req.wanted) {
+        r.bubbles++;
+        return;
+    }
+    r.delivered++;
+    if (exposure != req.exposure) r.wrong++;
+}
+
+// Program the next request, and follow every change with the nominal
+// number of bubbles
+static Result runOld(int nominal, int trueLatency) {
+    Result r = {0, 0, 0, -1, 1 + nominal};
+    std::deque<Request> queue;
+    std::vector<int> reg(captures);
+    int current = -1, latency = 0;
+    for (int k = 0; k < captures; k++) {
+        if (queue.empty()) generate(queue);
+        Request req = queue.front();
+        if (req.exposure != current) req = bubble(req);
+        else queue.pop_front();
+
+        if (queue.empty()) generate(queue);
+        if (queue.front().exposure != current) {
+            current = queue.front().exposure;
+            latency = nominal;
+        } else if (latency > 0) {
+            latency--;
+        }
+        for (; latency > 0; latency--) queue.push_front(bubble(queue.front()));
+
+        reg[k] = current;
+        count(r, req, actual(reg, k, trueLatency));
+    }
+    return r;
+}
+
+// Program each request as far ahead as the model says it takes to
+// take effect, and learn that from the frames coming back
+static Result runModel(int nominal, int trueLatency) {
+    Result r = {0, 0, 0, -1, 0};
+    FCam::Tegra::LatencyModel model(1 + nominal);
+    std::deque<Request> queue;
+    std::vector<int> reg(captures);
+    int current = -1, bubblesPending = 0;
+    for (int k = 0; k < captures; k++) {
+        if (queue.empty()) generate(queue);
+        Request req = queue.front();
+        if (bubblesPending > 0) {
+            req = bubble(req);
+            bubblesPending--;
+        } else if (model.latency() && model.predicted(k) != req.exposure) {
+            req = bubble(req);
+            bubblesPending = model.latency() - 1;
+        } else {
+            queue.pop_front();
+        }
+
+        int ahead = model.latency(), index = 0;
+        if (ahead - 1 > bubblesPending) index = ahead - 1 - bubblesPending;
+        while ((int)queue.size() <= index) generate(queue);
+        current = ahead ? queue[index].exposure : req.exposure;
+        model.programmed(k, current);
+
+        reg[k] = current;
+        count(r, req, actual(reg, k, trueLatency));
+
+        if (k >= inFlight) model.observed(k - inFlight, actual(reg, k - inFlight, trueLatency));
+        if (r.learnedAt < 0 && model.latency() == trueLatency) r.learnedAt = k;
+    }
+    r.latency = model.latency();
+    return r;
+}
+
+static void report(const char *scenario, const char *policy, int nominal, int trueLatency, const Result &r) {
+    printf("{\"benchmark\": \"bracketed_stream\", \"scenario\": \"%s\", \"policy\": \"%s\", "
+           "\"nominal_latency\": %d, \"true_latency\": %d, \"latency_used\": %d, "
+           "\"captures_per_frame\": %.2f, \"wrong_exposure_frames\": %d, \"learned_after_captures\": %d}\n",
+           scenario, policy, 1 + nominal, trueLatency, r.latency,
+           (double)captures / r.delivered, r.wrong, r.learnedAt);
+}
+
+int main(int argc, char **argv) {
+    // Sensor configurations say how many frames to skip after the
+    // capture that follows the change
+    const char *scenarios[] = {"nominal_correct", "nominal_wrong"};
+    int nominal[] = {1, 0};
+    int trueLatency[] = {2, 3};
+    for (int s = 0; s < 2; s++) {
+        report(scenarios[s], "bubbles", nominal[s], trueLatency[s], runOld(nominal[s], trueLatency[s]));
+        report(scenarios[s], "latency_model", nominal[s], trueLatency[s], runModel(nominal[s], trueLatency[s]));
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+// Throughput of the processing library on synthetic frames.
+//
+// Generates deterministic raw (Bayer) and YUV420p frames at a few
+// resolutions, and times each of the processing steps a capture goes
+// through on its way to disk: demosaicking, thumbnails, YUV to RGB
+// conversion, histogram and sharpness statistics, and saving and
+// loading JPEGs, DNGs and dumps. Also times serializing frame tags.
+// Reports the best of several runs of each, in megapixels and in
+// megabytes of input (or output, for the writers) per second, except
+// for the statistics, which report the samples they read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <FCam/processing/Demosaic.h>
+#include <FCam/processing/JPEG.h>
+#include <FCam/processing/DNG.h>
+#include <FCam/processing/Dump.h>
+#include <FCam/Tegra/Platform.h>
+#include <FCam/Tegra/YUV420.h>
+#include <FCam/Frame.h>
+#include <FCam/TagValue.h>
+#include <FCam/Time.h>
+
+#include "Tegra/Statistics.h"
+
+struct SimFrame : public FCam::_Frame {
+    FCam::Shot _shot;
+    const FCam::Shot &baseShot() const {return _shot;}
+    const FCam::Platform &platform() const {return FCam::Tegra::Platform::instance();}
+};
+
+struct Resolution {
+    const char *name;
+    int width, height;
+};
+
+// VGA preview, the 960p video mode and the full 5MP sensor
+static const Resolution resolutions[] = {
+    {"vga", 640, 480},
+    {"960p", 1280, 960},
+    {"5mp", 2592, 1944}
+};
+
+// A small linear congruential generator, so every run sees the same
+// frames
+struct Noise {
+    unsigned state;
+    Noise() : state(12345) {}
+    int operator()(int range) {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) % range;
+    }
+};
+
+// A raw frame: a diagonal gradient with a grid of bright squares and
+// some noise, in the 10 bit range of the sensor
+static FCam::Frame makeRawFrame(int width, int height) {
+    SimFrame *f = new SimFrame;
+    f->_shot.whiteBalance = 5000;
+    f->_shot.exposure = 10000;
+    f->_shot.gain = 1.0f;
+    f->exposure = 10000;
+    f->gain = 1.0f;
+    f->whiteBalance = 5000;
+    f->image = FCam::Image(width, height, FCam::RAW);
+    Noise noise;
+    for (int y = 0; y < height; y++) {
+        short *row = (short *)f->image(0, y);
+        for (int x = 0; x < width; x++) {
+            int v = 64 + 600 * (x + y) / (width + height);
+            if (((x / 64) + (y / 64)) % 5 == 0) v += 300;
+            row[x] = v + noise(16);
+        }
+    }
+    return FCam::Frame(f);
+}
+
+// A YUV420p frame with the same kind of content, and slowly varying
+// chroma
+static FCam::Image makeYUVImage(int width, int height) {
+    FCam::Image im(width, height, FCam::YUV420p);
+    Noise noise;
+    for (int y = 0; y < height; y++) {
+        unsigned char *row = im(0, y);
+        for (int x = 0; x < width; x++) {
+            int v = 16 + 200 * (x + y) / (width + height);
+            if (((x / 64) + (y / 64)) % 5 == 0) v += 30;
+            row[x] = v + noise(8);
+        }
+    }
+    // The chroma planes follow the luma plane, U then V
+    int planeSize = (width / 2) * (height / 2);
+    unsigned char *u = im(0, height), *v = u + planeSize;
+    for (int i = 0; i < planeSize; i++) {
+        int x = i % (width / 2), y = i / (width / 2);
+        u[i] = 128 + 40 * x / width - 20;
+        v[i] = 128 + 40 * y / height - 20;
+    }
+    return im;
+}
+
+static const char *tmpDir = "/tmp";
+static int runs = 3;
+
+static std::string tmpFile(const char *name) {
+    return std::string(tmpDir) + "/fcam_bench_" + name;
+}
+
+static long fileSize(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+// The sum of a raw image's pixels. Loaded DNGs are memory mapped, so
+// the loads are timed up to having read every pixel once.
+static long long checksum(const FCam::Image &im) {
+    long long sum = 0;
+    for (unsigned y = 0; y < im.height(); y++) {
+        const short *row = (const short *)im(0, y);
+        for (unsigned x = 0; x < im.width(); x++) sum += row[x];
+    }
+    return sum;
+}
+
+static void report(const char *benchmark, const Resolution &r, double us, double bytes) {
+    double pixels = (double)r.width * r.height;
+    printf("{\"benchmark\": \"%s\", \"resolution\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"ms\": %.2f, \"mpix_per_s\": %.1f, \"mb_per_s\": %.1f}\n",
+           benchmark, r.name, r.width, r.height, us / 1000,
+           pixels / us, bytes / us);
+}
+
+// The statistics subsample every frame down to a fixed number of
+// samples, so for them the time and the number of samples read are
+// what is worth tracking, rather than a rate over the whole frame
+static void reportSamples(const char *benchmark, const Resolution &r, double us, int samples) {
+    printf("{\"benchmark\": \"%s\", \"resolution\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"ms\": %.3f, \"samples\": %d, \"ns_per_sample\": %.2f}\n",
+           benchmark, r.name, r.width, r.height, us / 1000,
+           samples, us * 1000 / samples);
+}
+
+// The number of pixels evaluateSharpness reads, following its
+// subsampling
+static int sharpnessSamples(int width, int height) {
+    int subsample = 1;
+    for (int x = width, y = height; x * y > FCam::Tegra::Statistics::MAX_VARIANCE_SAMPLES; x >>= 1, y >>= 1) {
+        subsample <<= 1;
+    }
+    // It leaves out the last row and column
+    return ((width - 1 + subsample - 1) / subsample) * ((height - 1 + subsample - 1) / subsample);
+}
+
+// Runs the body the given number of times and returns the best time
+// in microseconds
+#define TIME_BEST(best, body) do {                      \
+        best = 1e30;                                    \
+        for (int run_ = 0; run_ < runs; run_++) {       \
+            FCam::Time start_ = FCam::Time::now();      \
+            body;                                       \
+            double t_ = FCam::Time::now() - start_;     \
+            if (t_ < best) best = t_;                   \
+        }                                               \
+        if (best < 1) best = 1;                         \
+    } while (0)
+
+static void benchRaw(const Resolution &r) {
+    FCam::Frame frame = makeRawFrame(r.width, r.height);
+    long long expected = checksum(frame.image()), sum = 0;
+    double rawBytes = (double)r.width * r.height * 2;
+    double us;
+
+    FCam::Image out;
+    TIME_BEST(us, out = FCam::demosaic(frame, 50.0f, true, 25, 2.2f, FCam::FastDemosaic));
+    report("demosaic_fast", r, us, rawBytes);
+
+    TIME_BEST(us, out = FCam::demosaic(frame, 50.0f, true, 25, 2.2f, FCam::HighQualityDemosaic));
+    report("demosaic_high_quality", r, us, rawBytes);
+
+    TIME_BEST(us, out = FCam::makeThumbnail(frame));
+    report("make_thumbnail", r, us, rawBytes);
+
+    std::string dng = tmpFile("raw.dng");
+    TIME_BEST(us, FCam::saveDNG(frame, dng));
+    report("save_dng", r, us, fileSize(dng));
+
+    FCam::DNGFrame loaded;
+    TIME_BEST(us, loaded = FCam::loadDNG(dng); sum = checksum(loaded.image()));
+    if (!loaded.image().valid() || sum != expected) {
+        fprintf(stderr, "loadDNG did not return the saved image\n");
+        exit(1);
+    }
+    report("load_dng", r, us, fileSize(dng));
+    remove(dng.c_str());
+
+    std::string dump = tmpFile("raw.dump");
+    TIME_BEST(us, FCam::saveDump(frame.image(), dump));
+    report("save_dump", r, us, fileSize(dump));
+
+    FCam::Image dumped;
+    TIME_BEST(us, dumped = FCam::loadDump(dump); sum = checksum(dumped));
+    if (!dumped.valid() || sum != expected) {
+        fprintf(stderr, "loadDump did not return the saved image\n");
+        exit(1);
+    }
+    report("load_dump", r, us, fileSize(dump));
+    remove(dump.c_str());
+}
+
+static void benchYUV(const Resolution &r) {
+    FCam::Image im = makeYUVImage(r.width, r.height);
+    double yuvBytes = (double)r.width * r.height * 3 / 2;
+    double us;
+
+    FCam::Image rgb(r.width, r.height, FCam::RGB24);
+    TIME_BEST(us, FCam::Tegra::convertYUV420ToRGB24(rgb, im));
+    report("yuv420_to_rgb24", r, us, yuvBytes);
+
+    // The statistics the Tegra daemon computes for every streamed frame
+    FCam::HistogramConfig histogram;
+    histogram.enabled = true;
+    histogram.region = FCam::Rect(0, 0, r.width, r.height);
+    std::vector<int> regionSums;
+    FCam::Histogram hist;
+    TIME_BEST(us, hist = FCam::Tegra::Statistics::evaluateHistogram(histogram, im, &regionSums));
+    int samples = 0;
+    for (unsigned b = 0; b < hist.buckets(); b++) samples += hist(b, 0);
+    reportSamples("evaluate_histogram", r, us, samples);
+
+    FCam::SharpnessMapConfig sharpness;
+    sharpness.enabled = true;
+    sharpness.size = FCam::Size(16, 12);
+    TIME_BEST(us, FCam::Tegra::Statistics::evaluateSharpness(sharpness, im));
+    reportSamples("evaluate_sharpness", r, us, sharpnessSamples(r.width, r.height));
+
+    std::string jpeg = tmpFile("yuv.jpg");
+    TIME_BEST(us, FCam::saveJPEG(im, jpeg, 90));
+    report("save_jpeg", r, us, yuvBytes);
+    remove(jpeg.c_str());
+}
+
+// The tags a frame typically carries: a few scalars, a histogram and
+// the per region statistics
+static void benchTags() {
+    FCam::TagMap tags;
+    tags["flash.brightness"] = 1.0f;
+    tags["flash.duration"] = 1000;
+    tags["lens.focus"] = 3.5f;
+    tags["sensor.name"] = std::string("synthetic");
+    std::vector<int> histogram(256);
+    for (size_t i = 0; i < histogram.size(); i++) histogram[i] = (int)(i * 37 % 1000);
+    tags["stats.histogram"] = histogram;
+    std::vector<int> regions(16 * 12 * 4);
+    for (size_t i = 0; i < regions.size(); i++) regions[i] = (int)(i * 101 % 65536);
+    tags["stats.regionYUV"] = regions;
+
+    const int frames = 1000;
+    const char *formats[] = {"string", "blob"};
+    for (int fmt = 0; fmt < 2; fmt++) {
+        double best = 1e30, bytes = 0;
+        for (int run = 0; run < runs; run++) {
+            FCam::Time start = FCam::Time::now();
+            bytes = 0;
+            for (int i = 0; i < frames; i++) {
+                for (FCam::TagMap::const_iterator t = tags.begin(); t != tags.end(); t++) {
+                    std::string s = fmt ? t->second.toBlob() : t->second.toString();
+                    FCam::TagValue back = FCam::TagValue::fromString(s);
+                    bytes += s.size();
+                    if (back.type != t->second.type) {
+                        fprintf(stderr, "Tag %s did not survive serialization\n", t->first.c_str());
+                        exit(1);
+                    }
+                }
+            }
+            double us = FCam::Time::now() - start;
+            if (us < best) best = us;
+        }
+        if (best < 1) best = 1;
+        printf("{\"benchmark\": \"tag_serialization\", \"format\": \"%s\", \"frames\": %d, "
+               "\"us_per_frame\": %.2f, \"mb_per_s\": %.1f}\n",
+               formats[fmt], frames, best / frames, bytes / best);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) runs = atoi(argv[1]);
+    if (argc > 2) tmpDir = argv[2];
+    if (runs < 1) runs = 1;
+
+    for (size_t i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++) {
+        benchRaw(resolutions[i]);
+        benchYUV(resolutions[i]);
+    }
+    benchTags();
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Speed and accuracy of resampling.
+//
+// Shrinks a full resolution YUV420p frame to the size of the
+// FCameraPro thumbnails with each ResampleMethod, and with the box
+// filtered subsampler the thumbnail writer used to carry. Accuracy is
+// the PSNR of the luma plane against an exact (double precision) area
+// average of the source. Also times RGB24 and RAW (Bayer) resampling,
+// and the RAW thumbnail path.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <FCam/processing/Resample.h>
+#include <FCam/processing/Demosaic.h>
+#include <FCam/Frame.h>
+#include <FCam/Time.h>
+#include <FCam/Tegra/Platform.h>
+
+static const int width = 2592, height = 1944;
+static const int thumbWidth = 384, thumbHeight = 288;
+
+struct SimFrame : public FCam::_Frame {
+    FCam::Shot _shot;
+    const FCam::Shot &baseShot() const {return _shot;}
+    const FCam::Platform &platform() const {return FCam::Tegra::Platform::instance();}
+};
+
+// A zone plate over a gradient: fine detail that aliases badly if
+// it isn't filtered out
+static unsigned char scene(int x, int y) {
+    float dx = x - width / 2.0f, dy = y - height / 2.0f;
+    float v = 0.3f + 0.4f * x / width + 0.25f * sinf((dx*dx + dy*dy) * 0.0004f);
+    return (unsigned char)(v * 255 + 0.5f);
+}
+
+// The subsampler AsyncImageWriter used for thumbnails: a 5x5 box
+// filter at each subsampled point
+static void boxSubsample(unsigned char *dest, int dstWidth, int dstHeight,
+                         const unsigned char *src, int srcWidth, int srcHeight) {
+    const int radius = 5, norm = 0x10000 / (radius * radius);
+    int ax = ((srcWidth - (radius & ~1)) << 16) / dstWidth;
+    int ay = ((srcHeight - (radius & ~1)) << 16) / dstHeight;
+    for (int i = 0, ty = 0; i < dstHeight; i++, ty += ay) {
+        for (int j = 0, tx = 0; j < dstWidth; j++, tx += ax) {
+            const unsigned char *s = src + (ty >> 16) * srcWidth + (tx >> 16);
+            int sum = 0;
+            for (int y = 0; y < radius; y++, s += srcWidth) {
+                for (int x = 0; x < radius; x++) sum += s[x];
+            }
+            *dest++ = sum * norm >> 16;
+        }
+    }
+}
+
+static void boxThumbnail(const FCam::Image &src, FCam::Image &dst) {
+    int sw = src.width(), sh = src.height(), dw = dst.width(), dh = dst.height();
+    const unsigned char *s = src(0, 0);
+    unsigned char *d = dst(0, 0);
+    boxSubsample(d, dw, dh, s, sw, sh);
+    s += sw * sh;
+    d += dw * dh;
+    boxSubsample(d, dw/2, dh/2, s, sw/2, sh/2);
+    s += sw * sh / 4;
+    d += dw * dh / 4;
+    boxSubsample(d, dw/2, dh/2, s, sw/2, sh/2);
+}
+
+static double lumaPsnr(const FCam::Image &out, const std::vector<double> &truth) {
+    double err = 0;
+    for (int y = 0; y < thumbHeight; y++) {
+        for (int x = 0; x < thumbWidth; x++) {
+            double d = out(x, y)[0] - truth[y * thumbWidth + x];
+            err += d * d;
+        }
+    }
+    return 10 * log10(255.0 * 255.0 / (err / (thumbWidth * thumbHeight)));
+}
+
+static void report(const char *format, const char *method, double ms, double psnr) {
+    printf("{\"benchmark\": \"resample\", \"format\": \"%s\", \"method\": \"%s\", "
+           "\"from\": \"%dx%d\", \"to\": \"%dx%d\", \"ms\": %.2f", format, method,
+           width, height, thumbWidth, thumbHeight, ms);
+    if (psnr > 0) printf(", \"psnr_db\": %.2f", psnr);
+    printf("}\n");
+}
+
+int main(int argc, char **argv) {
+    int runs = 10;
+    if (argc > 1) runs = atoi(argv[1]);
+
+    FCam::Image yuv(width, height, FCam::YUV420p);
+    unsigned char *p = yuv(0, 0);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) *p++ = scene(x, y);
+    }
+    for (int i = 0; i < width * height / 2; i++) *p++ = 128;
+
+    // The exact area average of the luma
+    std::vector<double> truth(thumbWidth * thumbHeight);
+    double sx = (double)width / thumbWidth, sy = (double)height / thumbHeight;
+    for (int ty = 0; ty < thumbHeight; ty++) {
+        for (int tx = 0; tx < thumbWidth; tx++) {
+            double sum = 0;
+            for (int y = (int)(ty * sy); y < (ty + 1) * sy; y++) {
+                double wy = std::min<double>(y + 1, (ty + 1) * sy) - std::max<double>(y, ty * sy);
+                for (int x = (int)(tx * sx); x < (tx + 1) * sx; x++) {
+                    double wx = std::min<double>(x + 1, (tx + 1) * sx) - std::max<double>(x, tx * sx);
+                    sum += wx * wy * yuv(x, y)[0];
+                }
+            }
+            truth[ty * thumbWidth + tx] = sum / (sx * sy);
+        }
+    }
+
+    FCam::Image thumb(thumbWidth, thumbHeight, FCam::YUV420p);
+    FCam::Time start = FCam::Time::now();
+    for (int i = 0; i < runs; i++) boxThumbnail(yuv, thumb);
+    report("yuv420p", "old_box_subsample", (FCam::Time::now() - start) / 1000.0 / runs, lumaPsnr(thumb, truth));
+
+    const char *names[] = {"area", "bilinear", "lanczos"};
+    const FCam::ResampleMethod methods[] = {FCam::AreaResample, FCam::BilinearResample, FCam::LanczosResample};
+    for (int m = 0; m < 3; m++) {
+        start = FCam::Time::now();
+        for (int i = 0; i < runs; i++) FCam::resample(yuv, thumb, methods[m]);
+        report("yuv420p", names[m], (FCam::Time::now() - start) / 1000.0 / runs, lumaPsnr(thumb, truth));
+    }
+
+    // Flat areas must come through exactly
+    FCam::Image flat(width, height, FCam::RGB24), flatOut(thumbWidth, thumbHeight, FCam::RGB24);
+    memset(flat(0, 0), 77, width * height * 3);
+    for (int m = 0; m < 3; m++) {
+        FCam::resample(flat, flatOut, methods[m]);
+        for (int i = 0; i < thumbWidth * thumbHeight * 3; i++) {
+            if (flatOut(0, 0)[i] != 77) {
+                printf("%s resampling changed a flat field (%d at %d)\n", names[m], flatOut(0, 0)[i], i);
+                return 1;
+            }
+        }
+    }
+
+    FCam::Image rgb(width, height, FCam::RGB24), rgbOut(thumbWidth, thumbHeight, FCam::RGB24);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char v = yuv(x, y)[0];
+            rgb(x, y)[0] = v;
+            rgb(x, y)[1] = 255 - v;
+            rgb(x, y)[2] = v / 2;
+        }
+    }
+    start = FCam::Time::now();
+    for (int i = 0; i < runs; i++) FCam::resample(rgb, rgbOut, FCam::AreaResample);
+    report("rgb24", "area", (FCam::Time::now() - start) / 1000.0 / runs, 0);
+
+    SimFrame *f = new SimFrame;
+    f->_shot.whiteBalance = 5000;
+    f->image = FCam::Image(width, height, FCam::RAW);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            ((short *)f->image(x, y))[0] = yuv(x, y)[0] * 4;
+        }
+    }
+    FCam::Frame frame(f);
+
+    FCam::Image rawOut(2 * thumbWidth, 2 * thumbHeight, FCam::RAW);
+    start = FCam::Time::now();
+    for (int i = 0; i < runs; i++) FCam::resample(frame.image(), rawOut, FCam::AreaResample);
+    report("raw", "area", (FCam::Time::now() - start) / 1000.0 / runs, 0);
+
+    start = FCam::Time::now();
+    for (int i = 0; i < runs; i++) FCam::makeThumbnail(frame, FCam::Size(thumbWidth, thumbHeight));
+    report("raw", "thumbnail", (FCam::Time::now() - start) / 1000.0 / runs, 0);
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Microbenchmark of tag-heavy frame construction and destruction.
+//
+// Each iteration builds a TagMap the way the Tegra Lens and Flash
+// devices tag a frame (a few dozen scalar tags plus a couple of small
+// vectors), copies it as Frame handling does, and then destroys both
+// maps. Reports time and heap allocations per frame. Also checks that
+// a TagMapView rejects blobs with damaged headers rather than reading
+// past them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+
+#include <FCam/Frame.h>
+#include <FCam/TagValue.h>
+#include <FCam/TagMapView.h>
+#include <FCam/Time.h>
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t bytes) {
+    allocations++;
+    void *ptr = malloc(bytes);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) throw() {
+    free(ptr);
+}
+
+// C++14 compilers call the sized delete, whose default would not pair
+// with the malloc above
+void operator delete(void *ptr, size_t) throw() {
+    operator delete(ptr);
+}
+
+static const char *scalarTags[] = {
+    "lens.initialFocus", "lens.finalFocus", "lens.focus", "lens.focusSpeed",
+    "lens.zoom", "lens.initialZoom", "lens.finalZoom", "lens.zoomSpeed",
+    "lens.aperture", "lens.initialAperture", "lens.finalAperture", "lens.apertureSpeed",
+    "lens.minZoom", "lens.maxZoom", "lens.wideApertureMin", "lens.wideApertureMax",
+    "flash.brightness", "flash.duration", "flash.peak", "flash.start"
+};
+static const int numScalarTags = sizeof(scalarTags)/sizeof(scalarTags[0]);
+
+static void tagFrame(FCam::TagMap &tags, int frame) {
+    for (int i = 0; i < numScalarTags; i++) {
+        tags[scalarTags[i]] = (float)(frame + i);
+    }
+    tags["frame.index"] = frame;
+    tags["frame.time"] = FCam::Time(frame, 0);
+    tags["frame.gainRatio"] = 1.0/(frame+1);
+
+    std::vector<float> wb(3, 1.0f);
+    tags["frame.wbGains"] = wb;
+    std::vector<int> hist(16, frame);
+    tags["frame.histogramSummary"] = hist;
+}
+
+// Whether a view of the first bytes of a blob, after patching its
+// header's total size, comes out valid. The header is the magic, the
+// tag count and the total size, each four bytes.
+static bool viewValid(const std::string &blob, size_t bytes, uint32_t totalBytes) {
+    // TagMapView wants an 8-byte aligned buffer. Keep it no larger
+    // than needed, so a memory checker catches any read past it.
+    std::vector<uint64_t> buf((bytes + 7) / 8);
+    memcpy(&buf[0], blob.data(), bytes);
+    memcpy((char *)&buf[0] + 8, &totalBytes, sizeof(totalBytes));
+    return FCam::TagMapView(&buf[0], bytes).valid();
+}
+
+static bool checkMalformedBlobs() {
+    FCam::TagMap tags;
+    tagFrame(tags, 1);
+    std::string blob = FCam::tagMapToBlob(tags);
+    uint32_t total = blob.size();
+
+    bool ok = viewValid(blob, blob.size(), total);
+    // A header claiming less than its own size, with nothing after it
+    ok = ok && !viewValid(blob, 16, 0);
+    ok = ok && !viewValid(blob, 16, 8);
+    ok = ok && !viewValid(blob, 16, 15);
+    // A header claiming more than there is
+    ok = ok && !viewValid(blob, blob.size() - 8, total);
+    ok = ok && !viewValid(blob, 15, total);
+    printf("{\"benchmark\": \"tagmapview_malformed_blobs\", \"correct\": %s}\n", ok ? "true" : "false");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int frames = 100000;
+    if (argc > 1) frames = atoi(argv[1]);
+
+    // Warm up, so the map's bucket arrays are not counted against the first frames
+    {
+        FCam::TagMap tags;
+        tagFrame(tags, 0);
+    }
+
+    unsigned long startAllocations = allocations;
+    FCam::Time start = FCam::Time::now();
+    for (int f = 0; f < frames; f++) {
+        FCam::TagMap tags;
+        tagFrame(tags, f);
+        FCam::TagMap copy(tags);
+    }
+    FCam::Time end = FCam::Time::now();
+    unsigned long totalAllocations = allocations - startAllocations;
+
+    double usPerFrame = (double)(end - start) / frames;
+    printf("{\"benchmark\": \"tagvalue_frame_tags\", \"frames\": %d, "
+           "\"tags_per_frame\": %d, \"us_per_frame\": %.3f, \"allocations_per_frame\": %.2f}\n",
+           frames, numScalarTags + 5, usPerFrame, (double)totalAllocations / frames);
+
+    if (!checkMalformedBlobs()) return 1;
+    return 0;
+}
@@ -33,6 +33,64 @@ namespace FCam {
                     int maxExposure = 125000, // 8 fps
                     int minExposure = 500,    // 1/2000 s
                     float smoothness = 0.5);
+
+    /** A metering controller for streaming, which takes the exposure
+     * and gain latency of the sensor into account. Frames keep
+     * arriving for a few frame times after the shot is changed,
+     * taken with the old parameters. The simple \ref autoExpose
+     * reacts to each of them in turn, overshoots, and oscillates for
+     * a while after a sudden change in scene brightness.
+     *
+     * This controller instead estimates the absolute brightness of
+     * the scene from each frame and the exposure and gain it was
+     * actually taken with. It predicts the parameters that will give
+     * the target brightness, so frames still in flight agree with
+     * later ones rather than pushing the exposure further in the same
+     * direction. When a frame is too saturated or too dark to measure
+     * how far off it is, the controller takes a bounded step, and
+     * waits for a frame requested with the new parameters before
+     * stepping again. After a step change in the scene, it settles
+     * within a few round trips through the sensor pipeline.
+     *
+     * Call update with every frame returned while streaming. It
+     * limits and orders exposure and gain changes like \ref
+     * autoExpose. */
+    class AutoExposure {
+    public:
+        /** The arguments have the same meaning as for \ref
+         * autoExpose. Since changes are predicted rather than
+         * reacted to, the smoothness only damps noise, and applies
+         * per frame in the log domain. */
+        AutoExposure(float maxGain = 32.0f,
+                     int maxExposure = 125000,
+                     int minExposure = 500,
+                     float smoothness = 0.5);
+
+        /** Meter a frame, and update the shot for the next
+         * request. Frames without a usable histogram are ignored. */
+        void update(Shot *s, const Frame &f);
+
+        /** Forget about any change still in flight, for example when
+         * the streaming shot is replaced. */
+        void reset();
+
+        /** Was the last frame metered within a few percent of the
+         * target brightness? */
+        bool converged() const {return _converged;}
+
+    private:
+        float maxGain;
+        int maxExposure, minExposure;
+        float smoothness;
+
+        // The brightness (exposure times gain) most recently set on
+        // the shot, or zero if there is none in flight
+        float pending;
+        // How many frames have arrived since then that were not
+        // requested with it
+        int waited;
+        bool _converged;
+    };
 }
 
 #endif
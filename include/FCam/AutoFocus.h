@@ -15,7 +15,16 @@ namespace FCam {
     /** This class does autofocus, by sweeping the sensor back and
         forth until a nice thing to focus on is found. You call \ref
         startSweep, then feed it frames using \ref update, until \ref
-        focused returns true. */
+        focused returns true.
+
+        The focus search is a contrast-detect hill climb. A coarse pass
+        steps the lens from far to near, and stops early once the
+        sharpness has clearly peaked. A fine pass then refines the
+        peak with a quarter of the step size, and the lens is set to
+        the peak of a parabola fit through the best samples. Only
+        frames exposed while the lens was resting at the requested
+        position (according to the lens tags) are measured, so the
+        search adapts to the focus latency of the lens. */
     class AutoFocus {
     public:
         /** Construct an AutoFocus helper object that uses the
@@ -35,9 +44,12 @@ namespace FCam {
          * appropriately. This function will ignore frames that aren't
          * tagged by the lens this object was constructed with, and
          * will also ignore frames with no sharpnes map.
-         * When the lens minFocusSpeed doesn't allow for a focus
-         * in one second, the autofocus algorithm will step through
-         * the focus positions. Pass a shot to add the focus action. */
+         * Each lens move is requested by adding a
+         * Lens::FocusAction to the shot passed in, so that it is
+         * issued together with the next request to the sensor. Pass
+         * that shot to \ref Sensor::stream (or capture) again after
+         * calling update. If no shot is given, the lens is moved
+         * directly. */
         virtual void update(const FCam::Frame &f, FCam::Shot *s = NULL);
 
         /** Is the lens currently focused? */
@@ -61,6 +73,30 @@ namespace FCam {
         enum {IDLE = 0, HOMING, SWEEPING, STEPPING, SETTING, FOCUSED} state;
 
         Rect rect;
+
+        /** The sharpest sample of the current sweep */
+        Stats best;
+
+        /** Where the lens has been asked to go, the step to take
+         * from there, and the last position to sample in the current
+         * pass */
+        float target, step, passEnd;
+
+        /** How many samples in a row fell well below the best one,
+         * and how many frames have been skipped waiting for the lens
+         * to arrive at the target (-1 before the first move) */
+        int falls, waited;
+
+        /** Move the lens, using a FocusAction on the shot if there is
+         * one */
+        void moveLens(float position, Shot *s);
+
+        /** Mean sharpness of the target rectangle of a frame */
+        int measure(const Frame &f) const;
+
+        /** Pick the final position from the samples around the best
+         * one */
+        float peak() const;
     };
 
 }
@@ -18,6 +18,15 @@ namespace FCam {
      * be. 0 makes instant changes. 1 never changes at all. 0.5 is
      * recommended.
      *
+     * For YpUV statistics, as produced on Tegra, the correlated color
+     * temperature of the light is solved for directly from the mean
+     * color of the gray parts of the frame and the white balance the
+     * frame was actually taken with. The per-region color sums in the
+     * "stats.regionYUV" frame tag are used if present, and the
+     * histogram otherwise. Since the estimate does not depend on
+     * earlier frames, the white balance converges within one or two
+     * round trips through the sensor pipeline, and the smoothness
+     * only applies to changes of less than 10 mireds.
      */
     void autoWhiteBalance(Shot *s, const Frame &f, 
                           int minWB = 3200,
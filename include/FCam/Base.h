@@ -46,6 +46,15 @@ namespace FCam {
          * the high 4-6 bits will commonly be zero (for 12 or 10 bit
          * sensors respectively).*/
         RAW,
+
+        /** YV12 = planar YUV, as YUV420p but with the chroma planes
+         * swapped: a Y width x height plane followed by a V width/2 x
+         * height/2 plane followed by a U width/2 x height/2
+         * plane. This is the layout Android's display path expects,
+         * so preview frames requested in this format can be handed to
+         * it without any reordering. (YUV420p is the I420
+         * layout.) */
+        YV12,
         
         /** An unknown or invalid format. Also acts as a sentinel, so
          * this must be the last entry in the enum. */
@@ -0,0 +1,174 @@
+#ifndef FCAM_COUNTERS_H
+#define FCAM_COUNTERS_H
+
+/** \file
+ * Performance counters. Unlike the debugging output, these are
+ * always compiled in, cheap enough to leave running, and can be read
+ * back at run time or dumped as JSON. */
+
+#include <string>
+#include <pthread.h>
+
+#include "Time.h"
+
+namespace FCam {
+
+    /** A named running total, such as the number of frames delivered
+     * or of bytes written to files. Counters are meant to be
+     * constructed once, as static objects, and register themselves
+     * under their name so that they can be read with \ref
+     * Counters::value or dumped with \ref Counters::json.
+     *
+     * Increments are spread over a few shards picked by the calling
+     * thread, so threads counting the same thing rarely contend for
+     * the same cache line, and take no lock. */
+    class Counter {
+    public:
+        /** Make and register a counter. The name should stay valid
+         * for the life of the counter; usually it is a string
+         * literal. By convention names are of the form
+         * "module.what_is_counted". */
+        Counter(const char *name);
+        ~Counter();
+
+        /** Add to the count. Safe to call from any thread. */
+        void add(unsigned long n = 1) {
+            Shard &s = shards[shard()];
+            if (__sync_add_and_fetch(&s.value, n) >= FoldAt) fold(s);
+        }
+
+        /** The total so far */
+        unsigned long long value() const;
+
+        /** Set the total back to zero */
+        void reset();
+
+        const char *name() const {return _name;}
+
+    private:
+        enum {Shards = 8};
+        // Shards hand their count over to the 64 bit total before
+        // they can wrap, which matters where longs are 32 bits
+        enum {FoldAt = 1 << 30};
+
+        struct Shard {
+            volatile unsigned long value;
+            // Keep shards on separate cache lines
+            char padding[64 - sizeof(unsigned long)];
+        };
+        Shard shards[Shards];
+        unsigned long long folded;
+        mutable pthread_mutex_t mutex;
+        const char *_name;
+
+        static int shard() {
+            unsigned long t = (unsigned long)pthread_self();
+            return (t ^ (t >> 7) ^ (t >> 13)) & (Shards - 1);
+        }
+        void fold(Shard &);
+
+        Counter(const Counter &);
+        Counter &operator=(const Counter &);
+    };
+
+    /** A named distribution of values, such as the time taken to
+     * convert an image in microseconds, or the depth of a queue. Keeps
+     * the number, sum and largest of the values recorded, and a
+     * histogram of them with power of two buckets. Distributions
+     * register themselves like \ref Counter "Counters". Recording a
+     * value takes a short lock, so they suit things that happen once
+     * a frame rather than once a pixel. */
+    class Distribution {
+    public:
+        /** Make and register a distribution. See Counter::Counter. */
+        Distribution(const char *name);
+        ~Distribution();
+
+        /** Record a value. Safe to call from any thread. */
+        void record(unsigned long v);
+
+        /** How many values have been recorded */
+        unsigned long long count() const;
+
+        /** The sum of the values recorded */
+        unsigned long long sum() const;
+
+        /** The largest value recorded */
+        unsigned long max() const;
+
+        /** How many values fell in the given bucket. Bucket 0 holds
+         * zeros, and bucket i > 0 holds values from 2^(i-1) up to
+         * 2^i - 1. The last bucket also holds anything larger. */
+        unsigned long bucket(int i) const;
+
+        enum {Buckets = 32};
+
+        /** Forget all the values recorded */
+        void reset();
+
+        const char *name() const {return _name;}
+
+    private:
+        unsigned long long _count, _sum;
+        unsigned long _max;
+        unsigned long buckets[Buckets];
+        mutable pthread_mutex_t mutex;
+        const char *_name;
+
+        Distribution(const Distribution &);
+        Distribution &operator=(const Distribution &);
+    };
+
+    /** Records the time in microseconds between its construction and
+     * its destruction in a Distribution. */
+    class ScopedTimer {
+    public:
+        ScopedTimer(Distribution &d) : dist(d), start(Time::now()) {}
+        ~ScopedTimer() {
+            int elapsed = Time::now() - start;
+            dist.record(elapsed > 0 ? elapsed : 0);
+        }
+    private:
+        Distribution &dist;
+        Time start;
+    };
+
+    /** Access to all the registered counters and distributions. The
+     * library keeps, among others:
+     *
+     * - sensor.frames_delivered, sensor.frames_dropped and
+     *   sensor.bubbles_captured
+     * - sensor.frame_queue_depth and sensor.request_queue_depth
+     *   (distributions, sampled as frames are queued)
+     * - sensor.statistics_us (the time to compute a frame's
+     *   histogram and sharpness map)
+     * - convert.yuv420_to_rgb24_us, convert.yuv420_to_yv12_us and
+     *   processing.demosaic_us
+     * - image.allocations and image.bytes_allocated
+     * - file.files_written and file.bytes_written
+     * - debug.messages_dropped (debugging output lost because the
+     *   thread writing it out fell behind)
+     */
+    namespace Counters {
+        /** The total of the named counter, or the number of values
+         * recorded by the named distribution. Zero if there is no
+         * such counter. */
+        unsigned long long value(const std::string &name);
+
+        /** All the counters and distributions as a JSON object, with
+         * a "counters" object mapping names to totals and a
+         * "distributions" object mapping names to their count, sum,
+         * max, mean and buckets (up to the last non-empty one). */
+        std::string json();
+
+        /** Write json() to the given file. Returns whether it
+         * succeeded. */
+        bool saveJSON(const std::string &filename);
+
+        /** Set every counter and distribution back to zero */
+        void reset();
+    }
+
+}
+
+#endif
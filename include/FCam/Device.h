@@ -1,6 +1,8 @@
 #ifndef FCAM_DEVICE_H
 #define FCAM_DEVICE_H
 
+#include <vector>
+
 #include "Time.h"
 #include "Event.h"
 
@@ -15,7 +17,7 @@ namespace FCam {
         have a bunch of methods to do their thing (e.g. the lens has
         methods to move it around.). Devices also typically define
         nested actions, and tags. */
-    class Device : public EventGenerator {
+    class Device : public EventGenerator, public EventListener {
       public:
         /** Your device should implement this method to tag a frame
          * coming back from the sensor. Don't forget to \ref
@@ -29,6 +31,12 @@ namespace FCam {
          * tags. */
         virtual void tagFrame(Frame) = 0;
 
+        /** Tag a batch of frames returned together by the sensor
+         * (see Tegra::Sensor::getFrames). By default this calls
+         * tagFrame on each frame in turn. Devices can override it to
+         * look up state shared by the whole batch only once. */
+        virtual void tagFrames(const std::vector<Frame> &frames);
+
         /** Devices might need to handle events from the sensor they
          *  are attached to.
          */
@@ -27,6 +27,9 @@ namespace FCam {
         int data;                //!< data associated with this Event
         Time time;               //!< Time this Event occured
         std::string description; //!<  A human-readable description of the event
+        int count;               //!< How many identical events this one stands for. See \ref setEventCoalescing.
+
+        Event(): creator(NULL), type(0), data(0), count(1) {}
 
         /** The list of builtin event types
          * 
@@ -132,13 +135,77 @@ while (FCam::getNextEvent(&event)) {
      * queue. */
     bool getNextEvent(Event *, EventGenerator *creator);
 
-    /** Add an event to the event queue. */
+    /** A base class for things that want events delivered to them
+     * as they are posted, rather than polling for them with \ref
+     * getNextEvent. See \ref subscribe. */
+    class EventListener {
+      public:
+        /** Called on the event dispatcher thread for each event
+         * matching one of this listener's subscriptions. Events are
+         * delivered one at a time, in the order they were posted, so
+         * this should return promptly. */
+        virtual void handleEvent(const Event &e) = 0;
+
+        virtual ~EventListener() {}
+    };
+
+    /** Deliver all future events of the given type to the
+     * listener. Events delivered to at least one listener are not
+     * also placed on the event queue for \ref getNextEvent. The
+     * dispatcher thread that delivers events is started by the first
+     * subscription. */
+    void subscribe(EventListener *, int type);
+    /** Deliver all future events of the given type created by the
+     * given EventGenerator to the listener. */
+    void subscribe(EventListener *, int type, EventGenerator *creator);
+    /** Deliver all future events created by the given EventGenerator
+     * to the listener. */
+    void subscribe(EventListener *, EventGenerator *creator);
+
+    /** Remove all subscriptions of a listener. Once this returns, the
+     * listener will not be called again, unless this is called from
+     * within a listener, in which case the event currently being
+     * delivered may still reach it. */
+    void unsubscribe(EventListener *);
+
+    /** Add an event to the event queue, or deliver it to its
+     * subscribers. */
     void postEvent(Event);
 
     /** A simplified event posting interface that includes a type,
      * integer code, message, and optional creator. */
     void postEvent(int type, int code, const std::string &msg, EventGenerator *creator = NULL);
 
+    /** Merge repeated events. Once an event has been posted, further
+     * events with the same type, data and creator posted within the
+     * next interval microseconds are counted but not queued. Once
+     * the interval is over the count is reported as a single event,
+     * with its \ref Event::count set accordingly: to subscribers as
+     * soon as the interval ends, and otherwise at the next event
+     * posted or the next call to getNextEvent. For
+     * error and warning events, the message of a merged event is
+     * never formatted, so that a flood of errors costs little more
+     * than a counter increment each. An interval of zero, the
+     * default, disables merging. */
+    void setEventCoalescing(int interval);
+
+    /** Limit the number of events waiting on the event queue. Once
+     * the limit is reached, the oldest event is discarded for each
+     * new one. Zero means no limit. The default is 1024. */
+    void setEventQueueLimit(size_t limit);
+
+    /** Counters describing the traffic through the event queue */
+    struct EventStats {
+        unsigned posted;    //!< Events queued or delivered to listeners
+        unsigned coalesced; //!< Events merged into an earlier event
+        unsigned dropped;   //!< Events discarded due to the queue limit
+    };
+
+    /** Get the event counters accumulated since startup or the last
+     * call to \ref resetEventStats. */
+    EventStats eventStats();
+    void resetEventStats();
+
     /** Post an error event, using printf-style arguments. */
     void error(int code, EventGenerator *creator, const char *fmt, ...);
 
@@ -150,9 +217,6 @@ while (FCam::getNextEvent(&event)) {
 
     /** Post a warning event with no creator, using printf-style arguments. */
     void warning(int code, const char *fmt, ...);    
-
-    /** The global event queue */
-    extern TSQueue<Event> _eventQueue;
 }
 
 #endif
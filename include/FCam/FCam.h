@@ -9,6 +9,7 @@
 #include "AutoExposure.h"
 #include "AutoFocus.h"
 #include "AutoWhiteBalance.h"
+#include "Counters.h"
 #include "Device.h"
 #include "Event.h"
 #include "Flash.h"
@@ -20,10 +21,12 @@
 #include "Shot.h"
 #include "Time.h"
 
+#include "processing/Burst.h"
 #include "processing/DNG.h"
 #include "processing/Demosaic.h"
 #include "processing/Dump.h"
 #include "processing/JPEG.h"
+#include "processing/Resample.h"
 
 namespace FCam {
 
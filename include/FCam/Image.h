@@ -3,6 +3,7 @@
 
 #include "Base.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <string>
 
@@ -176,7 +177,7 @@ namespace FCam {
 	 * of bytes into the file the image buffer starts at, and the
 	 * dimensions and format of the image, followed by whether
 	 * changing the image data also changes the file. */
-	Image(int fd, int offset, Size, ImageFormat, bool writeThrough = false);
+	Image(int fd, uint64_t offset, Size, ImageFormat, bool writeThrough = false);
 
         /** Returns an Image containing a copy of the current Image's
          * data. Useful for converting an Image with a weak reference
@@ -2,6 +2,7 @@
 #define FCAM_PLATFORM
 
 #include <string>
+#include <stdint.h>
 #include "FCam/Base.h"
 
 /** \file 
@@ -13,6 +14,11 @@ namespace FCam {
     /** The abstract base class for static platform data. */
     class Platform {
     public:
+        Platform();
+        /** Copies get a cache of their own. */
+        Platform(const Platform &);
+        Platform &operator=(const Platform &);
+
         /** Get the bayer pattern of this sensor when in raw mode. */
         virtual BayerPattern bayerPattern() const = 0;
 
@@ -21,6 +27,21 @@ namespace FCam {
          * row-major order. */
         virtual void rawToRGBColorMatrix(int kelvin, float *matrix) const = 0;
 
+        /** The granularity in kelvin of the color matrix cache. */
+        enum {ColorMatrixQuantum = 50};
+
+        /** The same as \ref rawToRGBColorMatrix, with the white
+         * balance rounded to the nearest \ref ColorMatrixQuantum
+         * kelvin. Matrices are computed once per platform and white
+         * balance and cached, so this is cheap enough to call for
+         * every frame. Thread-safe. */
+        void colorMatrix(int kelvin, float *matrix) const;
+
+        /** The matrix given by \ref colorMatrix in signed 8.8 fixed
+         * point, rounded to nearest, for integer and NEON processing
+         * paths. */
+        void colorMatrixFixed(int kelvin, int16_t *matrix) const;
+
         /** The camera's manufacturer. (e.g. Canon). */
         virtual const std::string &manufacturer() const = 0;
 
@@ -33,7 +54,11 @@ namespace FCam {
         /** The largest value to expect when in raw mode. */
         virtual unsigned short maxRawValue() const = 0; 
 
-        virtual ~Platform(){}
+        virtual ~Platform();
+
+    private:
+        struct ColorMatrixCache;
+        ColorMatrixCache *colorCache;
     };
 }
 
@@ -60,7 +60,8 @@ namespace FCam {
 
         /** Which frames should be dropped if there are too many frames in the frame Queue. */
         enum DropPolicy {DropNewest = 0, //!< Drop the newest frames
-                         DropOldest      //!< Drop the oldest frames
+                         DropOldest,     //!< Drop the oldest frames
+                         DropAdaptive    //!< Compare the rate frames are taken off the frame queue with the rate they arrive, and while the consumer falls behind, shed work on streamed frames before any frames need dropping: first skip the statistics on every other one, then skip streaming requests to match the consumer's rate. Drops the oldest frames if the limit is hit anyway.
         };
 
         /** Set which frames should be dropped if the frame limit is exceeded. */
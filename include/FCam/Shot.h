@@ -27,6 +27,10 @@ namespace FCam {
      * .. only adjust changed fields of b ..
      *
      * and still be able distinguish Frames created by a and b shots when they are handed over by the sensor.
+     *
+     * The actions and custom color matrix of a shot are shared between
+     * copies, and are only duplicated when a copy modifies them, so
+     * copying a shot does not allocate memory.
      */
     class Shot {
       public:
@@ -87,8 +91,9 @@ namespace FCam {
 
 
         /** Acquire a const reference to the set of actions to be
-         * performed during the short. */
-        const std::set<Action *> &actions() const {return _actions;}
+         * performed during the short. The actions may be shared with
+         * copies of this shot, so they should not be modified. */
+        const std::set<Action *> &actions() const;
 
         /** A unique ID, generated on construction. Feel free to
          * replace it with your own identifier. */
@@ -97,12 +102,16 @@ namespace FCam {
         Shot();
         ~Shot();
 
-        /** Copying a shot results in a very deep copy. This assigns a
-         * freshly generated shot id to the result. */
+        /** Copying a shot results in a deep copy, although actions and
+         * the color matrix are only duplicated once either shot
+         * changes them. This assigns a freshly generated shot id to
+         * the result. */
         Shot(const Shot &other);
 
-        /** Copying a shot results in a very deep copy. This assigns a
-         * freshly generated shot id to the result. */
+        /** Copying a shot results in a deep copy, although actions and
+         * the color matrix are only duplicated once either shot
+         * changes them. This assigns a freshly generated shot id to
+         * the result. */
         const Shot &operator=(const Shot &other);
 
         /** Set a custom color matrix to use to post-process this
@@ -114,7 +123,7 @@ namespace FCam {
 
         /** If a custom color matrix has been set for this shot, this
          * returns it. Otherwise this will return an empty vector. */
-        const std::vector<float> &colorMatrix() const {return _colorMatrix;}
+        const std::vector<float> &colorMatrix() const;
 
         /** Clear any custom color matrix set for this shot. The
          * whiteBalance field will be used instead to determine the
@@ -123,13 +132,22 @@ namespace FCam {
 
       private:
         static int _id;
+        // Also protects the reference counts of the shared data
         static pthread_mutex_t _idLock;        
 
-        /** The set of actions slaved to this device. */
-        std::set<Action *> _actions;
-
-        /** A custom color matrix for this shot. */
-        std::vector<float> _colorMatrix;
+        /** The set of actions slaved to this device, and the custom
+         * color matrix for this shot. Reference counted, and shared
+         * between copies of the shot until one of them is
+         * modified. NULL if there are neither. */
+        struct SharedData;
+        SharedData *_shared;
+
+        /** Drop this shot's reference to the shared data. */
+        void releaseShared();
+        /** Make sure this shot holds the only reference to its shared
+         * data, so that it can be modified. The actions are only
+         * duplicated if copyActions is true. */
+        SharedData *unshare(bool copyActions = true);
     };
 
 }
@@ -2,6 +2,7 @@
 #define FCAM_TSQUEUE_H
 
 #include <deque>
+#include <vector>
 #include <iterator>
 #include <semaphore.h>
 #include <pthread.h>
@@ -85,6 +86,15 @@ namespace FCam {
         bool tryPull(T *);
         bool tryPullBack(T *);
 
+        /** Like pull, but gives up and returns false if the queue is
+         * still empty after timeout microseconds. */
+        bool timedPull(T *, unsigned int timeout);
+
+        /** Dequeue up to n items from the front of the queue and
+         * append them to the vector, taking the lock only once. Does
+         * not block. Returns the number of items dequeued. */
+        size_t tryPullMany(std::vector<T> *, size_t n);
+
         /** Create an iterator referring to the front of the queue and
          * locks the queue. Queue will remain locked until all the
          * locked_iterators referring to it are destroyed. */
@@ -108,6 +118,9 @@ namespace FCam {
         sem_t *sem;
 
         friend class locking_iterator;
+
+        // Compute the absolute deadline for a timed wait
+        static void deadline(timespec *tv, unsigned int timeout);
     };
 
     template<typename T>
@@ -297,11 +310,7 @@ namespace FCam {
         } else {
 #ifndef FCAM_PLATFORM_OSX // No clock_gettime or sem_timedwait on OSX 
             timespec tv;
-            // This will overflow around 1 hour or so of timeout
-            clock_gettime(CLOCK_REALTIME, &tv);
-            tv.tv_nsec += timeout*1000;
-            tv.tv_sec += tv.tv_nsec / 1000000000;
-            tv.tv_nsec = tv.tv_nsec % 1000000000;
+            deadline(&tv, timeout);
             err=sem_timedwait(sem, &tv);
 #else
             err=sem_trywait(sem);
@@ -370,6 +379,54 @@ namespace FCam {
         return true;
     }
 
+    template<typename T>
+    bool TSQueue<T>::timedPull(T *ptr, unsigned int timeout) {
+#ifndef FCAM_PLATFORM_OSX
+        timespec tv;
+        deadline(&tv, timeout);
+        while (sem_timedwait(sem, &tv)) {
+            if (errno != EINTR) return false;
+        }
+#else
+        if (sem_trywait(sem)) return false;
+#endif
+        pthread_mutex_lock(&mutex);
+        T copyVal = q.front();
+        q.pop_front();
+        pthread_mutex_unlock(&mutex);
+        *ptr = copyVal;
+        return true;
+    }
+
+    template<typename T>
+    size_t TSQueue<T>::tryPullMany(std::vector<T> *out, size_t n) {
+        // Claim the items first, so that the lock is taken once for
+        // the whole batch.
+        size_t count = 0;
+        while (count < n && sem_trywait(sem) == 0) count++;
+        if (!count) return 0;
+        pthread_mutex_lock(&mutex);
+        for (size_t i = 0; i < count; i++) {
+            out->push_back(q.front());
+            q.pop_front();
+        }
+        pthread_mutex_unlock(&mutex);
+        return count;
+    }
+
+    template<typename T>
+    void TSQueue<T>::deadline(timespec *tv, unsigned int timeout) {
+#ifndef FCAM_PLATFORM_OSX
+        clock_gettime(CLOCK_REALTIME, tv);
+        tv->tv_sec += timeout / 1000000;
+        tv->tv_nsec += (long)(timeout % 1000000) * 1000;
+        if (tv->tv_nsec >= 1000000000) {
+            tv->tv_sec++;
+            tv->tv_nsec -= 1000000000;
+        }
+#endif
+    }
+
     template<typename T>
     typename TSQueue<T>::locking_iterator TSQueue<T>::begin() {
         return locking_iterator(this, q.begin());
@@ -0,0 +1,116 @@
+#ifndef FCAM_TAGMAPVIEW_H
+#define FCAM_TAGMAPVIEW_H
+
+#include <string>
+#include <stdint.h>
+
+#include "Frame.h"
+
+/** \file
+ * A compact binary encoding for an entire TagMap, and a read-only view
+ * that accesses tags directly from an encoded buffer. */
+
+namespace FCam {
+
+    /** Serialize a whole TagMap into a single binary blob. Unlike a
+     * sequence of TagValue::toBlob strings, the result starts with a
+     * sorted directory of all tags, and each value is stored in its
+     * native layout at an aligned offset. The blob can therefore be
+     * read in place with a TagMapView, without parsing or
+     * allocation. The encoding uses native byte order. */
+    std::string tagMapToBlob(const TagMap &tags);
+
+    /** Deserialize a blob made by tagMapToBlob into a TagMap. Returns
+     * an empty TagMap and posts a ParseError if the blob is
+     * malformed. */
+    TagMap tagMapFromBlob(const void *data, size_t bytes);
+
+    /** A read-only view of a TagMap encoded by tagMapToBlob. The view
+     * does not copy or own the buffer it is constructed from (which
+     * will usually be memory mapped from a file), so the buffer must
+     * outlive it. The buffer should be at least 8-byte aligned for
+     * direct access to double tags. */
+    class TagMapView {
+    public:
+        /** A single tag in a TagMapView. Accessing an entry as the
+         * wrong type posts a BadCast error and returns zero or
+         * NULL. */
+        class Entry {
+        public:
+            Entry(): base(NULL), dir(NULL) {}
+
+            /** Does this entry exist? */
+            bool valid() const {return dir != NULL;}
+
+            /** The tag name, NUL-terminated. */
+            const char *key() const;
+            TagValue::Type type() const;
+            /** Number of elements in a vector tag, number of bytes in
+             * a String tag, and 1 for scalar tags. */
+            int count() const;
+
+            int asInt() const;
+            float asFloat() const;
+            double asDouble() const;
+            /** The time stored in a Time tag, or element i of a
+             * TimeVector tag. */
+            Time asTime(int i = 0) const;
+
+            /** Direct pointers to the elements of vector tags. */
+            const int *asIntArray() const;
+            const float *asFloatArray() const;
+            const double *asDoubleArray() const;
+
+            /** The contents of a String tag, NUL-terminated. The
+             * string may contain further NUL bytes; count() gives its
+             * true length. */
+            const char *asCString() const;
+            /** Element i of a StringVector tag, NUL-terminated, with
+             * its true length optionally returned in length. */
+            const char *asCString(int i, int *length = NULL) const;
+
+            /** Make a regular (allocating) TagValue from this entry */
+            TagValue toTagValue() const;
+
+        private:
+            friend class TagMapView;
+            Entry(const unsigned char *b, const void *d): base(b), dir(d) {}
+            const void *data() const;
+            bool check(TagValue::Type t) const;
+
+            const unsigned char *base;
+            const void *dir;
+        };
+
+        /** Construct an invalid, empty view */
+        TagMapView();
+        /** Construct a view over an encoded buffer. The whole
+         * directory is validated here, so that the accessors need no
+         * further bounds checks. If validation fails, the view is
+         * invalid and a ParseError is posted. */
+        TagMapView(const void *data, size_t bytes);
+
+        bool valid() const {return base != NULL;}
+
+        /** The number of tags in the view */
+        int size() const {return count;}
+
+        /** The i'th tag, in key order */
+        Entry operator[](int i) const;
+
+        /** Look up a tag by name with a binary search. Returns an
+         * invalid Entry if there is no such tag. */
+        Entry find(const char *key) const;
+        Entry find(const std::string &key) const {return find(key.c_str());}
+
+        /** Copy every tag into a TagMap */
+        void toTagMap(TagMap *tags) const;
+
+    private:
+        const unsigned char *base;
+        int count;
+    };
+
+}
+
+#endif
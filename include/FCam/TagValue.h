@@ -151,15 +151,31 @@ tag.asIntVector().push_back(3);
         /** Deserialize from either format */
         static TagValue fromString(const std::string &);
 
+        /** Exchange the contents of two TagValues without copying
+         * any strings or vectors. Use this to move a large tag value
+         * into or out of a TagMap cheaply. */
+        void swap(TagValue &other);
+
         /** The type of this tag. */
         Type type;
 
-        /** A pointer to the actual value of this tag. */
+        /** A pointer to the actual value of this tag. Ints, floats,
+         * doubles and Times are stored inside the TagValue itself, so
+         * that scalar tags need no heap allocation; for those, data
+         * points into the TagValue. */
         void *data;
 
     private:
         void nullify();
 
+        static bool storedInPlace(Type t);
+
+        // In-place storage for scalar and Time values
+        union {
+            double alignment;
+            char bytes[sizeof(FCam::Time)];
+        } storage;
+
 
         // Dummy objects to return references to. Set them to zero or
         // clear them before returning a reference to them.
@@ -79,25 +79,18 @@ namespace FCam { namespace Tegra {
         /** Start the autofocus routine. Returns immediately. */
         virtual void startSweep();
 
-        /** Feed the autofocus routine a new frame. The sharpness map of the 
-         * frame is examined, and the autofocus will react
+        /** Feed the autofocus routine a new frame. The sharpness map
+         * of the frame is examined, and the autofocus will react
          * appropriately. This function will ignore frames that aren't
          * tagged by the lens this object was constructed with, and
-         * will also ignore frames with no sharpnes map.
-         * The update routine will do a sweep in a single operation
-         * by moving the lens at a low diopters/sec speed if possible. 
-         * Otherwise, the range will be covered by mutiple short steps
-         * at a high diopters/sec speed. In this latter case, the shot
-         * s is updated with the corresponding FocusStepping action.
+         * will also ignore frames with no sharpnes map. Lens moves
+         * are added to the shot s as FocusActions, so that the daemon
+         * issues them along with the next request. Frames still in
+         * flight when the lens moved are skipped, so the search waits
+         * out the focus latency of the lens rather than being misled
+         * by it. See FCam::AutoFocus for details of the search.
          */
         virtual void update(const FCam::Frame &f, FCam::Shot *s = NULL);
-
-    protected:
-        /** When state == SETTING || state == FOCUSED holds the
-         *  best focus position.
-         */
-        Stats best;
-
     };
 
 }}
@@ -63,6 +63,8 @@
 namespace FCam { namespace Tegra {
 
     struct _Frame : public FCam::_Frame {
+        _Frame() : fastMode(false), confidence(0), captureIndex(0), streamed(false) {}
+
 
         Shot _shot;
 
@@ -75,6 +77,15 @@ namespace FCam { namespace Tegra {
         /** A bitwise value of Frame::FrameConfidence enums */
         unsigned int confidence;
 
+        /** Used by the daemon to match the frame with the settings
+         * that were programmed when it was captured. */
+        unsigned int captureIndex;
+
+        /** Set for requests generated for a streaming shot, rather
+         * than passed to capture. The daemon may shed work on these
+         * when the consumer can't keep up. */
+        bool streamed;
+
         const Shot &shot() const { return _shot; }
         const FCam::Shot &baseShot() const { return shot(); }
         
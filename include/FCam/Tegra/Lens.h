@@ -162,6 +162,10 @@ namespace FCam { namespace Tegra {
          * frame. See \ref Lens::Tags */
         void tagFrame(FCam::Frame);
 
+        /** Tag a batch of frames, looking up the fixed zoom and
+         * aperture only once. */
+        void tagFrames(const std::vector<FCam::Frame> &frames);
+
         /** What was the focus at some time in the past? Uses linear
          * interpolation from known lens positions. */
         float getFocus(Time t) const;
@@ -178,6 +182,9 @@ namespace FCam { namespace Tegra {
         int dioptersToTicks(float) const;
         float tickRateToDiopterRate(int) const;
         int diopterRateToTickRate(float) const;
+
+        // Tag a frame given the zoom and aperture during it
+        void tagFrame(FCam::Frame f, float zoom, float aperture);
         
         struct LensState {
             Time time;
@@ -70,6 +70,56 @@ namespace FCam { namespace Tegra {
 
     class Daemon;
 
+    /** A change to the most commonly adjusted parameters of the
+     * streaming shot or burst, for use with
+     * Sensor::updateStream. Only the fields whose bits are set in
+     * \ref changed are applied; the rest of the streaming shot is
+     * left as it is. The set methods fill in a field and set its
+     * bit. */
+    struct StreamUpdate {
+        enum {
+            Exposure = 1,      //!< Set the exposure time
+            Gain = 2,          //!< Set the gain
+            WhiteBalance = 4,  //!< Set the white balance
+            Focus = 8,         //!< Move the lens at the start of the next frame
+            TargetImage = 16   //!< Set the image the frames are delivered into
+        };
+
+        StreamUpdate() : changed(0), exposure(0), gain(0), whiteBalance(0), lens(NULL), focus(0) {}
+
+        void setExposure(int e) {exposure = e; changed |= Exposure;}
+        void setGain(float g) {gain = g; changed |= Gain;}
+        void setWhiteBalance(int wb) {whiteBalance = wb; changed |= WhiteBalance;}
+        /** Add a FocusAction for the given lens to the next frame
+         * requested, and to that frame only. */
+        void setFocus(Lens *l, float f) {lens = l; focus = f; changed |= Focus;}
+        void setImage(const Image &im) {image = im; changed |= TargetImage;}
+
+        /** A bitwise or of the fields to apply */
+        int changed;
+
+        int exposure;
+        float gain;
+        int whiteBalance;
+        Lens *lens;
+        float focus;
+        Image image;
+    };
+
+    /** Counts of the work the sensor has shed to keep up with a
+     * slow consumer, since it was started. See
+     * Sensor::DropAdaptive. */
+    struct DropCounters {
+        DropCounters() : statisticsSkipped(0), requestsThrottled(0), framesDropped(0) {}
+
+        /** Streamed frames returned without their histogram or sharpness map */
+        int statisticsSkipped;
+        /** Streaming requests skipped, and captured as bubbles instead */
+        int requestsThrottled;
+        /** Frames dropped because the frame limit was hit, under any drop policy */
+        int framesDropped;
+    };
+
     /** The Tegra Sensor class. It takes vanilla shots and
      * returns vanilla frames. See the base class documentation
      * for the semantics of its methods. 
@@ -109,6 +159,17 @@ namespace FCam { namespace Tegra {
         void stream(const FCam::Shot &s);
         void stream(const std::vector<FCam::Shot> &);
 
+        /** Apply a StreamUpdate to every shot of the streaming shot
+         * or burst, starting with the next frame the sensor
+         * requests. Unlike stream, this doesn't copy the streaming
+         * shots or take the lock that guards them, so it costs
+         * almost nothing when called on every frame. Updates made
+         * before the next frame is requested are merged, later
+         * fields winning. A call to stream or stopStreaming
+         * discards any update not yet applied. Returns false if
+         * nothing is streaming. */
+        bool updateStream(const StreamUpdate &);
+
         bool streaming();
         void stopStreaming();
         void start();
@@ -140,10 +201,17 @@ namespace FCam { namespace Tegra {
         int framesPending() const;
         int shotsPending() const;
 
-        /* How many frames to discard after an exposure change */
+        /** What the drop policy has done so far */
+        DropCounters dropCounters() const;
+
+        /* How many frames to discard after an exposure change,
+         * according to the sensor configuration. The daemon starts
+         * from this and learns the actual latency from the frames it
+         * gets back. */
         int exposureLatency() const;
 
-        /* How many frames to discard after a gain change */
+        /* How many frames to discard after a gain change, according
+         * to the sensor configuration. */
         int gainLatency() const;
 
         virtual Platform &platform() {return Tegra::Platform::instance();}
@@ -151,6 +219,22 @@ namespace FCam { namespace Tegra {
 
         FCam::Tegra::Frame getFrame();
 
+        /** Get the next frame, waiting at most timeout microseconds
+         * for one to arrive. Returns an invalid frame if none
+         * arrived in time. A negative timeout waits forever. */
+        FCam::Tegra::Frame getFrame(int timeout);
+
+        /** Get the next frame if one is ready, without blocking.
+         * Returns an invalid frame otherwise. */
+        FCam::Tegra::Frame tryGetFrame() {return getFrame(0);}
+
+        /** Wait for a frame as getFrame(timeout) does, then also take
+         * up to maxFrames-1 further frames that are already
+         * available, in a single pass over the frame queue. Attached
+         * devices tag the whole batch at once. Returns the frames in
+         * order, or an empty vector on timeout. */
+        std::vector<FCam::Tegra::Frame> getFrames(int maxFrames, int timeout = -1);
+
         Hal::ICamera *getHardwareInterface() { return pHardwareInterface; }
 
         // IObserver interface...
@@ -166,6 +250,26 @@ namespace FCam { namespace Tegra {
         // The currently streaming shot            
         std::vector<Shot> streamingShot;            
 
+        // Updates to the streaming shot made with updateStream and not
+        // yet applied, guarded by updateMutex. updateVersion counts the
+        // calls to updateStream, and appliedVersion (guarded by
+        // requestMutex) is the count already folded into streamingShot,
+        // so generateRequest can tell there is nothing new with an
+        // atomic read of updateVersion rather than a lock.
+        StreamUpdate pendingUpdate;
+        pthread_mutex_t updateMutex;
+        volatile int updateVersion;
+        int appliedVersion;
+
+        // Drop any pending update, when a new stream or
+        // stopStreaming supersedes it. Called with requestMutex held.
+        void discardPendingUpdate();
+
+        // Fold the pending update, if any, into streamingShot. Returns
+        // the lens and focus to move to on the next frame, if the update
+        // asked for it. Called with requestMutex held.
+        Lens *applyPendingUpdate(float *focus);
+
         // The daemon that manages the Tegra's sensor
         friend class Daemon;
         Daemon *daemon;
@@ -188,7 +292,11 @@ namespace FCam { namespace Tegra {
         // This is so the daemon can inform the sensor that a frame
         // was dropped due to the frame limit being hit in a
         // thread-safe way
-        void decShotsPending();
+        void decShotsPending(int count = 1);
+
+        // Take the next frame off the frame queue, waiting as
+        // described for getFrame(timeout). Returns NULL on timeout.
+        _Frame *pullFrame(int timeout);
 
         // Returns the index to the sensor mode that will 
         // be applied for the given image size.
@@ -58,6 +58,10 @@
 namespace FCam { namespace Tegra { 
 
     bool convertYUV420ToRGB24(Image dstImg, Image srcImg);
+
+    /** Copy a YUV420p image into a YV12 image of the same size,
+     * swapping the chroma planes on the way. */
+    bool copyYUV420ToYV12(Image dstImg, Image srcImg);
 }}
 
 #endif
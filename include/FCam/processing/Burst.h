@@ -0,0 +1,121 @@
+#ifndef FCAM_BURST_H
+#define FCAM_BURST_H
+
+#include "../Frame.h"
+#include "../TagMapView.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** \file
+ * Saving and loading bursts of frames in a single container file.
+ *
+ * A burst file holds any number of RAW, RGB24, UYVY or YUV420p
+ * images, each followed by its serialized frame fields and tags. All
+ * data is appended sequentially, and an index of all frames is written
+ * at the end of the file when it is closed. Frames can then be read
+ * back in any order, with the image data memory mapped straight from
+ * the file.
+ */
+
+namespace FCam {
+
+    /** Writes frames sequentially into a burst container file. A
+     * BurstWriter is not thread-safe; use it from a single saving
+     * thread. */
+    class BurstWriter {
+    public:
+        BurstWriter();
+        /** Closes the file if it is still open. */
+        ~BurstWriter();
+
+        /** Create a new burst file, replacing any existing file of
+         * the same name. If reserveBytes is nonzero, that much space
+         * is preallocated in the file system up front, so that
+         * appending frames does not need to grow the file. Returns
+         * false on failure. */
+        bool open(const std::string &filename, size_t reserveBytes = 0);
+
+        /** Append a frame's image data, frame fields, and tags to the
+         * file. Frame fields are stored as tags with a "frame."
+         * prefix, using the same names as the DNG private data. */
+        bool append(Frame frame);
+        /** Append an image with an optional set of tags to the
+         * file. */
+        bool append(Image image, const TagMap &tags = TagMap());
+
+        /** Write the frame index, trim off any unused preallocated
+         * space, and close the file. Returns false if the index could
+         * not be written. */
+        bool close();
+
+        /** The number of frames appended so far. */
+        int frames() const {return (int)index.size();}
+
+        /** The number of bytes written to the file so far. */
+        uint64_t bytesWritten() const {return offset;}
+
+    private:
+        struct IndexEntry {
+            uint64_t imageOffset;
+            uint64_t tagOffset;
+            uint32_t tagBytes;
+            int32_t width, height, type;
+        };
+
+        bool writeBytes(const void *data, size_t bytes);
+
+        int fd;
+        std::string filename;
+        uint64_t offset;
+        std::vector<IndexEntry> index;
+
+        friend class BurstReader;
+    };
+
+    /** Provides random access to the frames in a burst container
+     * file. */
+    class BurstReader {
+    public:
+        BurstReader();
+        ~BurstReader();
+
+        /** Open a burst file and read its index. Returns false if the
+         * file is missing, truncated, or was never closed by its
+         * writer. */
+        bool open(const std::string &filename);
+        void close();
+
+        /** The number of frames in the file. */
+        int frames() const {return (int)index.size();}
+
+        /** Memory map the image data of a frame. The returned Image
+         * stays valid after the reader is closed. Returns an invalid
+         * Image if index is out of range. */
+        Image image(int frame) const;
+
+        /** Read the tags of a frame, including its "frame." fields. */
+        TagMap tags(int frame) const;
+
+        /** View the tags of a frame in place in the mapped file,
+         * without copying them. The view is valid until the reader is
+         * closed. Returns an invalid view if the file could not be
+         * mapped. */
+        TagMapView tagView(int frame) const;
+
+    private:
+        int fd;
+        std::string filename;
+        const unsigned char *mapping;
+        size_t mappingBytes;
+        std::vector<BurstWriter::IndexEntry> index;
+
+        // The size of a frame's image data in the file, as written by
+        // BurstWriter::append. Zero if the entry is not one append
+        // could have written.
+        static uint64_t imageBytes(const BurstWriter::IndexEntry &);
+    };
+
+}
+
+#endif
@@ -35,6 +35,12 @@ namespace FCam {
 
         Image thumbnail;
 
+        /** The IFDs holding the RAW and thumbnail image data, kept
+         * so that a frame returned by scanDNG can read its pixels
+         * in later on request. */
+        TiffIfd *rawIfd, *thumbIfd;
+        bool imageLoaded, thumbnailLoaded;
+
         // LoadDNG should set all these
         struct {
             BayerPattern bayerPattern;
@@ -83,7 +89,16 @@ namespace FCam {
          * passed in. */
         DNGFrame(_DNGFrame *f=NULL);
   
+        /** Returns the DNG thumbnail. For a frame returned by
+         * scanDNG, the first call reads the thumbnail from the
+         * file. */
         Image thumbnail();
+
+        /** Reads in the RAW image data of a frame returned by
+         * scanDNG, after which image() is valid. Does nothing if the
+         * data is already loaded. Returns false if the data could
+         * not be read. */
+        bool loadImage();
     };
 
     /** Save a DNG file. The frame must have an image in RAW format.
@@ -94,6 +109,17 @@ namespace FCam {
     /** Load a DNG file. Only DNG files saved by FCam are properly supported.
      */
     DNGFrame loadDNG(const std::string &filename);
+
+    /** Scan a DNG file for its metadata only. All FCam::Frame fields,
+     * the tag map, and the DNG calibration data are read exactly as
+     * in loadDNG, but neither the RAW pixel data nor the thumbnail
+     * are read. The returned frame's image is a Discard image of the
+     * correct size and format; call DNGFrame::loadImage or
+     * DNGFrame::thumbnail to read in the pixel data when it is
+     * actually needed. Use this to index large numbers of DNG files
+     * cheaply.
+     */
+    DNGFrame scanDNG(const std::string &filename);
 }
 
 #endif
@@ -8,6 +8,21 @@
 
 namespace FCam {
 
+    /** The available demosaicking algorithms. */
+    enum DemosaicMethod {
+        /** Gradient directed green interpolation, followed by
+         * interpolation of color differences. Fast enough for
+         * viewfinding, and vectorized on ARM. */
+        FastDemosaic = 0,
+        /** Edge directed green interpolation with a Laplacian
+         * correction from red and blue (Hamilton and Adams), followed
+         * by interpolation of color differences. Sharper, with less
+         * zippering at edges than FastDemosaic. Processes the image
+         * in strips using integer arithmetic throughout. Use it for
+         * final quality output. */
+        HighQualityDemosaic
+    };
+
     /** Demosaic, white balance, and gamma correct a raw frame, and
      * return a slightly smaller RGB24 format image. At least four
      * pixels are lost from each side of the image, more if necessary
@@ -17,10 +32,10 @@ namespace FCam {
      * the frame's shot's custom color matrix if it exists. Otherwise,
      * it uses the frame's platform's \ref Platform::rawToRGBColorMatrix 
      * method to retrieve the correct white-balanced color conversion
-     * matrix. */
+     * matrix. The output size is the same for all methods. */
     Image demosaic(Frame src, float contrast = 50.0f,
                    bool denoise = true, int blackLevel = 25, 
-                   float gamma = 2.2f);
+                   float gamma = 2.2f, DemosaicMethod method = FastDemosaic);
 
 
     /** Create a low-resolution representation of the input image
@@ -0,0 +1,48 @@
+#ifndef FCAM_RESAMPLE_H
+#define FCAM_RESAMPLE_H
+
+/** \file
+ * Resizing images. */
+
+#include "../Image.h"
+
+namespace FCam {
+
+    /** The available resampling filters. */
+    enum ResampleMethod {
+        /** Each output pixel is the average of the input pixels it
+         * covers, weighted by how much of each it covers. The best
+         * choice for downsampling, e.g. for thumbnails and
+         * previews. Equivalent to bilinear when upsampling. */
+        AreaResample = 0,
+        /** Linear interpolation between the two nearest input pixels
+         * in each direction. Cheapest, but aliases when shrinking by
+         * more than a factor of two. */
+        BilinearResample,
+        /** A separable three lobed Lanczos filter, widened when
+         * downsampling to avoid aliasing. Sharpest, at several times
+         * the cost of the others. May ring slightly at hard edges. */
+        LanczosResample
+    };
+
+    /** Resample an image to a new size. Supports RGB24, YUV420p, YV12
+     * and RAW images. Planar YUV images are resampled a plane at a time,
+     * and must have even width and height and no row padding. RAW
+     * images are treated as a 2x2 Bayer mosaic: each of the four
+     * pixels of the pattern is resampled separately, so the output
+     * is a mosaic with the same pattern. Its width and height must
+     * be even. Coefficients are computed in fixed point, and the
+     * vertical pass of 8 bit formats is vectorized with NEON or SSE2
+     * where available. Returns an invalid image on error. */
+    Image resample(Image src, Size size, ResampleMethod method = AreaResample);
+
+    /** Resample an image into an existing image of the same type,
+     * for example a preview buffer or a region of interest of a
+     * larger image. The size of the result is the size of dst. Sub
+     * images may be used for either argument, to resample a crop of
+     * the source or to write into part of the destination. Returns
+     * false on error. */
+    bool resample(Image src, Image dst, ResampleMethod method = AreaResample);
+}
+
+#endif
@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include <FCam/Frame.h>
 #include <FCam/Sensor.h>
 #include <FCam/Shot.h>
@@ -7,6 +9,10 @@
 #include "Debug.h"
 
 namespace FCam {
+
+    static void setBrightness(Shot *s, float desiredBrightness,
+                              float maxGain, int maxExposure, int minExposure);
+
     void autoExpose(Shot *s, const Frame &f,
                     float maxGain,
                     int maxExposure,
@@ -61,13 +67,21 @@ namespace FCam {
 
         float brightness = f.gain() * f.exposure();
         float desiredBrightness = brightness * adjustment;
-        int exposure;
-        float gain;
 
         // Apply the smoothness constraint
         float shotBrightness = s->gain * s->exposure;
         desiredBrightness = shotBrightness * smoothness + desiredBrightness * (1-smoothness);
 
+        setBrightness(s, desiredBrightness, maxGain, maxExposure, minExposure);
+    }
+
+    // Split a brightness (exposure times gain) into an exposure and a
+    // gain for the shot, in the order documented for autoExpose
+    static void setBrightness(Shot *s, float desiredBrightness,
+                              float maxGain, int maxExposure, int minExposure) {
+        int exposure;
+        float gain;
+
         // whats the largest we can raise exposure without negatively
         // impacting frame-rate or introducing handshake. We use 1/30s
         int exposureKnee = 33333;
@@ -98,4 +112,116 @@ namespace FCam {
         s->exposure  = exposure;
         s->gain      = gain;
     }
+
+    // Work out how far the brightness of a frame is from the target
+    // used by autoExpose: 2% of pixels in the top 20 buckets, and
+    // few saturated. Returns true if the histogram shows by how much,
+    // and sets ratio to the target over the current brightness.
+    // Returns false if the frame is too saturated or dark to tell, and
+    // sets ratio to a bounded step in the right direction.
+    static bool meter(const Histogram &hist, float *ratio) {
+        int b = hist.buckets();
+        unsigned total = 0;
+        for (int i = 0; i < b; i++) total += hist(i);
+        if (!total) {
+            *ratio = 1.0f;
+            return false;
+        }
+
+        unsigned saturatedPixels = 0;
+        for (int i = b-5; i < b; i++) saturatedPixels += hist(i);
+        if (saturatedPixels > total/200) {
+            // Halve the brightness, or quarter it if a large part of
+            // the frame is blown out
+            *ratio = saturatedPixels > total/4 ? 0.25f : 0.5f;
+            return false;
+        }
+
+        // Find the level that the brightest 2% of pixels are above,
+        // interpolating within the bucket
+        float targetBrightPixels = total/50.0f;
+        float brightPixels = 0;
+        float level = 0;
+        for (int i = b-1; i >= 0; i--) {
+            float count = hist(i);
+            if (brightPixels + count >= targetBrightPixels) {
+                level = i + 1 - (targetBrightPixels - brightPixels)/count;
+                break;
+            }
+            brightPixels += count;
+        }
+
+        *ratio = (b-10)/(level+1);
+        if (level < 4) {
+            // Too dark for the level to mean much
+            if (*ratio > 4.0f) *ratio = 4.0f;
+            return false;
+        }
+        return true;
+    }
+
+    AutoExposure::AutoExposure(float maxGain_, int maxExposure_, int minExposure_, float smoothness_) :
+        maxGain(maxGain_), maxExposure(maxExposure_), minExposure(minExposure_), 
+        smoothness(smoothness_), pending(0), waited(0), _converged(false) {
+    }
+
+    void AutoExposure::reset() {
+        pending = 0;
+        waited = 0;
+        _converged = false;
+    }
+
+    void AutoExposure::update(Shot *s, const Frame &f) {
+        // Give up waiting for frames taken with the pending
+        // parameters after this many frames, in case the shot was
+        // changed behind our back
+        static const int maxWait = 8;
+
+        if (!s) return;
+        const Histogram &hist = f.histogram();
+        if (!hist.valid() || hist.buckets() < 32) return;
+        if (f.exposure() <= 0 || f.gain() <= 0) return;
+
+        // The brightness this frame was actually taken with, which
+        // may differ from what its shot asked for if the sensor had
+        // not caught up yet
+        float brightness = f.exposure() * f.gain();
+        float requested = f.shot().exposure * f.shot().gain;
+        bool current = (pending == 0 || fabs(requested - pending) <= 0.02f * pending);
+        if (current) {
+            waited = 0;
+        } else {
+            waited++;
+        }
+
+        float ratio;
+        bool measured = meter(hist, &ratio);
+        _converged = measured && fabs(ratio - 1.0f) < 0.05f;
+
+        float desiredBrightness;
+        if (measured) {
+            // An absolute prediction, so frames from before the last
+            // change predict the same thing as frames from after
+            // it. Blend geometrically with what's already in flight
+            // to damp noise.
+            desiredBrightness = brightness * ratio;
+            float shotBrightness = s->exposure * s->gain;
+            if (shotBrightness > 0 && smoothness > 0) {
+                desiredBrightness = powf(shotBrightness, smoothness) * powf(desiredBrightness, 1-smoothness);
+            }
+        } else if (current || waited > maxWait) {
+            // Step, and wait for the result before stepping again
+            desiredBrightness = brightness * ratio;
+        } else {
+            return;
+        }
+
+        setBrightness(s, desiredBrightness, maxGain, maxExposure, minExposure);
+
+        float set = s->exposure * s->gain;
+        if (fabs(set - (pending ? pending : requested)) > 0.02f * set) {
+            pending = set;
+            waited = 0;
+        }
+    }
 }
@@ -8,15 +8,187 @@
 
 namespace FCam {
 
-    AutoFocus::AutoFocus(Lens *l, Rect r) : lens(l), state(IDLE), rect(r) {}
+    // Number of steps across the focus range in the coarse pass
+    static const int coarseSteps = 8;
+    // The fine pass uses this fraction of the coarse step
+    static const int fineDivisions = 4;
+    // A sample this much worse than the best one counts as a fall,
+    // and two falls in a row end a pass
+    static const float fallFraction = 0.1f;
+    static const int maxFalls = 2;
+    // Give up waiting for the lens to report it has arrived after
+    // this many frames, and measure anyway
+    static const int maxWait = 8;
+
+    AutoFocus::AutoFocus(Lens *l, Rect r) : lens(l), state(IDLE), rect(r),
+                                            target(0), step(0), passEnd(0), falls(0), waited(0) {
+        best.position = 0;
+        best.sharpness = 0;
+    }
     
     void AutoFocus::startSweep() {
-      // Left empty intentionally.
+        if (!lens) return;
+        if (state != IDLE && state != FOCUSED) return;
+
+        stats.clear();
+        best.position = lens->farFocus();
+        best.sharpness = 0;
+        step = (lens->nearFocus() - lens->farFocus()) / coarseSteps;
+        passEnd = lens->nearFocus();
+        falls = 0;
+
+        // The first update will send the lens to the far end
+        target = lens->farFocus();
+        waited = -1;
+        state = HOMING;
+    }
+
+    void AutoFocus::moveLens(float position, Shot *s) {
+        target = position;
+        waited = 0;
+        if (s) {
+            s->clearActions(this);
+            Lens::FocusAction a(lens, 0, position);
+            a.owner = this;
+            s->addAction(a);
+        } else {
+            lens->setFocus(position);
+        }
     }
 
+    int AutoFocus::measure(const Frame &f) const {
+        const SharpnessMap &map = f.sharpness();
+
+        // Map the target rectangle from pixels to sharpness map cells
+        int x0 = 0, y0 = 0, x1 = map.width(), y1 = map.height();
+        Size size = f.image().valid() ? f.image().size() : f.shot().image.size();
+        if (rect.width > 0 && rect.height > 0 && size.width > 0 && size.height > 0) {
+            x0 = rect.x * map.width() / size.width;
+            y0 = rect.y * map.height() / size.height;
+            x1 = ((rect.x + rect.width) * map.width() + size.width - 1) / size.width;
+            y1 = ((rect.y + rect.height) * map.height() + size.height - 1) / size.height;
+            if (x0 < 0) x0 = 0;
+            if (y0 < 0) y0 = 0;
+            if (x1 > map.width()) x1 = map.width();
+            if (y1 > map.height()) y1 = map.height();
+        }
+        if (x1 <= x0 || y1 <= y0) return 0;
+
+        // Average rather than sum, so the result fits in an int
+        unsigned long long total = 0;
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                total += map(x, y);
+            }
+        }
+        return (int)(total / ((x1 - x0) * (y1 - y0)));
+    }
+
+    float AutoFocus::peak() const {
+        // Fit a parabola through the best sample and the closest
+        // samples on either side of it
+        const Stats *left = NULL, *right = NULL;
+        for (size_t i = 0; i < stats.size(); i++) {
+            float d = stats[i].position - best.position;
+            if (d < 0 && (!left || d > left->position - best.position)) left = &stats[i];
+            if (d > 0 && (!right || d < right->position - best.position)) right = &stats[i];
+        }
+        if (!left || !right) return best.position;
+
+        float dl = best.position - left->position;
+        float dr = right->position - best.position;
+        float sl = (float)(best.sharpness - left->sharpness) / dl;
+        float sr = (float)(right->sharpness - best.sharpness) / dr;
+        float curvature = (sr - sl) / ((dl + dr) / 2);
+        if (curvature >= 0) return best.position;
+
+        // The slope sl holds halfway between the left sample and the
+        // best one. The vertex is where the slope reaches zero.
+        float offset = -sl / curvature - dl / 2;
+        if (offset < -dl) offset = -dl;
+        if (offset > dr) offset = dr;
+        return best.position + offset;
+    }
     
-    void AutoFocus::update(const Frame &f, FCam::Shot *shots) {
-      // Left empty intentinoally.
+    void AutoFocus::update(const Frame &f, FCam::Shot *shot) {
+        if (state == IDLE || state == FOCUSED) return;
+        if (!lens) return;
+
+        if (waited < 0) {
+            moveLens(target, shot);
+            return;
+        }
+
+        if (!f.sharpness().valid()) return;
+        TagMap::const_iterator initial = f.tags().find("lens.initialFocus");
+        TagMap::const_iterator final = f.tags().find("lens.finalFocus");
+        if (initial == f.tags().end() || final == f.tags().end()) return;
+
+        // Only our last move should be issued
+        if (shot) shot->clearActions(this);
+
+        // Skip frames exposed before the lens got to the target. The
+        // number of these depends on the lens latency and the depth
+        // of the pipeline.
+        float tolerance = fabs(step) / (2 * fineDivisions);
+        if (fabs((float)initial->second - target) > tolerance ||
+            fabs((float)final->second - target) > tolerance) {
+            if (++waited < maxWait) return;
+            dprintf(DBG_MINOR, "AutoFocus: Lens did not report reaching %f, measuring anyway\n", target);
+        }
+        waited = 0;
+
+        if (state == SETTING) {
+            dprintf(DBG_MINOR, "AutoFocus: Focused at %f after %d samples\n", target, (int)stats.size());
+            state = FOCUSED;
+            return;
+        }
+
+        Stats s;
+        s.position = target;
+        s.sharpness = measure(f);
+        stats.push_back(s);
+
+        if (state == HOMING || s.sharpness > best.sharpness) {
+            best = s;
+            falls = 0;
+        } else if (s.sharpness < best.sharpness * (1 - fallFraction)) {
+            falls++;
+        }
+        if (state == HOMING) state = SWEEPING;
+
+        float next = target + step;
+        bool passDone = (falls >= maxFalls || 
+                         (step > 0 ? next > passEnd + tolerance : next < passEnd - tolerance));
+
+        if (!passDone) {
+            moveLens(next, shot);
+            return;
+        }
+
+        if (state == SWEEPING) {
+            // Refine between the best sample and whichever coarse
+            // neighbour was sharper
+            const Stats *below = NULL, *above = NULL;
+            for (size_t i = 0; i < stats.size(); i++) {
+                if (fabs(stats[i].position - (best.position - step)) < tolerance) below = &stats[i];
+                if (fabs(stats[i].position - (best.position + step)) < tolerance) above = &stats[i];
+            }
+            if (below || above) {
+                float coarse = step;
+                if (below && (!above || below->sharpness > above->sharpness)) coarse = -coarse;
+                step = coarse / fineDivisions;
+                passEnd = best.position + coarse - step;
+                falls = 0;
+                state = STEPPING;
+                moveLens(best.position + step, shot);
+                return;
+            }
+        }
+
+        // Done searching. Go to the peak.
+        state = SETTING;
+        moveLens(peak(), shot);
     }
 
 }
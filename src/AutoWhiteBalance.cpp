@@ -1,11 +1,137 @@
 #include "FCam/AutoWhiteBalance.h"
 #include "FCam/Sensor.h"
 #include "FCam/Platform.h"
+#include "FCam/processing/Color.h"
 #include "Debug.h"
 
+#include <math.h>
 
 namespace FCam {
 
+// Find the mean gamma corrected Y, U and V of the parts of the frame
+// that are most likely gray. Uses the per-region sums computed with
+// the histogram if there are any, and the histogram means otherwise.
+static bool grayRegionMean(const Frame &f, float *y, float *u, float *v) {
+    // How far in U and V a region may be from the mean of all
+    // regions and still be considered gray
+    const float grayTolerance = 16.0f;
+
+    std::vector<float> ys, us, vs, weights;
+
+    TagMap::const_iterator tag = f.tags().find("stats.regionYUV");
+    if (tag != f.tags().end() && tag->second.type == TagValue::IntVector) {
+        const std::vector<int> &sums = tag->second;
+        for (size_t i = 0; i + 3 < sums.size(); i += 4) {
+            if (sums[i] <= 0) continue;
+            float n = sums[i];
+            float ry = sums[i+1] / n;
+            // Dark and saturated regions say nothing about the color
+            // of the light
+            if (ry < 16 || ry > 235) continue;
+            ys.push_back(ry);
+            us.push_back(sums[i+2] / n);
+            vs.push_back(sums[i+3] / n);
+            weights.push_back(n);
+        }
+    } else {
+        const Histogram &h = f.histogram();
+        float sums[3] = {0, 0, 0};
+        float n = 0;
+        for (unsigned int i = 0; i < h.buckets(); i++) {
+            // Scale bucket indices back to 8 bit values
+            float value = (i + 0.5f) * 256 / h.buckets();
+            sums[0] += value * h(i, 0);
+            sums[1] += value * h(i, 1);
+            sums[2] += value * h(i, 2);
+            n += h(i, 0);
+        }
+        if (n > 0) {
+            ys.push_back(sums[0] / n);
+            us.push_back(sums[1] / n);
+            vs.push_back(sums[2] / n);
+            weights.push_back(n);
+        }
+    }
+
+    if (ys.empty()) return false;
+
+    // Gray world over all usable regions first, then refine using
+    // only the regions close to that, so that large brightly colored
+    // objects don't pull the estimate towards their own color
+    float mean[3] = {0, 0, 0};
+    for (int pass = 0; pass < 2; pass++) {
+        float acc[3] = {0, 0, 0};
+        float total = 0;
+        for (size_t i = 0; i < ys.size(); i++) {
+            if (pass == 1 && 
+                (fabs(us[i] - mean[1]) > grayTolerance || 
+                 fabs(vs[i] - mean[2]) > grayTolerance)) continue;
+            acc[0] += weights[i] * ys[i];
+            acc[1] += weights[i] * us[i];
+            acc[2] += weights[i] * vs[i];
+            total += weights[i];
+        }
+        if (total == 0) break;
+        for (int c = 0; c < 3; c++) mean[c] = acc[c] / total;
+    }
+
+    *y = mean[0];
+    *u = mean[1];
+    *v = mean[2];
+    return true;
+}
+
+// Convert a gamma corrected full range Y'UV value to CIE 1931 x,y
+// chromaticity, assuming sRGB primaries and a 2.2 gamma.
+static void ypuvToXY(float y, float u, float v, float *x, float *yc) {
+    float rgb[3] = {y + 1.402f * (v - 128),
+                    y - 0.344136f * (u - 128) - 0.714136f * (v - 128),
+                    y + 1.772f * (u - 128)};
+    for (int c = 0; c < 3; c++) {
+        float value = rgb[c] / 255;
+        if (value < 0.001f) value = 0.001f;
+        if (value > 1.0f) value = 1.0f;
+        rgb[c] = powf(value, 2.2f);
+    }
+    float XYZ[3];
+    for (int i = 0; i < 3; i++) {
+        XYZ[i] = RGBtoXYZ[i*3+0]*rgb[0] + RGBtoXYZ[i*3+1]*rgb[1] + RGBtoXYZ[i*3+2]*rgb[2];
+    }
+    float sum = XYZ[0] + XYZ[1] + XYZ[2];
+    *x = XYZ[0] / sum;
+    *yc = XYZ[1] / sum;
+}
+
+// Solve for the correlated color temperature of the scene
+// illumination, given the white balance a frame was taken with and
+// the mean color of its gray regions. Gray comes out as the sRGB
+// white point when the white balance is right; any difference is the
+// difference between the real illuminant and the one the frame was
+// balanced for.
+static int solveWhiteBalance(int current, float y, float u, float v, int minWB, int maxWB) {
+    float grayX, grayY, whiteX, whiteY;
+    ypuvToXY(y, u, v, &grayX, &grayY);
+    ypuvToXY(y, 128, 128, &whiteX, &whiteY);
+
+    float x, yc;
+    kelvinToXY(current, &x, &yc);
+    x += grayX - whiteX;
+    yc += grayY - whiteY;
+
+    // xyToCCT is only accurate over a limited range, so clamp to
+    // the allowed white balances before converting. Chromaticity x
+    // decreases as the temperature goes up.
+    float minX, maxX, unused;
+    kelvinToXY(maxWB, &minX, &unused);
+    kelvinToXY(minWB, &maxX, &unused);
+    if (x >= maxX) return minWB;
+    if (x <= minX) return maxWB;
+
+    int wb = xyToCCT(x, yc);
+    dprintf(DBG_MINOR, "autoWhiteBalance: gray at (%f, %f), %d K -> %d K\n", grayX, grayY, current, wb);
+    return wb;
+}
+
 void autoWhiteBalance(Shot *s, const Frame &f, 
                       int minWB,
                       int maxWB,
@@ -42,8 +168,8 @@ void autoWhiteBalance(Shot *s, const Frame &f,
         float RGB7000[] = {0, 0, 0};
         float d3200[12];
         float d7000[12];
-        f.platform().rawToRGBColorMatrix(3200, d3200);
-        f.platform().rawToRGBColorMatrix(7000, d7000);
+        f.platform().colorMatrix(3200, d3200);
+        f.platform().colorMatrix(7000, d7000);
 
         for (int i = 0; i < 3; i++) {
             for (int j = 0; j < 3; j++) {
@@ -58,44 +184,29 @@ void autoWhiteBalance(Shot *s, const Frame &f,
         // in this formula to make the interpolant equal alpha as desired.
         wb = int(1./(alpha * (1./7000-1./3200) + 1./3200));
     }
-    // Whitebalance using gamma corrected YUV histogram
+    // Whitebalance using gamma corrected YUV statistics
     else if (f.histogram().colorspace() == YpUV) {
-    
-        // Compute average gamma corrected u,v
-        int u = 0;              // accumulated values
-        int v = 0;
-        int samplesu = 0;       // number of samples
-        int samplesv = 0;
-
-        for (unsigned int i = 0; i < f.histogram().buckets(); i++) 
-        {
-            u += i*f.histogram()(i,1);
-            v +=i*f.histogram()(i,2);
-
-            samplesu += f.histogram()(i,1);
-            samplesv += f.histogram()(i,2);
-        }
-
-        float avgU = (float) u / (float) samplesu;
-        float avgV = (float) v / (float) samplesv;
-
-        wb = f.whiteBalance();
-
-        // The tolerance and step parameters are 
-        // heuristically determined. TODO: calibration.
-        float fTolerance = 5.0f;
-        int step = 500;
-
-        // In this color space gray is 128,128. 
-        // Shift to the blues or the reds to try
-        // to achieve a better wb
-        if (avgU - avgV < -fTolerance) {
-            wb -= step;
-        } else if (avgU - avgV > fTolerance) {
-            wb += step;
+        float y, u, v;
+        if (f.whiteBalance() <= 0) return;
+        if (!grayRegionMean(f, &y, &u, &v)) return;
+
+        wb = solveWhiteBalance(f.whiteBalance(), y, u, v, minWB, maxWB);
+        // Only x is clamped in the solve, and an off-locus y can still
+        // take the temperature out of range
+        if (wb < minWB) wb = minWB;
+        if (wb > maxWB) wb = maxWB;
+        if (wb == f.whiteBalance()) return;
+
+        // The estimate is absolute, so frames still in flight agree
+        // with later ones and big changes can be made at once. Only
+        // small changes are smoothed, to keep noise from making the
+        // white balance wander.
+        if (s->whiteBalance > 0 && fabs(1e6f/wb - 1e6f/s->whiteBalance) < 10) {
+            s->whiteBalance = smoothness * s->whiteBalance + (1-smoothness) * wb;
         } else {
-            return;
+            s->whiteBalance = wb;
         }
+        return;
     }
 
     if (wb < minWB) wb = minWB;
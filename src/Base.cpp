@@ -11,7 +11,7 @@ namespace FCam {
         case RGB16: case UYVY: case RAW: 
             return 2;
         // For planar formats, return 1 byte per pixel
-        case YUV420p:   
+        case YUV420p: case YV12:
             return 1;   
         default:
             return 0;
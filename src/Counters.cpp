@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "FCam/Counters.h"
+#include "FCam/Event.h"
+#include "Debug.h"
+
+namespace FCam {
+
+    // The registry. Counters are usually static objects, constructed
+    // before main in no particular order, so the lists are made on
+    // first use and guarded by a statically initialized mutex.
+    static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::vector<Counter *> *counterList = NULL;
+    static std::vector<Distribution *> *distributionList = NULL;
+
+    template<typename T>
+    static void registerItem(std::vector<T *> *&list, T *item) {
+        pthread_mutex_lock(&registryMutex);
+        if (!list) list = new std::vector<T *>;
+        list->push_back(item);
+        pthread_mutex_unlock(&registryMutex);
+    }
+
+    template<typename T>
+    static void unregisterItem(std::vector<T *> *list, T *item) {
+        pthread_mutex_lock(&registryMutex);
+        if (list) list->erase(std::remove(list->begin(), list->end(), item), list->end());
+        pthread_mutex_unlock(&registryMutex);
+    }
+
+    Counter::Counter(const char *name) : folded(0), _name(name) {
+        for (int i = 0; i < Shards; i++) shards[i].value = 0;
+        pthread_mutex_init(&mutex, NULL);
+        registerItem(counterList, this);
+    }
+
+    Counter::~Counter() {
+        unregisterItem(counterList, this);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void Counter::fold(Shard &s) {
+        pthread_mutex_lock(&mutex);
+        unsigned long v = s.value;
+        if (v >= FoldAt) {
+            folded += v;
+            __sync_fetch_and_sub(&s.value, v);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    unsigned long long Counter::value() const {
+        pthread_mutex_lock(&mutex);
+        unsigned long long total = folded;
+        for (int i = 0; i < Shards; i++) total += shards[i].value;
+        pthread_mutex_unlock(&mutex);
+        return total;
+    }
+
+    void Counter::reset() {
+        pthread_mutex_lock(&mutex);
+        folded = 0;
+        for (int i = 0; i < Shards; i++) __sync_fetch_and_and(&shards[i].value, 0);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    Distribution::Distribution(const char *name) : _name(name) {
+        pthread_mutex_init(&mutex, NULL);
+        reset();
+        registerItem(distributionList, this);
+    }
+
+    Distribution::~Distribution() {
+        unregisterItem(distributionList, this);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void Distribution::record(unsigned long v) {
+        int b = 0;
+        for (unsigned long x = v; x && b < Buckets - 1; x >>= 1) b++;
+
+        pthread_mutex_lock(&mutex);
+        _count++;
+        _sum += v;
+        if (v > _max) _max = v;
+        buckets[b]++;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    unsigned long long Distribution::count() const {
+        pthread_mutex_lock(&mutex);
+        unsigned long long c = _count;
+        pthread_mutex_unlock(&mutex);
+        return c;
+    }
+
+    unsigned long long Distribution::sum() const {
+        pthread_mutex_lock(&mutex);
+        unsigned long long s = _sum;
+        pthread_mutex_unlock(&mutex);
+        return s;
+    }
+
+    unsigned long Distribution::max() const {
+        pthread_mutex_lock(&mutex);
+        unsigned long m = _max;
+        pthread_mutex_unlock(&mutex);
+        return m;
+    }
+
+    unsigned long Distribution::bucket(int i) const {
+        if (i < 0 || i >= Buckets) return 0;
+        pthread_mutex_lock(&mutex);
+        unsigned long b = buckets[i];
+        pthread_mutex_unlock(&mutex);
+        return b;
+    }
+
+    void Distribution::reset() {
+        pthread_mutex_lock(&mutex);
+        _count = _sum = 0;
+        _max = 0;
+        for (int i = 0; i < Buckets; i++) buckets[i] = 0;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    namespace Counters {
+
+        unsigned long long value(const std::string &name) {
+            unsigned long long v = 0;
+            pthread_mutex_lock(&registryMutex);
+            // Several counters may share a name (one per translation
+            // unit counting the same thing), so add them all up
+            for (size_t i = 0; counterList && i < counterList->size(); i++) {
+                if (name == (*counterList)[i]->name()) v += (*counterList)[i]->value();
+            }
+            for (size_t i = 0; distributionList && i < distributionList->size(); i++) {
+                if (name == (*distributionList)[i]->name()) v += (*distributionList)[i]->count();
+            }
+            pthread_mutex_unlock(&registryMutex);
+            return v;
+        }
+
+        struct NameLess {
+            template<typename T>
+            bool operator()(const T *a, const T *b) const {return strcmp(a->name(), b->name()) < 0;}
+        };
+
+        std::string json() {
+            pthread_mutex_lock(&registryMutex);
+            std::vector<Counter *> counters;
+            std::vector<Distribution *> distributions;
+            if (counterList) counters = *counterList;
+            if (distributionList) distributions = *distributionList;
+            std::sort(counters.begin(), counters.end(), NameLess());
+            std::sort(distributions.begin(), distributions.end(), NameLess());
+
+            std::string out = "{\"counters\": {";
+            char buf[64];
+            for (size_t i = 0; i < counters.size(); ) {
+                // Merge counters that share a name
+                unsigned long long total = 0;
+                size_t j = i;
+                for (; j < counters.size() && !strcmp(counters[j]->name(), counters[i]->name()); j++) {
+                    total += counters[j]->value();
+                }
+                if (i) out += ", ";
+                snprintf(buf, sizeof(buf), "%llu", total);
+                out += std::string("\"") + counters[i]->name() + "\": " + buf;
+                i = j;
+            }
+
+            out += "}, \"distributions\": {";
+            for (size_t i = 0; i < distributions.size(); i++) {
+                const Distribution *d = distributions[i];
+                unsigned long long count = d->count(), sum = d->sum();
+                if (i) out += ", ";
+                out += std::string("\"") + d->name() + "\": {";
+                snprintf(buf, sizeof(buf), "\"count\": %llu, ", count);
+                out += buf;
+                snprintf(buf, sizeof(buf), "\"sum\": %llu, ", sum);
+                out += buf;
+                snprintf(buf, sizeof(buf), "\"max\": %lu, ", d->max());
+                out += buf;
+                snprintf(buf, sizeof(buf), "\"mean\": %.1f, ", count ? (double)sum / count : 0.0);
+                out += buf;
+                out += "\"buckets\": [";
+                int last = Distribution::Buckets - 1;
+                while (last >= 0 && !d->bucket(last)) last--;
+                for (int b = 0; b <= last; b++) {
+                    snprintf(buf, sizeof(buf), b ? ", %lu" : "%lu", d->bucket(b));
+                    out += buf;
+                }
+                out += "]}";
+            }
+            out += "}}";
+            pthread_mutex_unlock(&registryMutex);
+            return out;
+        }
+
+        bool saveJSON(const std::string &filename) {
+            FILE *f = fopen(filename.c_str(), "w");
+            if (!f) {
+                error(Event::FileSaveError, "Counters::saveJSON: %s: Cannot open file for writing", filename.c_str());
+                return false;
+            }
+            std::string s = json();
+            bool ok = fwrite(s.data(), 1, s.size(), f) == s.size();
+            ok = (fputc('\n', f) != EOF) && ok;
+            if (fclose(f) != 0) ok = false;
+            if (!ok) {
+                error(Event::FileSaveError, "Counters::saveJSON: %s: Error writing file (out of space?)", filename.c_str());
+            }
+            return ok;
+        }
+
+        void reset() {
+            pthread_mutex_lock(&registryMutex);
+            for (size_t i = 0; counterList && i < counterList->size(); i++) (*counterList)[i]->reset();
+            for (size_t i = 0; distributionList && i < distributionList->size(); i++) (*distributionList)[i]->reset();
+            pthread_mutex_unlock(&registryMutex);
+        }
+    }
+
+}
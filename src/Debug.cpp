@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "FCam/Counters.h"
+#include "Debug.h"
+
+// The asynchronous sink behind dprintf. A message is formatted by the
+// thread logging it straight into a slot of a bounded ring, and
+// written out by a background thread, so logging costs the caller a
+// vsnprintf and a few atomic operations rather than a write to the
+// console or the log device, and never waits for a lock held by
+// another thread.
+//
+// Each slot carries a sequence number saying whose turn it is. A slot
+// at position p in the stream of messages is free for a producer when
+// its sequence is p, holds a message for the writer when it is p + 1,
+// and is handed on to position p + DebugSlots once written. Producers
+// claim positions with a compare and swap on enqueuePos; there is only
+// one writer, so it simply takes the positions in order.
+
+enum {DebugSlots = 256, DebugMessageSize = 512};
+
+struct DebugSlot {
+    volatile unsigned sequence;
+    int level;
+    const char *src;
+    char message[DebugMessageSize];
+};
+
+static DebugSlot debugRing[DebugSlots];
+static volatile unsigned enqueuePos = 0;
+static volatile unsigned dequeuePos = 0;
+static sem_t debugPending;
+static pthread_once_t debugOnce = PTHREAD_ONCE_INIT;
+static FCam::Counter messagesDropped("debug.messages_dropped");
+
+static unsigned load(volatile unsigned *p) {
+    return __sync_fetch_and_add(p, 0);
+}
+
+static void *debugWriter(void *) {
+    for (;;) {
+        sem_wait(&debugPending);
+        for (;;) {
+            unsigned pos = load(&dequeuePos);
+            DebugSlot &slot = debugRing[pos % DebugSlots];
+            if (load(&slot.sequence) != pos + 1) break;
+            _dprintfWrite(slot.level, slot.src, slot.message);
+            __sync_val_compare_and_swap(&slot.sequence, pos + 1, pos + DebugSlots);
+            __sync_fetch_and_add(&dequeuePos, 1);
+        }
+    }
+    return NULL;
+}
+
+static void debugStart() {
+    for (unsigned i = 0; i < DebugSlots; i++) debugRing[i].sequence = i;
+    sem_init(&debugPending, 0, 0);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    pthread_create(&thread, &attr, debugWriter, NULL);
+    pthread_attr_destroy(&attr);
+
+    atexit(_dprintfFlush);
+}
+
+void _dprintfWrite(int level, const char *src, const char *msg) {
+/** On Android platforms, send debug msg to console and log */
+#if defined(FCAM_PLATFORM_ANDROID)
+    LOGD("%*c(%d) %s: %s",level*2+2,' ',level,src, msg);
+#endif
+    fprintf(stderr, "%*c(%d) %s: %s",level*2+2,' ',level,src, msg);
+}
+
+void _dprintfQueue(int level, const char *src, const char *fmt, va_list arglist) {
+    pthread_once(&debugOnce, debugStart);
+
+    unsigned pos = load(&enqueuePos);
+    DebugSlot *slot;
+    for (;;) {
+        slot = &debugRing[pos % DebugSlots];
+        int diff = (int)(load(&slot->sequence) - pos);
+        if (diff == 0) {
+            unsigned seen = __sync_val_compare_and_swap(&enqueuePos, pos, pos + 1);
+            if (seen == pos) break;
+            pos = seen;
+        } else if (diff < 0) {
+            // The writer is a whole ring behind
+            messagesDropped.add();
+            return;
+        } else {
+            pos = load(&enqueuePos);
+        }
+    }
+
+    slot->level = level;
+    slot->src = src;
+    vsnprintf(slot->message, DebugMessageSize, fmt, arglist);
+    __sync_val_compare_and_swap(&slot->sequence, pos, pos + 1);
+    sem_post(&debugPending);
+}
+
+void _dprintfFlush() {
+    // Give the writer up to a tenth of a second to catch up
+    for (int i = 0; i < 100 && load(&dequeuePos) != load(&enqueuePos); i++) {
+        usleep(1000);
+    }
+}
@@ -5,7 +5,8 @@
  * the FCam namespace, being macros, so this header is not included by
  * default by any part of the FCam public interface. Feel free to
  * include it if you wish to use it, but be aware of the possibility
- * of namespace pollution. To enable debugging, define DEBUG before including this header.
+ * of namespace pollution. To enable debugging, define DEBUG (or
+ * FCAM_DEBUG_LEVEL) before including this header.
  */
 
 #include <stdio.h>
@@ -37,7 +38,7 @@
 
 /** Encoding of the error levels described above. Use these for the
  * dprintf level argument, and then set FCAM_DEBUG_LEVEL to the
- * desired runtime verbosity. */
+ * desired verbosity. */
 enum debugLevel { DBG_ERROR=0,
                   DBG_WARN=1,
                   DBG_MAJOR=2,
@@ -47,38 +48,67 @@ enum debugLevel { DBG_ERROR=0,
 #define STRX(x) #x
 #define STR(x) STRX(x)
 
-#if defined(DEBUG)
+/** Whether dprintf calls at the given level are compiled in. This is
+ * decided at compile time, so calls above FCAM_DEBUG_LEVEL, and all of
+ * them if it is not defined, cost nothing at all: their arguments are
+ * never evaluated. Defining FCAM_DEBUG_LEVEL without DEBUG leaves
+ * tracing on in an otherwise optimized build. */
+#if defined(FCAM_DEBUG_LEVEL)
+#define FCAM_DEBUG_ENABLED(level) ((level) <= FCAM_DEBUG_LEVEL)
+#else
+#define FCAM_DEBUG_ENABLED(level) 0
+#endif
+
+/** Write a formatted debug message to the console (and the log on
+ * Android). Implemented in Debug.cpp. */
+void _dprintfWrite(int level, const char *src, const char *msg);
+
+/** Format a debug message and queue it for a background thread to
+ * write, without blocking. Messages are dropped, and counted in the
+ * debug.messages_dropped counter, if the queue is full. Implemented
+ * in Debug.cpp. */
+void _dprintfQueue(int level, const char *src, const char *fmt, va_list arglist);
+
+/** Wait briefly for the queued debug messages to be written. Called
+ * at exit. */
+void _dprintfFlush();
+
+#if defined(FCAM_DEBUG_LEVEL)
 /** Raw printf-like debugging fuction. It has a verbosity
  * level(lower=more verbose), controlled by FCAM_DEBUG_LEVEL, and a
- * source string as arguments, beyond the usual printf-style
- * fields. */
+ * source string as arguments, beyond the usual printf-style fields. The message is formatted by the
+ * caller and written asynchronously, so that tracing does not hold up
+ * time-critical threads; define FCAM_DEBUG_SYNC to write it
+ * immediately instead, e.g. when chasing a crash. */
 inline void _dprintf(int level, const char *src, const char *fmt, ...) {
-    if (level <= FCAM_DEBUG_LEVEL) {
+    // dprintf checks the level before evaluating its arguments, but
+    // some callers use _dprintf directly
+    if (!FCAM_DEBUG_ENABLED(level)) return;
 
-        char buf[512];
-
-        va_list arglist;
-        va_start(arglist, fmt);
-        vsnprintf(buf, 512, fmt, arglist);
-        va_end(arglist);
-
-/** On Android platforms, send debug msg to console and log */
-#if defined(FCAM_PLATFORM_ANDROID)
-        LOGD("%*c(%d) %s: %s",level*2+2,' ',level,src, buf);
+    va_list arglist;
+    va_start(arglist, fmt);
+#if defined(FCAM_DEBUG_SYNC)
+    char buf[512];
+    vsnprintf(buf, 512, fmt, arglist);
+    _dprintfWrite(level, src, buf);
+#else
+    _dprintfQueue(level, src, fmt, arglist);
 #endif
-        fprintf(stderr, "%*c(%d) %s: %s",level*2+2,' ',level,src, buf);
-    }
+    va_end(arglist);
 }
 
 #else
-/** Raw printf-like debugging fuction. It has a verbosity
- * level(lower=more verbose), controlled by FCAM_DEBUG_LEVEL, and a
- * source string as arguments, beyond the usual printf-style
- * fields. An empty function if DEBUG is not defined. */
+/** Raw printf-like debugging fuction. An empty function if
+ * FCAM_DEBUG_LEVEL is not defined. */
 inline void _dprintf(int, const char *, const char *, ...) {}
 #endif
 
-/** Printf-like debugging macro, which fills the source argument of _dprintf using the file name and line number. */
-#define dprintf(level, ...) _dprintf(level, __FILE__ ":" STR(__LINE__), __VA_ARGS__) 
+/** Printf-like debugging macro, which fills the source argument of
+ * _dprintf using the file name and line number. Compiles to nothing,
+ * arguments included, if the level is above FCAM_DEBUG_LEVEL. */
+#define dprintf(level, ...) do {                                        \
+        if (FCAM_DEBUG_ENABLED(level))                                  \
+            _dprintf(level, __FILE__ ":" STR(__LINE__), __VA_ARGS__);   \
+    } while (0)
 
 #endif
@@ -1,5 +1,12 @@
 #include "FCam/Device.h"
+#include "FCam/Frame.h"
 
 namespace FCam {
 
+    void Device::tagFrames(const std::vector<Frame> &frames) {
+        for (size_t i = 0; i < frames.size(); i++) {
+            tagFrame(frames[i]);
+        }
+    }
+
 }
@@ -1,103 +1,592 @@
 #include <sstream>
+#include <list>
+#include <map>
+#include <vector>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "FCam/Event.h"
 #include "Debug.h"
 
 namespace FCam {
 
-    // Gets the next pending event. Returns false if there are no
-    // outstanding events. 
-    bool getNextEvent(Event *e) {        
-        return _eventQueue.tryPull(e);
-    }
+    // The pending events, in the order they were posted. Each event
+    // is also indexed by its type and by its creator, so that the
+    // filtered variants of getNextEvent only look at events that
+    // could possibly match.
+    class EventStore {
+    public:
+        // What an event must match to be returned by pull
+        struct Filter {
+            Filter(): byType(false), byData(false), byCreator(false),
+                      type(0), data(0), creator(NULL) {}
+            bool byType, byData, byCreator;
+            int type, data;
+            EventGenerator *creator;
 
-    // Filter the event queue for specific types of events, several variants
-    bool getNextEvent(Event *e, int type) {
-        TSQueue<Event>::locking_iterator i = _eventQueue.begin();
-        for (; i != _eventQueue.end(); i++) {
-            if (i->type == type) {
-                Event eTemp = *i;
-                if (!_eventQueue.erase(i)) {
-                    dprintf(4, "getNextEvent: Skipping 'reserved' event.\n");
-                    return false;
+            bool matches(const Event &e) const {
+                return ((!byType || e.type == type) &&
+                        (!byData || e.data == data) &&
+                        (!byCreator || e.creator == creator));
+            }
+        };
+
+        EventStore(): count(0), limit(1024), dropped(0) {
+            pthread_mutex_init(&mutex, NULL);
+        }
+
+        ~EventStore() {
+            pthread_mutex_destroy(&mutex);
+        }
+
+        void push(const Event &e) {
+            pthread_mutex_lock(&mutex);
+            while (limit && count >= limit) {
+                erase(events.begin());
+                dropped++;
+            }
+            count++;
+            EntryList::iterator i = events.insert(events.end(), Entry());
+            i->event = e;
+            IndexList &types = typeIndex[e.type];
+            i->typePos = types.insert(types.end(), i);
+            IndexList &creators = creatorIndex[e.creator];
+            i->creatorPos = creators.insert(creators.end(), i);
+            pthread_mutex_unlock(&mutex);
+        }
+
+        // Remove the earliest event matching the filter
+        bool pull(Event *e, const Filter &f) {
+            bool found = false;
+            pthread_mutex_lock(&mutex);
+            if (!f.byType && !f.byCreator) {
+                // Any event will do unless we're matching by data
+                for (EntryList::iterator i = events.begin(); i != events.end(); i++) {
+                    if (f.matches(i->event)) {
+                        *e = i->event;
+                        erase(i);
+                        found = true;
+                        break;
+                    }
+                }
+            } else {
+                // Scan the shorter of the relevant indexes
+                IndexList *candidates = NULL;
+                if (f.byType) candidates = find(typeIndex, f.type);
+                if (f.byCreator) {
+                    IndexList *c = find(creatorIndex, f.creator);
+                    if (!f.byType || !c || (candidates && c->size() < candidates->size())) {
+                        candidates = c;
+                    }
+                }
+                if (candidates) {
+                    for (IndexList::iterator i = candidates->begin(); i != candidates->end(); i++) {
+                        if (f.matches((*i)->event)) {
+                            *e = (*i)->event;
+                            erase(*i);
+                            found = true;
+                            break;
+                        }
+                    }
                 }
-                *e = eTemp;
-                return true;
             }
+            pthread_mutex_unlock(&mutex);
+            return found;
         }
-        return false;
-    }
 
-    bool getNextEvent(Event *e, int type, int data) {
-        TSQueue<Event>::locking_iterator i = _eventQueue.begin();
-        for (; i != _eventQueue.end(); i++) {
-            if (i->type == type && i->data == data) {
-                Event eTemp = *i;
-                if (!_eventQueue.erase(i)) {
-                    dprintf(4, "getNextEvent: Skipping 'reserved' event.\n");
-                    return false; // Can't erase == 'doesn't actually exist'
+        void setLimit(size_t l) {
+            pthread_mutex_lock(&mutex);
+            limit = l;
+            pthread_mutex_unlock(&mutex);
+        }
+
+        unsigned droppedEvents(bool reset) {
+            pthread_mutex_lock(&mutex);
+            unsigned d = dropped;
+            if (reset) dropped = 0;
+            pthread_mutex_unlock(&mutex);
+            return d;
+        }
+
+    private:
+        struct Entry;
+        typedef std::list<Entry> EntryList;
+        typedef std::list<EntryList::iterator> IndexList;
+        struct Entry {
+            Event event;
+            IndexList::iterator typePos, creatorPos;
+        };
+
+        template<typename K>
+        static IndexList *find(std::map<K, IndexList> &index, K key) {
+            typename std::map<K, IndexList>::iterator i = index.find(key);
+            return i == index.end() ? NULL : &i->second;
+        }
+
+        template<typename K>
+        static void unindex(std::map<K, IndexList> &index, K key, IndexList::iterator pos) {
+            typename std::map<K, IndexList>::iterator i = index.find(key);
+            i->second.erase(pos);
+            if (i->second.empty()) index.erase(i);
+        }
+
+        void erase(EntryList::iterator i) {
+            unindex(typeIndex, i->event.type, i->typePos);
+            unindex(creatorIndex, i->event.creator, i->creatorPos);
+            events.erase(i);
+            count--;
+        }
+
+        EntryList events;
+        // std::list::size() is linear, so keep count ourselves
+        size_t count, limit;
+        unsigned dropped;
+        std::map<int, IndexList> typeIndex;
+        std::map<EventGenerator *, IndexList> creatorIndex;
+        pthread_mutex_t mutex;
+    };
+
+    static EventStore eventStore;
+
+    // Deliver summaries of any runs of merged events that are over.
+    // Returns how long in microseconds until the next open run is
+    // over, or 0 if none are open.
+    static int flushCoalescedEvents();
+
+    // Delivers events to subscribed listeners on a thread of its
+    // own. Never destroyed, as the thread runs until exit.
+    class EventDispatcher {
+    public:
+        EventDispatcher(): running(false) {
+            pthread_mutex_init(&subscriptionMutex, NULL);
+            pthread_mutex_init(&deliveryMutex, NULL);
+        }
+
+        static EventDispatcher &instance() {
+            static EventDispatcher *d = new EventDispatcher;
+            return *d;
+        }
+
+        void subscribe(EventListener *l, bool anyType, int type, EventGenerator *creator) {
+            Subscription s;
+            s.listener = l;
+            s.anyType = anyType;
+            s.type = type;
+            s.creator = creator;
+            pthread_mutex_lock(&subscriptionMutex);
+            subscriptions.push_back(s);
+            if (!running) {
+                running = (pthread_create(&thread, NULL, event_dispatch_thread_, this) == 0);
+                if (running) {
+                    pthread_detach(thread);
+                } else {
+                    _dprintf(DBG_ERROR, "Event", "Unable to start event dispatcher thread\n");
                 }
-                *e = eTemp;
-                return true;
             }
+            pthread_mutex_unlock(&subscriptionMutex);
         }
-        return false;
-    }
 
-    bool getNextEvent(Event *e, int type, EventGenerator *creator) {
-        TSQueue<Event>::locking_iterator i = _eventQueue.begin();
-        for (; i != _eventQueue.end(); i++) {
-            if (i->type == type && i->creator == creator) {
-                Event eTemp = *i;
-                if (!_eventQueue.erase(i)) {
-                    dprintf(4, "getNextEvent: Skipping 'reserved' event.\n");
-                    return false;
+        void unsubscribe(EventListener *l) {
+            pthread_mutex_lock(&subscriptionMutex);
+            bool onDispatcher = running && pthread_equal(pthread_self(), thread);
+            pthread_mutex_unlock(&subscriptionMutex);
+
+            // Wait for any delivery in progress to finish, unless
+            // we're being called from within one
+            if (!onDispatcher) pthread_mutex_lock(&deliveryMutex);
+            pthread_mutex_lock(&subscriptionMutex);
+            for (size_t i = 0; i < subscriptions.size();) {
+                if (subscriptions[i].listener == l) {
+                    subscriptions.erase(subscriptions.begin() + i);
+                } else {
+                    i++;
                 }
-                *e = eTemp;
-                return true;
             }
+            pthread_mutex_unlock(&subscriptionMutex);
+            if (!onDispatcher) pthread_mutex_unlock(&deliveryMutex);
         }
-        return false;
-    }
 
-    bool getNextEvent(Event *e, int type, int data, EventGenerator *creator) {
-        TSQueue<Event>::locking_iterator i = _eventQueue.begin();
-        for (; i != _eventQueue.end(); i++) {
-            if (i->type == type && i->data == data && i->creator == creator) {
-                Event eTemp = *i;
-                if (!_eventQueue.erase(i)) {
-                    dprintf(4, "getNextEvent: Skipping 'reserved' event.\n");
-                    return false; // Can't erase == 'doesn't actually exist'
+        // Queue an event for delivery if anyone is listening for it
+        bool post(const Event &e) {
+            bool wanted = false;
+            pthread_mutex_lock(&subscriptionMutex);
+            for (size_t i = 0; i < subscriptions.size(); i++) {
+                if (subscriptions[i].matches(e)) {
+                    wanted = running;
+                    break;
                 }
-                *e = eTemp;
-                return true;
             }
+            pthread_mutex_unlock(&subscriptionMutex);
+            if (wanted) queue.push(e);
+            return wanted;
         }
-        return false;
-    }
 
-    bool getNextEvent(Event *e, EventGenerator *creator) {
-        TSQueue<Event>::locking_iterator i = _eventQueue.begin();
-        for (; i != _eventQueue.end(); i++) {
-            if (i->creator == creator) {
-                Event eTemp = *i;
-                if (!_eventQueue.erase(i)) {
-                    dprintf(4, "getNextEvent: Skipping 'reserved' event.\n");
-                    return false; // Can't erase == 'doesn't actually exist'
+    private:
+        struct Subscription {
+            EventListener *listener;
+            bool anyType;
+            int type;
+            EventGenerator *creator;
+
+            bool matches(const Event &e) const {
+                return ((anyType || e.type == type) &&
+                        (!creator || e.creator == creator));
+            }
+        };
+
+        void run() {
+            std::vector<EventListener *> targets;
+            // While a run of merged events is open, wake up in time to
+            // deliver its summary even if nothing else is posted
+            int timeout = 0;
+            while (1) {
+                Event e;
+                if (!timeout) {
+                    e = queue.pull();
+                } else if (!queue.timedPull(&e, timeout)) {
+                    timeout = flushCoalescedEvents();
+                    continue;
                 }
-                *e = eTemp;
+                pthread_mutex_lock(&deliveryMutex);
+                targets.clear();
+                pthread_mutex_lock(&subscriptionMutex);
+                for (size_t i = 0; i < subscriptions.size(); i++) {
+                    if (subscriptions[i].matches(e)) targets.push_back(subscriptions[i].listener);
+                }
+                pthread_mutex_unlock(&subscriptionMutex);
+
+                for (size_t i = 0; i < targets.size(); i++) {
+                    targets[i]->handleEvent(e);
+                }
+                pthread_mutex_unlock(&deliveryMutex);
+
+                // If everyone unsubscribed in the meantime, leave the
+                // event for getNextEvent instead
+                if (targets.empty()) eventStore.push(e);
+
+                timeout = flushCoalescedEvents();
+            }
+        }
+
+        static void *event_dispatch_thread_(void *arg) {
+            ((EventDispatcher *)arg)->run();
+            return NULL;
+        }
+
+        std::vector<Subscription> subscriptions;
+        pthread_mutex_t subscriptionMutex;
+        // Held while listeners are being called
+        pthread_mutex_t deliveryMutex;
+        TSQueue<Event> queue;
+        pthread_t thread;
+        bool running;
+    };
+
+    // Merges repeated events posted within a short interval of each
+    // other. See setEventCoalescing.
+    class EventCoalescer {
+    public:
+        EventCoalescer(): interval(0), posted(0), coalesced(0) {
+            pthread_mutex_init(&mutex, NULL);
+        }
+
+        ~EventCoalescer() {
+            pthread_mutex_destroy(&mutex);
+        }
+
+        // Decide whether an event should be posted, or merged into
+        // the last one like it. Summaries of any earlier runs of
+        // merged events that are now over are added to summaries.
+        bool admit(int type, int data, EventGenerator *creator, Time now,
+                   std::vector<Event> *summaries) {
+            pthread_mutex_lock(&mutex);
+            if (interval <= 0) {
+                posted++;
+                pthread_mutex_unlock(&mutex);
                 return true;
             }
+
+            // Runs of other kinds of event may have ended without
+            // anyone calling getNextEvent. Look for them at most once
+            // an interval, so windows doesn't grow without bound.
+            if (now >= lastSweep + interval) {
+                expire(now, false, summaries);
+                lastSweep = now;
+            }
+
+            Window &w = windows[Key(type, data, creator)];
+            if (w.open && now < w.start + interval) {
+                w.merged++;
+                w.last = now;
+                coalesced++;
+                pthread_mutex_unlock(&mutex);
+                return false;
+            }
+            if (w.open && w.merged) {
+                summaries->push_back(Event());
+                summarize(w, &summaries->back());
+                posted++;
+            }
+            w.open = true;
+            w.start = now;
+            w.merged = 0;
+            w.event.type = type;
+            w.event.data = data;
+            w.event.creator = creator;
+            w.event.description.clear();
+            posted++;
+            pthread_mutex_unlock(&mutex);
+            return true;
         }
-        return false;
-    }
 
-    void postEvent(Event e) {        
+        // Remember the description of an event let through by admit,
+        // for use in the summary of any events merged into it
+        void opened(const Event &e) {
+            pthread_mutex_lock(&mutex);
+            if (interval > 0) {
+                std::map<Key, Window>::iterator i = windows.find(Key(e.type, e.data, e.creator));
+                if (i != windows.end()) i->second.event.description = e.description;
+            }
+            pthread_mutex_unlock(&mutex);
+        }
+
+        // Summarize and forget all runs of events that are over, or
+        // all of them if everything is true. Returns how long in
+        // microseconds until the next of the remaining runs is over,
+        // or 0 if none are open.
+        int flush(Time now, bool everything, std::vector<Event> *summaries) {
+            pthread_mutex_lock(&mutex);
+            int next = expire(now, everything, summaries);
+            pthread_mutex_unlock(&mutex);
+            return next;
+        }
+
+        void setInterval(int i, std::vector<Event> *summaries) {
+            flush(Time::now(), true, summaries);
+            pthread_mutex_lock(&mutex);
+            interval = i;
+            pthread_mutex_unlock(&mutex);
+        }
+
+        void stats(EventStats *st, bool reset) {
+            pthread_mutex_lock(&mutex);
+            st->posted = posted;
+            st->coalesced = coalesced;
+            if (reset) posted = coalesced = 0;
+            pthread_mutex_unlock(&mutex);
+        }
+
+    private:
+        struct Key {
+            Key(int t, int d, EventGenerator *c): type(t), data(d), creator(c) {}
+            int type, data;
+            EventGenerator *creator;
+            bool operator<(const Key &other) const {
+                if (type != other.type) return type < other.type;
+                if (data != other.data) return data < other.data;
+                return creator < other.creator;
+            }
+        };
+
+        struct Window {
+            Window(): open(false), merged(0) {}
+            bool open;
+            Time start, last;
+            int merged;
+            // The event that opened this window
+            Event event;
+        };
+
+        // flush, with the mutex held
+        int expire(Time now, bool everything, std::vector<Event> *summaries) {
+            int next = 0;
+            std::map<Key, Window>::iterator i = windows.begin();
+            while (i != windows.end()) {
+                Window &w = i->second;
+                Time end = w.start + interval;
+                if (everything || end <= now) {
+                    if (w.merged) {
+                        summaries->push_back(Event());
+                        summarize(w, &summaries->back());
+                        posted++;
+                    }
+                    windows.erase(i++);
+                } else {
+                    int left = end - now;
+                    if (!next || left < next) next = left;
+                    i++;
+                }
+            }
+            return next;
+        }
+
+        static void summarize(const Window &w, Event *summary) {
+            *summary = w.event;
+            summary->time = w.last;
+            summary->count = w.merged;
+            std::ostringstream desc;
+            desc << "(" << w.merged << " similar events merged) " << w.event.description;
+            summary->description = desc.str();
+        }
+
+        std::map<Key, Window> windows;
+        int interval;
+        Time lastSweep;
+        unsigned posted, coalesced;
+        pthread_mutex_t mutex;
+    };
+
+    static EventCoalescer eventCoalescer;
+
+    // Hand an event that has been let through by the coalescer on to
+    // its subscribers, or to the event queue
+    static void deliver(const Event &e) {
         if (e.type == Event::Error) _dprintf(DBG_ERROR, "Error (Event)", "%s\n", e.description.c_str());
         else if (e.type == Event::Warning) _dprintf(DBG_WARN, "Warning (Event)", "%s\n", e.description.c_str());
         else _dprintf(DBG_MINOR, "Event", "%s\n", e.description.c_str());
-        _eventQueue.push(e);
+        if (!EventDispatcher::instance().post(e)) eventStore.push(e);
+    }
+
+    static void deliver(const std::vector<Event> &events) {
+        for (size_t i = 0; i < events.size(); i++) deliver(events[i]);
+    }
+
+    static int flushCoalescedEvents() {
+        std::vector<Event> summaries;
+        int next = eventCoalescer.flush(Time::now(), false, &summaries);
+        deliver(summaries);
+        return next;
+    }
+
+    // Pull an event from the queue, after reporting any runs of
+    // merged events that are over
+    static bool pullEvent(Event *e, const EventStore::Filter &f) {
+        std::vector<Event> summaries;
+        eventCoalescer.flush(Time::now(), false, &summaries);
+        deliver(summaries);
+        return eventStore.pull(e, f);
+    }
+
+    // Gets the next pending event. Returns false if there are no
+    // outstanding events. 
+    bool getNextEvent(Event *e) {        
+        return pullEvent(e, EventStore::Filter());
+    }
+
+    // Filter the event queue for specific types of events, several variants
+    bool getNextEvent(Event *e, int type) {
+        EventStore::Filter f;
+        f.byType = true;
+        f.type = type;
+        return pullEvent(e, f);
+    }
+
+    bool getNextEvent(Event *e, int type, int data) {
+        EventStore::Filter f;
+        f.byType = f.byData = true;
+        f.type = type;
+        f.data = data;
+        return pullEvent(e, f);
+    }
+
+    bool getNextEvent(Event *e, int type, EventGenerator *creator) {
+        EventStore::Filter f;
+        f.byType = f.byCreator = true;
+        f.type = type;
+        f.creator = creator;
+        return pullEvent(e, f);
+    }
+
+    bool getNextEvent(Event *e, int type, int data, EventGenerator *creator) {
+        EventStore::Filter f;
+        f.byType = f.byData = f.byCreator = true;
+        f.type = type;
+        f.data = data;
+        f.creator = creator;
+        return pullEvent(e, f);
+    }
+
+    bool getNextEvent(Event *e, EventGenerator *creator) {
+        EventStore::Filter f;
+        f.byCreator = true;
+        f.creator = creator;
+        return pullEvent(e, f);
+    }
+
+    void subscribe(EventListener *l, int type) {
+        EventDispatcher::instance().subscribe(l, false, type, NULL);
+    }
+
+    void subscribe(EventListener *l, int type, EventGenerator *creator) {
+        EventDispatcher::instance().subscribe(l, false, type, creator);
+    }
+
+    void subscribe(EventListener *l, EventGenerator *creator) {
+        EventDispatcher::instance().subscribe(l, true, 0, creator);
+    }
+
+    void unsubscribe(EventListener *l) {
+        EventDispatcher::instance().unsubscribe(l);
+    }
+
+    void setEventCoalescing(int interval) {
+        std::vector<Event> summaries;
+        eventCoalescer.setInterval(interval, &summaries);
+        deliver(summaries);
+    }
+
+    void setEventQueueLimit(size_t limit) {
+        eventStore.setLimit(limit);
+    }
+
+    EventStats eventStats() {
+        EventStats st;
+        eventCoalescer.stats(&st, false);
+        st.dropped = eventStore.droppedEvents(false);
+        return st;
+    }
+
+    void resetEventStats() {
+        EventStats st;
+        eventCoalescer.stats(&st, true);
+        eventStore.droppedEvents(true);
+    }
+
+    // Let an event through the coalescer, and deliver it and any
+    // summary of earlier merged events. Returns false if the event
+    // was merged into an earlier one instead.
+    static bool admit(int type, int data, EventGenerator *creator) {
+        std::vector<Event> summaries;
+        bool admitted = eventCoalescer.admit(type, data, creator, Time::now(), &summaries);
+        deliver(summaries);
+        return admitted;
+    }
+
+    // Post an event already let through by admit
+    static void postAdmitted(const Event &e) {
+        eventCoalescer.opened(e);
+        deliver(e);
+    }
+
+    void postEvent(Event e) {        
+        if (!admit(e.type, e.data, e.creator)) return;
+        postAdmitted(e);
+    }
+
+    // Format and post an error or warning, unless it gets merged
+    // into an earlier one
+    static void postMessage(int type, int code, EventGenerator *creator, 
+                            const char *fmt, va_list arglist) {
+        if (!admit(type, code, creator)) return;
+        char buf[256];
+        vsnprintf(buf, 256, fmt, arglist);
+        Event e;
+        e.creator = creator;
+        e.type = type;
+        e.description = buf;
+        e.data = code;
+        e.time = Time::now();
+        postAdmitted(e);
     }
 
     void postEvent(int type, int data, const std::string &msg, EventGenerator *creator) {
@@ -111,42 +600,31 @@ namespace FCam {
     }
 
     void error(int code, const char *fmt, ...) {
-        char buf[256];
         va_list arglist;
         va_start(arglist, fmt);
-        vsnprintf(buf, 256, fmt, arglist);
+        postMessage(Event::Error, code, NULL, fmt, arglist);
         va_end(arglist);
-        postEvent(Event::Error, code, buf);
     }
 
     void warning(int code, const char *fmt, ...) {
-        char buf[256];
         va_list arglist;
         va_start(arglist, fmt);
-        vsnprintf(buf, 256, fmt, arglist);
+        postMessage(Event::Warning, code, NULL, fmt, arglist);
         va_end(arglist);
-        postEvent(Event::Warning, code, buf);
     }
 
     void error(int code, EventGenerator *creator, const char *fmt, ...) {
-        char buf[256];
         va_list arglist;
         va_start(arglist, fmt);
-        vsnprintf(buf, 256, fmt, arglist);
+        postMessage(Event::Error, code, creator, fmt, arglist);
         va_end(arglist);
-        postEvent(Event::Error, code, buf, creator);        
     }
 
     void warning(int code, EventGenerator *creator, const char *fmt, ...) {
-        char buf[256];
         va_list arglist;
         va_start(arglist, fmt);
-        vsnprintf(buf, 256, fmt, arglist);
+        postMessage(Event::Warning, code, creator, fmt, arglist);
         va_end(arglist);
-        postEvent(Event::Warning, code, buf, creator);        
     }
 
-    TSQueue<Event> _eventQueue;
 }
-
-
@@ -7,6 +7,7 @@
 #include "FCam/Image.h"
 #include "FCam/Time.h"
 #include "FCam/Event.h"
+#include "FCam/Counters.h"
 #include "Debug.h"
 
 namespace FCam {
@@ -14,6 +15,9 @@ namespace FCam {
     unsigned char *Image::Discard = (unsigned char *)(0);
     unsigned char *Image::AutoAllocate = (unsigned char *)(-1);
 
+    static Counter allocations("image.allocations");
+    static Counter bytesAllocatedTotal("image.bytes_allocated");
+
     Image::Image()
         : _size(0, 0), _type(UNKNOWN), _bytesPerPixel(0), _bytesPerRow(0), 
           data(Image::Discard), buffer(NULL), bytesAllocated(0),
@@ -35,6 +39,8 @@ namespace FCam {
         
         bytesAllocated = bytesPerRow()*allocateHeight();
         setBuffer(new unsigned char[bytesAllocated]);
+        allocations.add();
+        bytesAllocatedTotal.add(bytesAllocated);
         refCount = new unsigned;
         *refCount = 1; // only I know about this data
         mutex = new pthread_mutex_t;
@@ -53,14 +59,16 @@ namespace FCam {
           privateData(NULL) {
 
         bytesAllocated = bytesPerRow()*allocateHeight();
-        setBuffer(new unsigned char[bytesAllocated]);        
+        setBuffer(new unsigned char[bytesAllocated]);
+        allocations.add();
+        bytesAllocatedTotal.add(bytesAllocated);
         refCount = new unsigned;
         *refCount = 1; // only I know about this data
         mutex = new pthread_mutex_t;
         pthread_mutex_init(mutex, NULL);
     }
 
-    Image::Image(int fd, int offset, Size s, ImageFormat f, bool writeThrough) 
+    Image::Image(int fd, uint64_t offset, Size s, ImageFormat f, bool writeThrough) 
         : _size(s), 
           _type(f), 
           _bytesPerPixel(FCam::bytesPerPixel(f)),
@@ -79,30 +87,37 @@ namespace FCam {
             flags = MAP_PRIVATE;
         }
         // Make starting offset a multiple of page size, and determine relative offset to true buffer start
-        int pageSize = getpagesize();
-        int startOfMap = (offset/pageSize)*pageSize;
+        uint64_t pageSize = getpagesize();
+        uint64_t startOfMap = (offset/pageSize)*pageSize;
         int mapOffset = offset-startOfMap;
+        // Where off_t is 32 bits, mmap cannot reach past 2GB
+        if ((off_t)startOfMap < 0 || (uint64_t)(off_t)startOfMap != startOfMap) {
+            error(Event::InternalError,
+                  "Image: Offset %llu into file descriptor %d is too large to map on this platform",
+                  (unsigned long long)offset, fd);
+            return;
+        }
         // Make mapping size a multiple of page size, rounding up
-        int bytesToMap = bytesPerRow()*height()+mapOffset; 
+        int bytesToMap = bytesPerRow()*allocateHeight()+mapOffset; 
         bytesAllocated = ((bytesToMap-1)/pageSize+1) *pageSize;
         dprintf(5, 
                 "Image::Image(): Mapping image from file %d. "
-                "Requsted start %x, length %x. "
-                "Actual start: %x, offset %x, length %x\n", 
-                fd, offset, bytesPerRow()*height(), 
-                startOfMap, offset, bytesAllocated);
+                "Requsted start %llx, length %x. "
+                "Actual start: %llx, offset %x, length %x\n", 
+                fd, (unsigned long long)offset, bytesPerRow()*height(), 
+                (unsigned long long)startOfMap, mapOffset, bytesAllocated);
 
         mappedBuffer = (unsigned char*)mmap(NULL, 
                                             bytesAllocated,
                                             PROT_READ | PROT_WRITE,
                                             flags,
                                             fd,
-                                            startOfMap);
+                                            (off_t)startOfMap);
 
         if (mappedBuffer == MAP_FAILED) {
             error(Event::InternalError, 
-                  "Image: Unable to memory map file descriptor %d at %d, length %d bytes: %s",
-                  fd, offset, bytesPerRow()*height(), strerror(errno)
+                  "Image: Unable to memory map file descriptor %d at %llu, length %d bytes: %s",
+                  fd, (unsigned long long)offset, bytesPerRow()*height(), strerror(errno)
                   );
             return;
         }
@@ -405,6 +420,7 @@ namespace FCam {
     unsigned int Image::allocateHeight() const {
         switch(_type) {
             case YUV420p:
+            case YV12:
                 return height() + height()/2;
             default:
                 return height();
@@ -0,0 +1,87 @@
+#include <map>
+#include <math.h>
+#include <pthread.h>
+
+#include "FCam/Platform.h"
+#include "Debug.h"
+
+namespace FCam {
+
+    struct Platform::ColorMatrixCache {
+        struct Entry {
+            float matrix[12];
+            int16_t fixed[12];
+        };
+
+        // Only a handful of white balances are in use at any one
+        // time. If the cache fills up anyway (e.g. while auto white
+        // balance sweeps around) just start over.
+        enum {MaxEntries = 64};
+
+        std::map<int, Entry> entries;
+        pthread_mutex_t mutex;
+
+        ColorMatrixCache() {
+            pthread_mutex_init(&mutex, NULL);
+        }
+
+        ~ColorMatrixCache() {
+            pthread_mutex_destroy(&mutex);
+        }
+
+        // Find or compute the entry for a white balance. Must be
+        // called with the mutex held.
+        const Entry &lookup(const Platform &platform, int kelvin) {
+            int key = (kelvin + ColorMatrixQuantum/2) / ColorMatrixQuantum;
+            if (key < 1) key = 1;
+
+            std::map<int, Entry>::iterator i = entries.find(key);
+            if (i != entries.end()) return i->second;
+
+            if (entries.size() >= MaxEntries) entries.clear();
+
+            Entry &e = entries[key];
+            platform.rawToRGBColorMatrix(key * ColorMatrixQuantum, e.matrix);
+            for (int j = 0; j < 12; j++) {
+                float v = floorf(e.matrix[j] * 256 + 0.5f);
+                if (v > 32767) v = 32767;
+                if (v < -32768) v = -32768;
+                e.fixed[j] = (int16_t)v;
+            }
+            dprintf(DBG_MINOR, "Platform: Cached color matrix for %d K\n", key * ColorMatrixQuantum);
+            return e;
+        }
+    };
+
+    Platform::Platform() : colorCache(new ColorMatrixCache) {}
+
+    Platform::Platform(const Platform &) : colorCache(new ColorMatrixCache) {}
+
+    Platform &Platform::operator=(const Platform &) {
+        // Keep our own cache, but the matrices it holds may no longer
+        // be right
+        pthread_mutex_lock(&colorCache->mutex);
+        colorCache->entries.clear();
+        pthread_mutex_unlock(&colorCache->mutex);
+        return *this;
+    }
+
+    Platform::~Platform() {
+        delete colorCache;
+    }
+
+    void Platform::colorMatrix(int kelvin, float *matrix) const {
+        pthread_mutex_lock(&colorCache->mutex);
+        const ColorMatrixCache::Entry &e = colorCache->lookup(*this, kelvin);
+        for (int i = 0; i < 12; i++) matrix[i] = e.matrix[i];
+        pthread_mutex_unlock(&colorCache->mutex);
+    }
+
+    void Platform::colorMatrixFixed(int kelvin, int16_t *matrix) const {
+        pthread_mutex_lock(&colorCache->mutex);
+        const ColorMatrixCache::Entry &e = colorCache->lookup(*this, kelvin);
+        for (int i = 0; i < 12; i++) matrix[i] = e.fixed[i];
+        pthread_mutex_unlock(&colorCache->mutex);
+    }
+
+}
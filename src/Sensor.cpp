@@ -33,6 +33,7 @@ namespace FCam {
 
     void Sensor::setDropPolicy(Sensor::DropPolicy d) {
         dropPolicy = d;
+        enforceDropPolicy();
     }
 
     Sensor::DropPolicy Sensor::getDropPolicy() {
@@ -12,7 +12,25 @@ namespace FCam {
     pthread_mutex_t Shot::_idLock = PTHREAD_MUTEX_INITIALIZER;
     int Shot::_id = 0;
 
-    Shot::Shot(): exposure(0), frameTime(0), gain(0), whiteBalance(5000) {
+    struct Shot::SharedData {
+        SharedData(): refs(1) {}
+        ~SharedData() {
+            for (std::set<Action*>::iterator i = actions.begin();
+                 i != actions.end(); i++) {
+                delete *i;
+            }
+        }
+
+        int refs;
+        std::set<Action *> actions;
+        std::vector<float> colorMatrix;
+    };
+
+    // Returned for shots with no shared data
+    static const std::set<Action *> noActions;
+    static const std::vector<float> noColorMatrix;
+
+    Shot::Shot(): exposure(0), frameTime(0), gain(0), whiteBalance(5000), _shared(NULL) {
         pthread_mutex_lock(&_idLock);
         id = ++_id;
         pthread_mutex_unlock(&_idLock);
@@ -23,16 +41,61 @@ namespace FCam {
     };
 
     Shot::~Shot() {
-        clearAllActions();
+        releaseShared();
+    }
+
+    void Shot::releaseShared() {
+        if (!_shared) return;
+        pthread_mutex_lock(&_idLock);
+        bool last = (--_shared->refs == 0);
+        pthread_mutex_unlock(&_idLock);
+        if (last) delete _shared;
+        _shared = NULL;
+    }
+
+    Shot::SharedData *Shot::unshare(bool copyActions) {
+        if (!_shared) {
+            _shared = new SharedData;
+            return _shared;
+        }
+
+        // If nobody else holds a reference, nobody else can acquire
+        // one while we look at it either.
+        pthread_mutex_lock(&_idLock);
+        bool sole = (_shared->refs == 1);
+        pthread_mutex_unlock(&_idLock);
+        if (sole) return _shared;
+
+        SharedData *data = new SharedData;
+        data->colorMatrix = _shared->colorMatrix;
+        if (copyActions) {
+            for (std::set<Action*>::const_iterator i = _shared->actions.begin(); 
+                 i != _shared->actions.end(); i++) {
+                data->actions.insert((*i)->copy());
+            }
+        }
+        releaseShared();
+        _shared = data;
+        return _shared;
+    }
+
+    const std::set<Action *> &Shot::actions() const {
+        return _shared ? _shared->actions : noActions;
+    }
+
+    const std::vector<float> &Shot::colorMatrix() const {
+        return _shared ? _shared->colorMatrix : noColorMatrix;
     }
 
     void Shot::clearActions(void *owner) {
-        for (std::set<Action*>::iterator i = _actions.begin(); 
-             i != _actions.end();) {
+        if (!_shared || _shared->actions.empty()) return;
+        std::set<Action *> &actions = unshare()->actions;
+        for (std::set<Action*>::iterator i = actions.begin(); 
+             i != actions.end();) {
 
         	if ((*i)->owner == owner) {
         		delete *i;
-        		_actions.erase(i++);
+        		actions.erase(i++);
         	} else  {
         		i++;
         	}
@@ -40,15 +103,17 @@ namespace FCam {
     }
     
     void Shot::clearAllActions() {
-		for (std::set<Action*>::iterator i = _actions.begin();
-			 i != _actions.end(); i++) {
+        if (!_shared || _shared->actions.empty()) return;
+        std::set<Action *> &actions = unshare(false)->actions;
+		for (std::set<Action*>::iterator i = actions.begin();
+			 i != actions.end(); i++) {
 				delete *i;
 		}
-		_actions.clear();
+		actions.clear();
 	}
 
     void Shot::addAction(const Action &action) {
-        _actions.insert(action.copy());
+        unshare()->actions.insert(action.copy());
     }
 
     Shot::Shot(const Shot &other) :
@@ -60,19 +125,12 @@ namespace FCam {
         histogram(other.histogram),
         sharpness(other.sharpness),
         wanted(other.wanted),
-        _colorMatrix(other._colorMatrix) {
+        _shared(other._shared) {
 
         pthread_mutex_lock(&_idLock);
         id = ++_id;
+        if (_shared) _shared->refs++;
         pthread_mutex_unlock(&_idLock);
-
-        clearAllActions();
-
-        for (std::set<Action*>::const_iterator i = other._actions.begin(); 
-             i != other._actions.end(); i++) {
-            Action *a = (*i)->copy();
-            _actions.insert(a);
-        }        
     };
 
 
@@ -81,22 +139,24 @@ namespace FCam {
             clearColorMatrix();
             return;
         }
-        _colorMatrix.resize(12);
-        for (int i = 0; i < 12; i++) _colorMatrix[i] = m[i];
+        std::vector<float> &colorMatrix = unshare()->colorMatrix;
+        colorMatrix.resize(12);
+        for (int i = 0; i < 12; i++) colorMatrix[i] = m[i];
     }
 
     void Shot::clearColorMatrix() {
-        _colorMatrix.clear();
+        if (!_shared || _shared->colorMatrix.empty()) return;
+        unshare()->colorMatrix.clear();
     }
 
     const Shot &Shot::operator=(const Shot &other) {
-        clearAllActions();
-
-        for (std::set<Action*>::const_iterator i = other._actions.begin(); 
-             i != other._actions.end(); i++) {
-            Action *a = (*i)->copy();
-            _actions.insert(a);
-        }        
+        if (_shared != other._shared) {
+            releaseShared();
+            _shared = other._shared;
+            pthread_mutex_lock(&_idLock);
+            if (_shared) _shared->refs++;
+            pthread_mutex_unlock(&_idLock);
+        }
 
         pthread_mutex_lock(&_idLock);
         id = ++_id;
@@ -110,7 +170,6 @@ namespace FCam {
         sharpness = other.sharpness;
         image = other.image;
         wanted = other.wanted;
-        _colorMatrix = other._colorMatrix;
 
         return *this;
     }
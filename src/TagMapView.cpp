@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <string.h>
+
+#include "FCam/TagMapView.h"
+#include "FCam/Event.h"
+
+#include "Debug.h"
+
+namespace FCam {
+
+    // Blob layout. All offsets are from the start of the blob.
+    //
+    //   Header: 4-byte magic "FTM1", tag count, total blob size, reserved
+    //   Directory: one TagBlobEntry per tag, sorted by key
+    //   Keys: NUL-terminated tag names
+    //   Values: each one 8-byte aligned, in its native layout:
+    //     Int, Float, Double: the value
+    //     String: the bytes, plus a terminating NUL
+    //     Time: seconds, microseconds as two ints
+    //     Int/Float/DoubleVector: the elements
+    //     TimeVector: seconds, microseconds pairs
+    //     StringVector: (count+1) uint32 offsets, relative to the end of
+    //       the offset table, followed by the NUL-terminated strings
+
+    const char tagBlobMagic[4] = {'F','T','M','1'};
+
+    struct TagBlobHeader {
+        char magic[4];
+        uint32_t count;
+        uint32_t totalBytes;
+        uint32_t reserved;
+    };
+
+    struct TagBlobEntry {
+        uint32_t keyOffset;
+        uint16_t keyBytes;
+        uint8_t type;
+        uint8_t reserved;
+        uint32_t count;
+        uint32_t dataOffset;
+    };
+
+    static size_t align8(size_t x) {
+        return (x + 7) & ~(size_t)7;
+    }
+
+    // Number of elements to record for a tag, and the number of
+    // bytes its value occupies in the blob
+    static void valueSize(const TagValue &val, uint32_t *count, size_t *bytes) {
+        switch (val.type) {
+        case TagValue::Null:
+            *count = 0; *bytes = 0; return;
+        case TagValue::Int:
+            *count = 1; *bytes = sizeof(int); return;
+        case TagValue::Float:
+            *count = 1; *bytes = sizeof(float); return;
+        case TagValue::Double:
+            *count = 1; *bytes = sizeof(double); return;
+        case TagValue::String:
+            *count = ((std::string &)val).size();
+            *bytes = *count + 1;
+            return;
+        case TagValue::Time:
+            *count = 1; *bytes = 2*sizeof(int); return;
+        case TagValue::IntVector:
+            *count = ((std::vector<int> &)val).size();
+            *bytes = *count*sizeof(int);
+            return;
+        case TagValue::FloatVector:
+            *count = ((std::vector<float> &)val).size();
+            *bytes = *count*sizeof(float);
+            return;
+        case TagValue::DoubleVector:
+            *count = ((std::vector<double> &)val).size();
+            *bytes = *count*sizeof(double);
+            return;
+        case TagValue::StringVector: {
+            std::vector<std::string> &x = val;
+            *count = x.size();
+            *bytes = (x.size()+1)*sizeof(uint32_t);
+            for (size_t i = 0; i < x.size(); i++) *bytes += x[i].size() + 1;
+            return;
+        }
+        case TagValue::TimeVector:
+            *count = ((std::vector<Time> &)val).size();
+            *bytes = *count*2*sizeof(int);
+            return;
+        }
+        *count = 0; *bytes = 0;
+    }
+
+    static void writeValue(const TagValue &val, unsigned char *dst) {
+        switch (val.type) {
+        case TagValue::Null:
+            return;
+        case TagValue::Int: {
+            int x = val;
+            memcpy(dst, &x, sizeof(int));
+            return;
+        }
+        case TagValue::Float: {
+            float x = val;
+            memcpy(dst, &x, sizeof(float));
+            return;
+        }
+        case TagValue::Double: {
+            double x = val;
+            memcpy(dst, &x, sizeof(double));
+            return;
+        }
+        case TagValue::String: {
+            std::string &x = val;
+            memcpy(dst, x.data(), x.size());
+            dst[x.size()] = 0;
+            return;
+        }
+        case TagValue::Time: {
+            Time t = val;
+            int x[2] = {t.s(), t.us()};
+            memcpy(dst, x, sizeof(x));
+            return;
+        }
+        case TagValue::IntVector: {
+            std::vector<int> &x = val;
+            if (x.size()) memcpy(dst, &x[0], x.size()*sizeof(int));
+            return;
+        }
+        case TagValue::FloatVector: {
+            std::vector<float> &x = val;
+            if (x.size()) memcpy(dst, &x[0], x.size()*sizeof(float));
+            return;
+        }
+        case TagValue::DoubleVector: {
+            std::vector<double> &x = val;
+            if (x.size()) memcpy(dst, &x[0], x.size()*sizeof(double));
+            return;
+        }
+        case TagValue::StringVector: {
+            std::vector<std::string> &x = val;
+            uint32_t *offsets = (uint32_t *)((void *)dst);
+            unsigned char *strings = dst + (x.size()+1)*sizeof(uint32_t);
+            uint32_t pos = 0;
+            for (size_t i = 0; i < x.size(); i++) {
+                offsets[i] = pos;
+                memcpy(strings + pos, x[i].data(), x[i].size());
+                strings[pos + x[i].size()] = 0;
+                pos += x[i].size() + 1;
+            }
+            offsets[x.size()] = pos;
+            return;
+        }
+        case TagValue::TimeVector: {
+            std::vector<Time> &x = val;
+            int *ptr = (int *)((void *)dst);
+            for (size_t i = 0; i < x.size(); i++) {
+                ptr[i*2] = x[i].s();
+                ptr[i*2+1] = x[i].us();
+            }
+            return;
+        }
+        }
+    }
+
+    static bool keyLess(TagMap::const_iterator a, TagMap::const_iterator b) {
+        return strcmp(a->first.c_str(), b->first.c_str()) < 0;
+    }
+
+    std::string tagMapToBlob(const TagMap &tags) {
+        std::vector<TagMap::const_iterator> sorted;
+        sorted.reserve(tags.size());
+        for (TagMap::const_iterator it = tags.begin(); it != tags.end(); it++) {
+            sorted.push_back(it);
+        }
+        std::sort(sorted.begin(), sorted.end(), keyLess);
+
+        // Lay out the blob
+        std::vector<TagBlobEntry> dir(sorted.size());
+        std::vector<size_t> valueBytes(sorted.size());
+        size_t pos = sizeof(TagBlobHeader) + sorted.size()*sizeof(TagBlobEntry);
+        for (size_t i = 0; i < sorted.size(); i++) {
+            dir[i].keyOffset = pos;
+            dir[i].keyBytes = sorted[i]->first.size();
+            pos += sorted[i]->first.size() + 1;
+        }
+        for (size_t i = 0; i < sorted.size(); i++) {
+            pos = align8(pos);
+            dir[i].type = sorted[i]->second.type;
+            dir[i].reserved = 0;
+            valueSize(sorted[i]->second, &dir[i].count, &valueBytes[i]);
+            dir[i].dataOffset = pos;
+            pos += valueBytes[i];
+        }
+        size_t total = align8(pos);
+
+        // And fill it in
+        std::string blob(total, '\0');
+        unsigned char *base = (unsigned char *)&blob[0];
+
+        TagBlobHeader header;
+        memcpy(header.magic, tagBlobMagic, sizeof(tagBlobMagic));
+        header.count = sorted.size();
+        header.totalBytes = total;
+        header.reserved = 0;
+        memcpy(base, &header, sizeof(header));
+        if (sorted.size()) {
+            memcpy(base + sizeof(header), &dir[0], sorted.size()*sizeof(TagBlobEntry));
+        }
+
+        for (size_t i = 0; i < sorted.size(); i++) {
+            memcpy(base + dir[i].keyOffset, sorted[i]->first.c_str(), dir[i].keyBytes + 1);
+            writeValue(sorted[i]->second, base + dir[i].dataOffset);
+        }
+
+        return blob;
+    }
+
+    TagMap tagMapFromBlob(const void *data, size_t bytes) {
+        TagMap tags;
+        TagMapView view(data, bytes);
+        view.toTagMap(&tags);
+        return tags;
+    }
+
+    TagMapView::TagMapView(): base(NULL), count(0) {
+    }
+
+    TagMapView::TagMapView(const void *data, size_t bytes): base(NULL), count(0) {
+        const unsigned char *b = (const unsigned char *)data;
+
+#define parseError(...) do {                                    \
+            error(Event::ParseError, __VA_ARGS__);              \
+            return; } while(0)
+
+        if (!b || bytes < sizeof(TagBlobHeader)) parseError("TagMapView: Tag blob too short (%d bytes)", (int)bytes);
+
+        const TagBlobHeader *header = (const TagBlobHeader *)data;
+        if (memcmp(header->magic, tagBlobMagic, sizeof(tagBlobMagic)) != 0) parseError("TagMapView: Not a tag blob");
+        if (header->totalBytes > bytes) {
+            parseError("TagMapView: Tag blob truncated (%d of %d bytes)", (int)bytes, (int)header->totalBytes);
+        }
+        size_t total = header->totalBytes;
+        if (total < sizeof(TagBlobHeader)) {
+            parseError("TagMapView: Tag blob header gives too small a size (%d bytes)", (int)total);
+        }
+        if (header->count > (total - sizeof(TagBlobHeader))/sizeof(TagBlobEntry)) {
+            parseError("TagMapView: Tag blob directory too large (%d entries)", (int)header->count);
+        }
+
+        // Validate every entry up front, so that accessors can trust the directory
+        const TagBlobEntry *dir = (const TagBlobEntry *)(b + sizeof(TagBlobHeader));
+        for (uint32_t i = 0; i < header->count; i++) {
+            const TagBlobEntry &e = dir[i];
+            if ((size_t)e.keyOffset + e.keyBytes >= total || b[e.keyOffset + e.keyBytes] != 0) {
+                parseError("TagMapView: Bad key in tag blob entry %d", i);
+            }
+            if (i > 0 && strcmp((const char *)b + dir[i-1].keyOffset, (const char *)b + e.keyOffset) >= 0) {
+                parseError("TagMapView: Tag blob keys out of order at entry %d", i);
+            }
+            if (e.dataOffset % 8 != 0 || e.dataOffset > total) {
+                parseError("TagMapView: Bad value offset in tag blob entry %d", i);
+            }
+            size_t room = total - e.dataOffset;
+            size_t need = 0;
+            switch (e.type) {
+            case TagValue::Null: break;
+            case TagValue::Int: need = sizeof(int); break;
+            case TagValue::Float: need = sizeof(float); break;
+            case TagValue::Double: need = sizeof(double); break;
+            case TagValue::Time: need = 2*sizeof(int); break;
+            case TagValue::String:
+                need = (size_t)e.count + 1;
+                if (need <= room && b[e.dataOffset + e.count] != 0) need = room + 1;
+                break;
+            case TagValue::IntVector: need = (size_t)e.count*sizeof(int); break;
+            case TagValue::FloatVector: need = (size_t)e.count*sizeof(float); break;
+            case TagValue::DoubleVector: need = (size_t)e.count*sizeof(double); break;
+            case TagValue::TimeVector: need = (size_t)e.count*2*sizeof(int); break;
+            case TagValue::StringVector: {
+                if (e.count >= room/sizeof(uint32_t)) {
+                    need = room + 1;
+                    break;
+                }
+                need = ((size_t)e.count+1)*sizeof(uint32_t);
+                const uint32_t *offsets = (const uint32_t *)(b + e.dataOffset);
+                const unsigned char *strings = b + e.dataOffset + need;
+                size_t stringRoom = room - need;
+                if (offsets[0] != 0 || offsets[e.count] > stringRoom) {
+                    need = room + 1;
+                    break;
+                }
+                for (uint32_t j = 0; j < e.count; j++) {
+                    if (offsets[j+1] <= offsets[j] || offsets[j+1] > offsets[e.count] ||
+                        strings[offsets[j+1]-1] != 0) {
+                        need = room + 1;
+                        break;
+                    }
+                }
+                if (need <= room) need += offsets[e.count];
+                break;
+            }
+            default:
+                parseError("TagMapView: Unknown type %d in tag blob entry %d", e.type, i);
+            }
+            if (need > room) parseError("TagMapView: Value of tag blob entry %d is malformed", i);
+        }
+
+#undef parseError
+
+        base = b;
+        count = header->count;
+    }
+
+    TagMapView::Entry TagMapView::operator[](int i) const {
+        if (i < 0 || i >= count) return Entry();
+        return Entry(base, base + sizeof(TagBlobHeader) + i*sizeof(TagBlobEntry));
+    }
+
+    TagMapView::Entry TagMapView::find(const char *key) const {
+        int lo = 0, hi = count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            Entry e = (*this)[mid];
+            int cmp = strcmp(e.key(), key);
+            if (cmp == 0) return e;
+            if (cmp < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return Entry();
+    }
+
+    void TagMapView::toTagMap(TagMap *tags) const {
+        for (int i = 0; i < count; i++) {
+            Entry e = (*this)[i];
+            (*tags)[e.key()] = e.toTagValue();
+        }
+    }
+
+#define DIR ((const TagBlobEntry *)dir)
+
+    const char *TagMapView::Entry::key() const {
+        if (!dir) return "";
+        return (const char *)base + DIR->keyOffset;
+    }
+
+    TagValue::Type TagMapView::Entry::type() const {
+        if (!dir) return TagValue::Null;
+        return (TagValue::Type)DIR->type;
+    }
+
+    int TagMapView::Entry::count() const {
+        if (!dir) return 0;
+        return DIR->count;
+    }
+
+    const void *TagMapView::Entry::data() const {
+        return base + DIR->dataOffset;
+    }
+
+    bool TagMapView::Entry::check(TagValue::Type t) const {
+        if (dir && DIR->type == t) return true;
+        error(Event::BadCast, "TagMapView: Tag '%s' is of type %d, not %d", key(), type(), t);
+        return false;
+    }
+
+#undef DIR
+
+    int TagMapView::Entry::asInt() const {
+        if (!check(TagValue::Int)) return 0;
+        return *(const int *)data();
+    }
+
+    float TagMapView::Entry::asFloat() const {
+        if (!check(TagValue::Float)) return 0;
+        return *(const float *)data();
+    }
+
+    double TagMapView::Entry::asDouble() const {
+        if (!check(TagValue::Double)) return 0;
+        double x;
+        memcpy(&x, data(), sizeof(double));
+        return x;
+    }
+
+    Time TagMapView::Entry::asTime(int i) const {
+        const int *ptr = NULL;
+        if (type() == TagValue::TimeVector) {
+            if (i < 0 || i >= count()) {
+                error(Event::OutOfRange, "TagMapView: Index %d out of range for tag '%s'", i, key());
+                return Time(0, 0);
+            }
+            ptr = (const int *)data() + 2*i;
+        } else if (check(TagValue::Time)) {
+            ptr = (const int *)data();
+        } else {
+            return Time(0, 0);
+        }
+        return Time(ptr[0], ptr[1]);
+    }
+
+    const int *TagMapView::Entry::asIntArray() const {
+        if (!check(TagValue::IntVector)) return NULL;
+        return (const int *)data();
+    }
+
+    const float *TagMapView::Entry::asFloatArray() const {
+        if (!check(TagValue::FloatVector)) return NULL;
+        return (const float *)data();
+    }
+
+    const double *TagMapView::Entry::asDoubleArray() const {
+        if (!check(TagValue::DoubleVector)) return NULL;
+        return (const double *)data();
+    }
+
+    const char *TagMapView::Entry::asCString() const {
+        if (!check(TagValue::String)) return NULL;
+        return (const char *)data();
+    }
+
+    const char *TagMapView::Entry::asCString(int i, int *length) const {
+        if (!check(TagValue::StringVector)) return NULL;
+        if (i < 0 || i >= count()) {
+            error(Event::OutOfRange, "TagMapView: Index %d out of range for tag '%s'", i, key());
+            return NULL;
+        }
+        const uint32_t *offsets = (const uint32_t *)data();
+        const char *strings = (const char *)(offsets + count() + 1);
+        if (length) *length = offsets[i+1] - offsets[i] - 1;
+        return strings + offsets[i];
+    }
+
+    TagValue TagMapView::Entry::toTagValue() const {
+        switch (type()) {
+        case TagValue::Null:
+            return TagValue();
+        case TagValue::Int:
+            return TagValue(asInt());
+        case TagValue::Float:
+            return TagValue(asFloat());
+        case TagValue::Double:
+            return TagValue(asDouble());
+        case TagValue::String:
+            return TagValue(std::string(asCString(), count()));
+        case TagValue::Time:
+            return TagValue(asTime());
+        case TagValue::IntVector: {
+            const int *x = asIntArray();
+            return TagValue(std::vector<int>(x, x + count()));
+        }
+        case TagValue::FloatVector: {
+            const float *x = asFloatArray();
+            return TagValue(std::vector<float>(x, x + count()));
+        }
+        case TagValue::DoubleVector: {
+            std::vector<double> x(count());
+            if (count()) memcpy(&x[0], data(), count()*sizeof(double));
+            return TagValue(x);
+        }
+        case TagValue::StringVector: {
+            std::vector<std::string> x(count());
+            for (int i = 0; i < count(); i++) {
+                int length;
+                const char *s = asCString(i, &length);
+                x[i].assign(s, length);
+            }
+            return TagValue(x);
+        }
+        case TagValue::TimeVector: {
+            std::vector<Time> x(count());
+            for (int i = 0; i < count(); i++) x[i] = asTime(i);
+            return TagValue(x);
+        }
+        }
+        return TagValue();
+    }
+
+}
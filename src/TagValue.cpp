@@ -1,6 +1,8 @@
 #include "FCam/TagValue.h"
 
 #include <ctype.h>
+#include <new>
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
@@ -18,22 +20,15 @@ namespace FCam {
     void TagValue::nullify() {
         switch (type) {
         case Null:
-            break;
         case Int:
-            delete (int *)data;
-            break;
         case Float:
-            delete (float *)data;
-            break;
         case Double:
-            delete (double *)data;
+        case Time:
+            // Stored in place, nothing to free
             break;
         case String:
             delete (std::string *)data;
             break;
-        case Time:
-            delete (FCam::Time *)data;
-            break;
         case IntVector:
             delete (std::vector<int> *)data;
             break;
@@ -54,112 +49,113 @@ namespace FCam {
         data = NULL;
     }
 
+    bool TagValue::storedInPlace(Type t) {
+        return (t == Int || t == Float || t == Double || t == Time);
+    }
+
+    void TagValue::swap(TagValue &other) {
+        if (this == &other) return;
+        std::swap(type, other.type);
+        std::swap(data, other.data);
+        std::swap(storage, other.storage);
+        // In-place values moved with the storage, so repoint at it
+        if (storedInPlace(type)) data = (void *)storage.bytes;
+        if (storedInPlace(other.type)) other.data = (void *)other.storage.bytes;
+    }
+
     TagValue::TagValue(int x) {
         type = Int;
-        int *ptr = new int;
-        *ptr = x;
-        data = (void *)ptr;
+        data = (void *)storage.bytes;
+        *(int *)data = x;
     }
 
     TagValue::TagValue(float x) {
         type = Float;
-        float *ptr = new float;
-        *ptr = x;
-        data = (void *)ptr;
+        data = (void *)storage.bytes;
+        *(float *)data = x;
     }
 
     TagValue::TagValue(double x) {
         type = Double;
-        double *ptr = new double;
-        *ptr = x;
-        data = (void *)ptr;
+        data = (void *)storage.bytes;
+        *(double *)data = x;
     }
 
     TagValue::TagValue(std::string x) {
         type = String;
         std::string *ptr = new std::string;
-        *ptr = x;
+        // x is already our own copy, so take its contents rather than copying again
+        ptr->swap(x);
         data = (void *)ptr;
     }
 
     TagValue::TagValue(FCam::Time x) {
         type = Time;
-        FCam::Time *ptr = new FCam::Time;
-        *ptr = x;
-        data = (void *)ptr;
+        data = (void *)new (storage.bytes) FCam::Time(x);
     }
 
     TagValue::TagValue(std::vector<int> x) {
         type = IntVector;
         std::vector<int> *ptr = new std::vector<int>;
-        *ptr = x;
+        ptr->swap(x);
         data = (void *)ptr;
     }
 
     TagValue::TagValue(std::vector<float> x) {
         type = FloatVector;
         std::vector<float> *ptr = new std::vector<float>;
-        *ptr = x;
+        ptr->swap(x);
         data = (void *)ptr;
     }
 
     TagValue::TagValue(std::vector<double> x) {
         type = DoubleVector;
         std::vector<double> *ptr = new std::vector<double>;
-        *ptr = x;
+        ptr->swap(x);
         data = (void *)ptr;
     }
 
     TagValue::TagValue(std::vector<std::string> x) {
         type = StringVector;
         std::vector<std::string> *ptr = new std::vector<std::string>;
-        *ptr = x;
+        ptr->swap(x);
         data = (void *)ptr;
     }
 
     TagValue::TagValue(std::vector<FCam::Time> x) {
         type = TimeVector;
         std::vector<FCam::Time> *ptr = new std::vector<FCam::Time>;
-        *ptr = x;
+        ptr->swap(x);
         data = (void *)ptr;
     }
 
     const TagValue &TagValue::operator=(const int &x) {
-        if (type == Int) {
-            ((int *)data)[0] = x;
-        } else {
+        if (type != Int) {
             nullify();
             type = Int;
-            int *ptr = new int;
-            ptr[0] = x;
-            data = (void *)ptr;
+            data = (void *)storage.bytes;
         }
+        ((int *)data)[0] = x;
         return *this;
     }
 
     const TagValue &TagValue::operator=(const float &x) {
-        if (type == Float) {
-            ((float *)data)[0] = x;
-        } else {
+        if (type != Float) {
             nullify();
             type = Float;
-            float *ptr = new float;
-            ptr[0] = x;
-            data = (void *)ptr;
+            data = (void *)storage.bytes;
         }
+        ((float *)data)[0] = x;
         return *this;
     }
 
     const TagValue &TagValue::operator=(const double &x) {
-        if (type == Double) {
-            ((double *)data)[0] = x;
-        } else {
+        if (type != Double) {
             nullify();
             type = Double;
-            double *ptr = new double;
-            ptr[0] = x;
-            data = (void *)ptr;
+            data = (void *)storage.bytes;
         }
+        ((double *)data)[0] = x;
         return *this;
     }
 
@@ -167,36 +163,35 @@ namespace FCam {
         if (type == String) {
             ((std::string *)data)[0] = x;
         } else {
+            std::string *ptr = new std::string(x);
             nullify();
             type = String;
-            std::string *ptr = new std::string;
-            ptr[0] = x;
             data = (void *)ptr;
         }
         return *this;
     }
 
     const TagValue &TagValue::operator=(const FCam::Time &x) {
-        if (type == Time) {
-            ((FCam::Time *)data)[0] = x;
-        } else {
+        if (type != Time) {
             nullify();
             type = Time;
-            FCam::Time *ptr = new FCam::Time;
-            ptr[0] = x;
-            data = (void *)ptr;
+            data = (void *)new (storage.bytes) FCam::Time;
         }
+        ((FCam::Time *)data)[0] = x;
         return *this;
     }
 
+    // The vector assignments construct the new vector before
+    // releasing the old value, so that assigning a TagValue from a
+    // reference into itself is safe.
+
     const TagValue &TagValue::operator=(const std::vector<int> &x) {
         if (type == IntVector) {
             ((std::vector<int> *)data)[0] = x;
         } else {
+            std::vector<int> *ptr = new std::vector<int>(x);
             nullify();
             type = IntVector;
-            std::vector<int> *ptr = new std::vector<int>;
-            ptr[0] = x;
             data = (void *)ptr;
         }
         return *this;
@@ -206,10 +201,9 @@ namespace FCam {
         if (type == FloatVector) {
             ((std::vector<float> *)data)[0] = x;
         } else {
+            std::vector<float> *ptr = new std::vector<float>(x);
             nullify();
             type = FloatVector;
-            std::vector<float> *ptr = new std::vector<float>;
-            ptr[0] = x;
             data = (void *)ptr;
         }
         return *this;
@@ -219,10 +213,9 @@ namespace FCam {
         if (type == DoubleVector) {
             ((std::vector<double> *)data)[0] = x;
         } else {
+            std::vector<double> *ptr = new std::vector<double>(x);
             nullify();
             type = DoubleVector;
-            std::vector<double> *ptr = new std::vector<double>;
-            ptr[0] = x;
             data = (void *)ptr;
         }
         return *this;
@@ -232,10 +225,9 @@ namespace FCam {
         if (type == StringVector) {
             ((std::vector<std::string> *)data)[0] = x;
         } else {
+            std::vector<std::string> *ptr = new std::vector<std::string>(x);
             nullify();
             type = StringVector;
-            std::vector<std::string> *ptr = new std::vector<std::string>;
-            ptr[0] = x;
             data = (void *)ptr;
         }
         return *this;
@@ -245,60 +237,41 @@ namespace FCam {
         if (type == TimeVector) {
             ((std::vector<FCam::Time> *)data)[0] = x;
         } else {
+            std::vector<FCam::Time> *ptr = new std::vector<FCam::Time>(x);
             nullify();
             type = TimeVector;
-            std::vector<FCam::Time> *ptr = new std::vector<FCam::Time>;
-            ptr[0] = x;
             data = (void *)ptr;
         }
         return *this;
     }
 
     const TagValue &TagValue::operator=(const TagValue &other) {
+        // Copy straight from the other tag's storage; no intermediate
+        // temporaries are needed.
         switch(other.type) {
         case Null:
             nullify();
             return *this;
         case Int:
-            *this = (int)other;
-            return *this;
+            return (*this = *(const int *)other.data);
         case Float:
-            *this = (float)other;
-            return *this;
+            return (*this = *(const float *)other.data);
         case Double:
-            *this = (double)other;
-            return *this;
+            return (*this = *(const double *)other.data);
         case String:
-            *this = (std::string)other;
-            return *this;
+            return (*this = *(const std::string *)other.data);
         case Time:
-            *this = (FCam::Time)other;
-            return *this;
-        case IntVector: {
-            std::vector<int> temp = other;
-            *this = temp;
-            return *this;
-        }
-        case FloatVector: {
-            std::vector<float> temp = other;
-            *this = temp;
-            return *this;
-        }
-        case DoubleVector: {
-            std::vector<double> temp = other;
-            *this = temp;
-            return *this;
-        }
-        case StringVector: {
-            std::vector<std::string> temp = other;
-            *this = temp;
-            return *this;
-        }
-        case TimeVector: {
-            std::vector<FCam::Time> temp = other;
-            *this = temp;
-            return *this;
-        }
+            return (*this = *(const FCam::Time *)other.data);
+        case IntVector:
+            return (*this = *(const std::vector<int> *)other.data);
+        case FloatVector:
+            return (*this = *(const std::vector<float> *)other.data);
+        case DoubleVector:
+            return (*this = *(const std::vector<double> *)other.data);
+        case StringVector:
+            return (*this = *(const std::vector<std::string> *)other.data);
+        case TimeVector:
+            return (*this = *(const std::vector<FCam::Time> *)other.data);
         }
         return *this;
     }
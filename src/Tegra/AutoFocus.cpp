@@ -63,12 +63,12 @@ namespace FCam { namespace Tegra {
         {}
 
     void AutoFocus::startSweep() {
-      // Left empty intentionally.
+        FCam::AutoFocus::startSweep();
     }
 
 
     void AutoFocus::update(const Frame &f, FCam::Shot *shot) {
-      // Left empty intentionally.
+        FCam::AutoFocus::update(f, shot);
     }
 
 }}
@@ -50,19 +50,38 @@
 * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include <math.h>
+#include <stdlib.h>
 #include <errno.h>
 
 #include "FCam/Time.h"
 #include "FCam/Frame.h"
 #include "FCam/Action.h"
 #include "FCam/Tegra/YUV420.h"
+#include "FCam/Counters.h"
 
 #include "../Debug.h"
 #include "Daemon.h"
+#include "FramePool.h"
 #include "Statistics.h"
 
 namespace FCam { namespace Tegra {
 
+    // How many frames the adaptive drop policy looks at before
+    // changing course, and how far it will thin out a stream
+    static const int adaptWindow = 16;
+    static const int maxDecimation = 8;
+
+    static Counter framesDropped("sensor.frames_dropped");
+    static Counter bubblesCaptured("sensor.bubbles_captured");
+    static Distribution frameQueueDepth("sensor.frame_queue_depth");
+    static Distribution requestQueueDepth("sensor.request_queue_depth");
+    static Distribution statisticsTime("sensor.statistics_us");
+
+    // The driver takes gains as ISO, where 100 is unity gain
+    static int isoForGain(float gain) {
+        return (int)(gain * 100 + 0.5f);
+    }
+
     void *daemon_setter_thread_(void *arg) {
         Daemon *d = (Daemon *)arg;
         d->runSetter();    
@@ -86,9 +105,19 @@ namespace FCam { namespace Tegra {
         stop(false), 
         frameLimit(128),
         dropPolicy(Sensor::DropNewest),
+        pulledCount(0),
+        windowPulled(0),
+        windowPushed(0),
+        sheddingStatistics(false),
+        skipNextStatistics(false),
+        decimation(1),
+        streamedRequests(0),
         setterRunning(false),
-        exposureLatency(0),
-        gainLatency(0),
+        exposureModel(1 + sensor->exposureLatency()),
+        gainModel(1 + sensor->gainLatency()),
+        whiteBalanceModel(1),
+        captureCount(0),
+        bubblesPending(0),
         actionRunning(false),
         threadsLaunched(false) {
 
@@ -172,9 +201,10 @@ namespace FCam { namespace Tegra {
         sem_destroy(&readySemaphore);
 
         // Clean up all the internal queues
-        while (inFlightQueue.size()) delete inFlightQueue.pull();        
-        while (requestQueue.size()) delete requestQueue.pull();
-        while (frameQueue.size()) delete frameQueue.pull();
+        FramePool &pool = FramePool::instance();
+        while (inFlightQueue.size()) pool.release(inFlightQueue.pull());        
+        while (requestQueue.size()) pool.release(requestQueue.pull());
+        while (frameQueue.size()) pool.release(frameQueue.pull());
         while (actionQueue.size()) {
             delete actionQueue.top().action;
             actionQueue.pop();
@@ -196,15 +226,19 @@ namespace FCam { namespace Tegra {
                    "You're not draining the frame queue quickly enough. Use longer \n"
                    "frame times or drain the frame queue until empty every time you \n"
                    "call getFrame()\n", frameLimit, frameQueue.size() - frameLimit);
-            if (dropPolicy == Sensor::DropOldest) {
+            if (dropPolicy == Sensor::DropOldest || dropPolicy == Sensor::DropAdaptive) {
                 while (frameQueue.size() >= frameLimit) {
                     sensor->decShotsPending();
-                    delete frameQueue.pull();
+                    FramePool::instance().release(frameQueue.pull());
+                    counters.framesDropped++;
+                    framesDropped.add();
                 }
             } else if (dropPolicy == Sensor::DropNewest) {
                 while (frameQueue.size() >= frameLimit) {
                     sensor->decShotsPending();
-                    delete frameQueue.pullBack();
+                    FramePool::instance().release(frameQueue.pullBack());
+                    counters.framesDropped++;
+                    framesDropped.add();
                 }
             } else {
                 error(Event::InternalError, sensor, 
@@ -213,6 +247,41 @@ namespace FCam { namespace Tegra {
         }
     }
 
+    void Daemon::adaptToConsumer() {
+        if (++windowPushed < adaptWindow) return;
+
+        int pulledNow = pulledCount;
+        int pulled = pulledNow - windowPulled;
+        int pushed = windowPushed;
+        windowPulled = pulledNow;
+        windowPushed = 0;
+
+        size_t backlog = frameQueue.size();
+        if (pulled < pushed && backlog > 1) {
+            // The consumer is falling behind
+            if (!sheddingStatistics) {
+                sheddingStatistics = true;
+                dprintf(DBG_MINOR, "Consumer took %d of %d frames, skipping statistics\n", pulled, pushed);
+            } else if (decimation < maxDecimation) {
+                // Thin the stream out to the rate the consumer managed
+                int target = pulled > 0 ? (decimation * pushed + pulled - 1) / pulled : maxDecimation;
+                if (target <= decimation) target = decimation + 1;
+                if (target > maxDecimation) target = maxDecimation;
+                decimation = target;
+                dprintf(DBG_MINOR, "Consumer took %d of %d frames, capturing 1 in %d streaming requests\n",
+                        pulled, pushed, decimation);
+            }
+        } else if (pulled >= pushed && backlog <= 1) {
+            // The consumer is keeping up; see if it can take more
+            if (decimation > 1) {
+                decimation--;
+            } else if (sheddingStatistics) {
+                sheddingStatistics = false;
+                dprintf(DBG_MINOR, "Consumer caught up, computing all statistics again\n");
+            }
+        }
+    }
+
     void Daemon::runSetter() {
         dprintf(2, "Running setter...\n"); fflush(stdout);
 
@@ -287,6 +356,20 @@ namespace FCam { namespace Tegra {
             dprintf(4, "Inserting bubble - empty queue: 0x%x\n", req);
         }
 
+        // If the consumer can't keep up with the stream, only capture
+        // some of the streaming requests, and bubbles in place of the
+        // rest.
+        if (req->streamed && dropPolicy == Sensor::DropAdaptive &&
+            decimation > 1 && streamedRequests++ % decimation) {
+            _Frame *skipped = req;
+            requestQueue.pop();
+            req = insertBubble(skipped);
+            FramePool::instance().release(skipped);
+            sensor->decShotsPending();
+            counters.requestsThrottled++;
+            dprintf(4, "Throttling streaming request, capturing bubble 0x%x instead\n", req);
+        }
+
         // Check if the next request requires a mode switch
         if (req->shot().image.size() != current._shot.image.size() ||
             req->shot().image.type() != current._shot.image.type()) {
@@ -342,22 +425,44 @@ namespace FCam { namespace Tegra {
             current._shot.gain = -1.0;
             current._shot.whiteBalance = -1;
             current.image = Image(m.width, m.height, req->shot().image.type(), Image::Discard);
+            exposureModel.invalidate();
+            gainModel.invalidate();
+            whiteBalanceModel.invalidate();
 
         } else {
             // no mode switch required            
         }
 
-        // If current exposure != req exposure
-        // replace the current request with a bubble. The exposure
-        // setting is applied after the capture is done. The bubble
-        // will ensure the correct order of operations.
-        // Same for wb - wb settings are changed after the capture.
-        if (req->shot().exposure != current.shot().exposure || 
-            fabs(req->shot().gain - current.shot().gain) > 0.01 ||
-            req->shot().whiteBalance != current.shot().whiteBalance)
-        {
+        // Will this request be taken with the settings it asks for?
+        // Settings with no latency are programmed in time for this
+        // capture below, so they always will be.
+        int expectedExposure = exposureModel.predicted(captureCount);
+        int expectedGain = gainModel.predicted(captureCount);
+        int expectedWhiteBalance = whiteBalanceModel.predicted(captureCount);
+        bool exposureMatches = expectedExposure == req->shot().exposure || !exposureModel.latency();
+        bool gainMatches = abs(expectedGain - isoForGain(req->shot().gain)) <= 1 || !gainModel.latency();
+        bool whiteBalanceMatches = expectedWhiteBalance == req->shot().whiteBalance || !whiteBalanceModel.latency();
+
+        // If not, and it isn't in fast mode, capture bubbles in its
+        // place until the settings programmed for it now take
+        // effect. Everything programmed ahead assumed the request would
+        // go now, so keep the bubbles going until then even if some
+        // other setting happens to match sooner.
+        if (bubblesPending > 0) {
+            if (req->shot().wanted) {
+                req = insertBubble(req);
+                dprintf(4, "Inserting bubble 0x%x while settings take effect\n", req);
+            }
+            bubblesPending--;
+        } else if (req->shot().wanted && !req->shot().fastMode &&
+                   !(exposureMatches && gainMatches && whiteBalanceMatches)) {
+            int latency = exposureModel.latency();
+            if (gainModel.latency() > latency) latency = gainModel.latency();
+            if (whiteBalanceModel.latency() > latency) latency = whiteBalanceModel.latency();
+
             // Insert a dummy request
             req = insertBubble(req);
+            bubblesPending = latency - 1;
             dprintf(DBG_MAJOR, "Inserting bubble 0x%x to satisfy exposure change\n", req);
         }
 
@@ -371,84 +476,41 @@ namespace FCam { namespace Tegra {
         // Save the img informaton with the request.
         req->image = current.image;
 
-        // Look ahead to the next frame, does it require a 
-        // different exposure/gain?
-        if (!requestQueue.size()) {
-            sensor->generateRequest();
+        // Tag this frame with the expected gain and exposure values.
+        // The handler replaces them with the ones the driver reports.
+        req->captureIndex = captureCount;
+        req->exposure = expectedExposure;
+        req->gain     = expectedGain < 0 ? -1.0f : expectedGain / 100.0f;
+        req->whiteBalance = expectedWhiteBalance;
+        req->fastMode   = req->_shot.fastMode;
+        req->confidence = Frame::MATCH_REQUEST;
+        if (!gainMatches) req->confidence |= Frame::UNCERTAIN_GAIN;
+        if (!exposureMatches) req->confidence |= Frame::UNCERTAIN_EXPOSURETIME;
+
+        // The camera driver applies new settings after the capture is
+        // done, and the sensor may take a few more frames on top. So
+        // program each setting now for the request that many captures
+        // down the queue.
+        _Frame *target = requestAhead(req, exposureModel.latency());
+        if (target && target->shot().exposure != current._shot.exposure) {
+            m_pCameraInterface->setSensorExposure(target->shot().exposure);
+            current._shot.exposure = target->shot().exposure;
         }
+        exposureModel.programmed(captureCount, current._shot.exposure);
 
-        // Tag this frame with the expected gain and exposure values
-        // before changing current.
-        req->exposure = current._shot.exposure;
-        req->gain     = current._shot.gain;
-        req->whiteBalance = current._shot.whiteBalance;
-
-        if (requestQueue.size() > 0)
-        {
-            _Frame *nextreq = requestQueue.front();
-
-            // Setup settings for next frame
-            // The camera driver sets settings after the capture is done.
-            // So we look ahead and send now the settings for the next
-            // frame.
-            // Also track the gain and exposure latencies in case
-            // the request is fastMode - so we can accurately
-            // set the confidence field.
-            if (nextreq->shot().exposure != current.shot().exposure ||
-                fabs(nextreq->shot().gain - current.shot().gain) > 0.01)
-            {
-
-                if (current._shot.exposure != nextreq->shot().exposure) {
-                    m_pCameraInterface->setSensorExposure(nextreq->shot().exposure);
-                    current._shot.exposure = nextreq->shot().exposure;
-                    exposureLatency = sensor->exposureLatency();
-                }
-        
-                if (current._shot.gain != nextreq->shot().gain) {
-                    m_pCameraInterface->setSensorEffectiveISO(nextreq->shot().gain * 100);
-                    current._shot.gain = nextreq->shot().gain;
-                    gainLatency = sensor->gainLatency();
-                }
-            }
-            else
-            {
-                // No gain or exposure changes, then decrement the latencies
-                if (gainLatency > 0) gainLatency--;
-                if (exposureLatency > 0) exposureLatency--;
-            }
-
-            // Same for whitebalance, set it ahead of the next frame.
-            if (current._shot.whiteBalance != nextreq->shot().whiteBalance) {
-                m_pCameraInterface->setISPWhiteBalance(nextreq->shot().whiteBalance);
-                current._shot.whiteBalance = nextreq->shot().whiteBalance;
-            }
-
-            nextreq->fastMode   = nextreq->_shot.fastMode;
-            nextreq->confidence = Frame::MATCH_REQUEST;
-
-            // Not a fastMode request? - insert the necessary bubles.
-            if (!nextreq->fastMode) {
-                int latency = gainLatency > exposureLatency ? gainLatency : exposureLatency;
-
-                while (latency > 0)
-                {
-                    insertBubble(nextreq);
-                    dprintf(DBG_MAJOR, "Inserting an exposure/gain latency bubble 0x%x\n", req);
-                    latency--;
-                }
-
-                // We don't need to insert the bubbles again unless a new change comes in
-                // reset gain and exposure latency to 0
-                gainLatency = 0;
-                exposureLatency = 0;
-
-            } else {
-
-                if (gainLatency > 0) nextreq->confidence |= Frame::UNCERTAIN_GAIN;
-                if (exposureLatency > 0) nextreq->confidence |= Frame::UNCERTAIN_EXPOSURETIME;
-            }
+        target = requestAhead(req, gainModel.latency());
+        if (target && isoForGain(target->shot().gain) != isoForGain(current._shot.gain)) {
+            m_pCameraInterface->setSensorEffectiveISO(isoForGain(target->shot().gain));
+            current._shot.gain = target->shot().gain;
+        }
+        gainModel.programmed(captureCount, current._shot.gain < 0 ? -1 : isoForGain(current._shot.gain));
 
+        target = requestAhead(req, whiteBalanceModel.latency());
+        if (target && target->shot().whiteBalance != current._shot.whiteBalance) {
+            m_pCameraInterface->setISPWhiteBalance(target->shot().whiteBalance);
+            current._shot.whiteBalance = target->shot().whiteBalance;
         }
+        whiteBalanceModel.programmed(captureCount, current._shot.whiteBalance);
 
 
         // Update the frameTime
@@ -519,13 +581,34 @@ namespace FCam { namespace Tegra {
         // in-flight queue for the handler to deal with.
         dprintf(4, "Setter: pushing request 0x%x\n", req);
         inFlightQueue.push(req);
+        captureCount++;
 
         dprintf(4, "Setter: Done with this HS_VS, waiting for the next one\n");
     }
 
+    _Frame *Daemon::requestAhead(_Frame *req, int captures) {
+        if (captures == 0) return req;
+
+        // The front of the queue goes after the bubbles still pending.
+        // If the capture asked about is one of those bubbles, keep
+        // heading for the front request.
+        size_t index = 0;
+        if (captures - 1 > bubblesPending) index = captures - 1 - bubblesPending;
+
+        while (requestQueue.size() <= index) {
+            size_t queued = requestQueue.size();
+            sensor->generateRequest();
+            if (requestQueue.size() == queued) break;
+        }
+
+        if (requestQueue.empty()) return NULL;
+        if (requestQueue.size() <= index) return requestQueue.back();
+        return *(requestQueue.begin() + index);
+    }
+
     _Frame* Daemon::insertBubble(_Frame *params) {
 
-        _Frame *req = new _Frame;
+        _Frame *req = FramePool::instance().acquire();
 
         if (params == NULL) 
         {
@@ -574,6 +657,11 @@ namespace FCam { namespace Tegra {
         req->exposure = f->params.exposure;
         req->frameTime = f->params.frameTime;
 
+        // Learn how long the settings took to take effect
+        exposureModel.observed(req->captureIndex, f->params.exposure);
+        gainModel.observed(req->captureIndex, f->params.iso);
+        whiteBalanceModel.observed(req->captureIndex, f->params.wb);
+
         // Based on the end time for this frame, predict the start time.
         req->processingDoneTime = f->params.processingDoneTime;
         req->exposureEndTime    = f->params.captureDoneTime; // This could actually include ISP time, need to verify.
@@ -596,13 +684,16 @@ namespace FCam { namespace Tegra {
                   "Expected image data not returned.");
             req->image = Image(req->image.size(), req->image.type(), Image::Discard);
             if (!req->shot().wanted) {
-                delete req;
+                FramePool::instance().release(req);
             } else {
                 // the histogram and sharpness map may still have appeared
                 // req->histogram = m_pCameraInterface->getHistogram(req->exposureEndTime, req->shot().histogram);
                 // req->sharpness = m_pCameraInterface->getSharpnessMap(req->exposureEndTime, req->shot().sharpness);
                 frameQueue.push(req);
+                frameQueueDepth.record(frameQueue.size());
+                requestQueueDepth.record(requestQueue.size());
                 enforceDropPolicy();
+                if (dropPolicy == Sensor::DropAdaptive) adaptToConsumer();
             }
             req = NULL;
         } else if (true) {
@@ -613,19 +704,36 @@ namespace FCam { namespace Tegra {
             if (!req->shot().wanted) {
                 // it's a bubble - drop it
                 dprintf(4, "Handler: discarding a bubble 0x%x\n", req);
-                delete req;
+                bubblesCaptured.add();
+                FramePool::instance().release(req);
             } else {
 
-                // CPU computed sharpness/statistics
-                if (req->_shot.sharpness.enabled) {
-                    req->sharpness = Statistics::evaluateSharpness(req->_shot.sharpness, im);
+                // CPU computed sharpness/statistics. Skipped on every
+                // other streamed frame while the consumer is behind.
+                bool skipStatistics = false;
+                if (req->streamed && dropPolicy == Sensor::DropAdaptive && sheddingStatistics &&
+                    (req->_shot.sharpness.enabled || req->_shot.histogram.enabled)) {
+                    skipStatistics = skipNextStatistics;
+                    skipNextStatistics = !skipNextStatistics;
+                    if (skipStatistics) counters.statisticsSkipped++;
                 }
-                if (req->_shot.histogram.enabled) {
-                    req->histogram = Statistics::evaluateHistogram(req->_shot.histogram, im);
+                if ((req->_shot.sharpness.enabled || req->_shot.histogram.enabled) && !skipStatistics) {
+                    ScopedTimer timer(statisticsTime);
+                    if (req->_shot.sharpness.enabled) {
+                        req->sharpness = Statistics::evaluateSharpness(req->_shot.sharpness, im);
+                    }
+                    if (req->_shot.histogram.enabled) {
+                        std::vector<int> regionSums;
+                        req->histogram = Statistics::evaluateHistogram(req->_shot.histogram, im, &regionSums);
+                        req->tags["stats.regionYUV"] = regionSums;
+                    }
                 }
 
                 if (req->shot().image.autoAllocate()) {
-                    if (req->image.type() == req->shot().image.type() && im.weak()) {
+                    if (req->shot().image.type() == YV12 && im.type() == YUV420p) {
+                        req->image = Image(req->image.size(), YV12);
+                        copyYUV420ToYV12(req->image, im);
+                    } else if (req->image.type() == req->shot().image.type() && im.weak()) {
                         req->image = im.copy();
                     } else if(req->image.type() == req->shot().image.type() && !im.weak()) {
                         req->image = im;
@@ -668,6 +776,10 @@ namespace FCam { namespace Tegra {
                         if (req->image.lock(10000)) {
                             if (req->shot().image.type() == RGB24 && srcType == YUV420p) {
                                 convertYUV420ToRGB24( req->image, im);
+                            } else if (req->shot().image.type() == YV12 && im.type() == YUV420p) {
+                                // Straight into the target, e.g. a display buffer,
+                                // with the chroma planes in the order it wants
+                                copyYUV420ToYV12(req->image, im);
                             } else if (im.weak()) {
                                 req->image.copyFrom(im);
                             } else {
@@ -684,7 +796,10 @@ namespace FCam { namespace Tegra {
                 }
 
                 frameQueue.push(req);
+                frameQueueDepth.record(frameQueue.size());
+                requestQueueDepth.record(requestQueue.size());
                 enforceDropPolicy();
+                if (dropPolicy == Sensor::DropAdaptive) adaptToConsumer();
 
             }
 
@@ -9,6 +9,7 @@
 #include "FCam/Tegra/Sensor.h"
 #include "FCam/TSQueue.h"
 #include "FCam/Tegra/Frame.h"
+#include "LatencyModel.h"
 
 namespace FCam { namespace Tegra {
 
@@ -54,6 +55,13 @@ namespace FCam { namespace Tegra {
 
         void launchThreads();
 
+        // The sensor calls this when it takes frames off the frame
+        // queue, so the adaptive drop policy can tell how fast the
+        // consumer is
+        void framesPulled(int count = 1) {__sync_fetch_and_add(&pulledCount, count);}
+
+        DropCounters dropCounters() const {return counters;}
+
         void onFrame(Hal::CameraFrame* frame);
         void readyToCapture();
 
@@ -74,6 +82,19 @@ namespace FCam { namespace Tegra {
         Sensor::DropPolicy dropPolicy;
         void enforceDropPolicy();   
 
+        // The adaptive drop policy's state. Every adaptWindow frames
+        // pushed to the frame queue it compares that with the frames
+        // pulled off it (pulledCount, updated by the consumer), and
+        // sheds or restores one level of work: skipping the statistics
+        // on every other streamed frame, then capturing only one of
+        // every so many streaming requests (decimation).
+        void adaptToConsumer();
+        volatile int pulledCount;
+        int windowPulled, windowPushed;
+        bool sheddingStatistics, skipNextStatistics;
+        int decimation, streamedRequests;
+        DropCounters counters;
+
         // The setter thread puts in flight requests on this queue, which
         // is consumed by the handler thread
         TSQueue<_Frame *> inFlightQueue;
@@ -91,6 +112,13 @@ namespace FCam { namespace Tegra {
         void runSetter();   
         _Frame *insertBubble(_Frame *params = NULL);
 
+        // The request to be captured the given number of captures
+        // after req, which is about to be captured, allowing for any
+        // bubbles pending. Generates more streaming requests if the
+        // request queue isn't that long. Falls back to the last
+        // request queued, or NULL if none are.
+        _Frame *requestAhead(_Frame *req, int captures);
+
         pthread_t setterThread;
         void tickSetter(Time hs_vs);
         bool setterRunning;
@@ -99,9 +127,22 @@ namespace FCam { namespace Tegra {
         _Frame current;
         Shot lastGoodShot;
 
-        // Some counters to keep track of exposure latency/gain latency.
-        unsigned int exposureLatency;
-        unsigned int gainLatency;
+        // How many captures after being programmed the exposure, gain
+        // (as ISO) and white balance take effect, learned from the
+        // values the driver reports with each frame. Each one is
+        // programmed that many requests ahead, so that a stream whose
+        // settings change every frame, like an exposure bracket, needs
+        // no bubbles.
+        LatencyModel exposureModel;
+        LatencyModel gainModel;
+        LatencyModel whiteBalanceModel;
+
+        // The number of captures triggered so far
+        unsigned int captureCount;
+
+        // Bubbles still to capture before the request at the front of
+        // the queue, while the settings programmed for it take effect
+        int bubblesPending;
 
         // The component that executes RT actions
         void runAction();
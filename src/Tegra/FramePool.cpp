@@ -0,0 +1,118 @@
+/* Copyright (c) 1995-2010, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* Copyright (c) 2011, NVIDIA CORPORATION. All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*  * Neither the name of NVIDIA CORPORATION nor the names of its
+*    contributors may be used to endorse or promote products derived 
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+* OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "FramePool.h"
+
+namespace FCam { namespace Tegra {
+
+    static void releaseToPool(FCam::_Frame *f) {
+        FramePool::instance().release(static_cast<_Frame *>(f));
+    }
+
+    FramePool &FramePool::instance() {
+        // Deliberately never destroyed, so that frames held in static
+        // objects can still be released during exit.
+        static FramePool *pool = new FramePool;
+        return *pool;
+    }
+
+    FramePool::FramePool() {
+        pthread_mutex_init(&mutex, NULL);
+        idle.reserve(MaxIdle);
+    }
+
+    _Frame *FramePool::acquire() {
+        _Frame *f = NULL;
+        pthread_mutex_lock(&mutex);
+        if (idle.size()) {
+            f = idle.back();
+            idle.pop_back();
+        }
+        pthread_mutex_unlock(&mutex);
+        if (!f) f = new _Frame;
+        return f;
+    }
+
+    void FramePool::release(_Frame *f) {
+        if (!f) return;
+
+        // Let go of everything this frame refers to before it sits
+        // idle. Clearing the tags keeps the map's buckets around.
+        f->image = Image();
+        f->exposureStartTime = Time();
+        f->exposureEndTime = Time();
+        f->processingDoneTime = Time();
+        f->exposure = 0;
+        f->frameTime = 0;
+        f->gain = 0.0f;
+        f->whiteBalance = 5000;
+        f->histogram = Histogram();
+        f->sharpness = SharpnessMap();
+        f->tags.clear();
+        f->_shot = blank;
+        f->fastMode = false;
+        f->confidence = 0;
+        f->streamed = false;
+
+        pthread_mutex_lock(&mutex);
+        if (idle.size() < MaxIdle) {
+            idle.push_back(f);
+            f = NULL;
+        }
+        pthread_mutex_unlock(&mutex);
+        delete f;
+    }
+
+    shared_ptr<FCam::_Frame> FramePool::wrap(_Frame *f) {
+        return shared_ptr<FCam::_Frame>(f, releaseToPool);
+    }
+
+}}
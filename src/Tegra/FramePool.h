@@ -0,0 +1,47 @@
+#ifndef FCAM_TEGRA_FRAMEPOOL_H
+#define FCAM_TEGRA_FRAMEPOOL_H
+
+#include <vector>
+#include <pthread.h>
+
+#include "FCam/Tegra/Frame.h"
+
+namespace FCam { namespace Tegra {
+
+    // A free list of frame requests, so that capturing and streaming
+    // don't need to allocate and free a _Frame for every frame. It is
+    // shared by all sensors, and outlives them, since the frames
+    // handed out to user code may be released at any time.
+    class FramePool {
+    public:
+        static FramePool &instance();
+
+        // Get a frame request in its default state. Only allocates
+        // if the pool is empty.
+        _Frame *acquire();
+
+        // Reset a frame request and return it to the pool. Drops any
+        // image data, statistics and tags it refers to.
+        void release(_Frame *f);
+
+        // Wrap a frame request for handing out to user code. It is
+        // returned to the pool when the last reference goes away.
+        shared_ptr<FCam::_Frame> wrap(_Frame *f);
+
+    private:
+        FramePool();
+
+        // How many idle frames to hang on to. Any beyond this (after
+        // a long burst) are freed.
+        enum {MaxIdle = 32};
+
+        std::vector<_Frame *> idle;
+        pthread_mutex_t mutex;
+
+        // A default shot to reset requests with
+        Shot blank;
+    };
+
+}}
+
+#endif
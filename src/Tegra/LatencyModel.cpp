@@ -0,0 +1,169 @@
+/* Copyright (c) 1995-2010, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* Copyright (c) 2011, NVIDIA CORPORATION. All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*  * Neither the name of NVIDIA CORPORATION nor the names of its
+*    contributors may be used to endorse or promote products derived 
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+* OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+
+#include "LatencyModel.h"
+#include "../Debug.h"
+
+namespace FCam { namespace Tegra {
+
+    // How many frames that tell the candidate latencies apart are
+    // needed before the estimate is trusted over the nominal one
+    static const int minInformative = 4;
+
+    LatencyModel::LatencyModel(int initialLatency) :
+        lastCapture(0),
+        started(false),
+        informative(0),
+        latency_(initialLatency) {
+        if (latency_ < 0) latency_ = 0;
+        if (latency_ > MaxLatency) latency_ = MaxLatency;
+        for (int i = 0; i < History; i++) value[i] = -1;
+        for (int d = 0; d <= MaxLatency; d++) score[d] = 0;
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    LatencyModel::~LatencyModel() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void LatencyModel::programmed(unsigned capture, int v) {
+        pthread_mutex_lock(&mutex);
+        if (started) {
+            int gap = capture - lastCapture;
+            if (gap < 0 || gap > History) {
+                for (int i = 0; i < History; i++) value[i] = -1;
+            } else {
+                // Any captures in between kept the previous value
+                for (int i = 1; i < gap; i++) {
+                    value[(lastCapture + i) % History] = value[lastCapture % History];
+                }
+            }
+        }
+        started = true;
+        lastCapture = capture;
+        value[capture % History] = v;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void LatencyModel::invalidate() {
+        pthread_mutex_lock(&mutex);
+        for (int i = 0; i < History; i++) value[i] = -1;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    int LatencyModel::valueAt(unsigned capture) const {
+        if (!started) return -1;
+        int age = lastCapture - capture;
+        if (age < 0) {
+            // Not programmed yet, so the register still holds the last value
+            return value[lastCapture % History];
+        }
+        if (age >= History) return -1;
+        return value[capture % History];
+    }
+
+    int LatencyModel::predicted(unsigned capture) {
+        pthread_mutex_lock(&mutex);
+        int v = valueAt(capture - latency_);
+        pthread_mutex_unlock(&mutex);
+        return v;
+    }
+
+    void LatencyModel::observed(unsigned capture, int v) {
+        if (v < 0) return;
+
+        pthread_mutex_lock(&mutex);
+
+        // What the frame would have been taken with for each candidate latency
+        int candidate[MaxLatency + 1];
+        int best = -1, first = -1;
+        bool differ = false;
+        for (int d = 0; d <= MaxLatency; d++) {
+            candidate[d] = valueAt(capture - d);
+            if (candidate[d] < 0) continue;
+            if (first < 0) first = candidate[d];
+            else if (candidate[d] != first) differ = true;
+            int err = abs(candidate[d] - v);
+            if (best < 0 || err < best) best = err;
+        }
+
+        // Only frames whose candidates disagree say anything about the
+        // latency. Values the driver reports can be rounded (exposure to
+        // whole rows, for instance), but not by more than this.
+        if (!differ || best > v / 10 + 1) {
+            pthread_mutex_unlock(&mutex);
+            return;
+        }
+
+        for (int d = 0; d <= MaxLatency; d++) {
+            score[d] -= score[d] >> 3;
+            if (candidate[d] >= 0 && abs(candidate[d] - v) == best) score[d] += 256;
+        }
+        if (informative < minInformative) informative++;
+
+        if (informative >= minInformative) {
+            int estimate = latency_;
+            for (int d = 0; d <= MaxLatency; d++) {
+                if (score[d] > score[estimate]) estimate = d;
+            }
+            if (estimate != latency_) {
+                dprintf(DBG_MINOR, "LatencyModel: latency changed from %d to %d captures\n",
+                        latency_, estimate);
+                latency_ = estimate;
+            }
+        }
+
+        pthread_mutex_unlock(&mutex);
+    }
+
+}}
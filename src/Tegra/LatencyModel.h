@@ -0,0 +1,73 @@
+#ifndef FCAM_TEGRA_LATENCYMODEL_H
+#define FCAM_TEGRA_LATENCYMODEL_H
+
+#include <pthread.h>
+
+namespace FCam { namespace Tegra {
+
+    // Tracks how many captures after it is programmed a sensor
+    // setting (exposure, gain, white balance) takes effect, and what
+    // value each capture will therefore be taken with.
+    //
+    // Captures are numbered in the order they are triggered. The
+    // setter reports the value in the sensor's register at each
+    // capture, and the handler reports the value the driver says each
+    // frame was actually taken with. A value programmed for capture k
+    // with a latency of L is in effect for capture k + L. The latency
+    // starts out at the sensor's nominal figure, and is replaced by
+    // the one that best explains the frames seen so far once enough
+    // frames have told the candidates apart.
+    class LatencyModel {
+    public:
+        // The latency to assume until enough frames have been seen
+        LatencyModel(int initialLatency = 1);
+        ~LatencyModel();
+
+        // The setter is about to trigger the given capture with value
+        // in the register. Values of -1 mean unknown.
+        void programmed(unsigned capture, int value);
+
+        // Forget every value programmed so far, e.g. after a mode
+        // switch resets the sensor. The learned latency is kept.
+        void invalidate();
+
+        // The driver reported that the given capture was taken with
+        // value. Updates the latency estimate.
+        void observed(unsigned capture, int value);
+
+        // The current latency estimate in captures
+        int latency() const {return latency_;}
+
+        // The value the given capture will be, or was, taken with, as
+        // far as the history and the current latency estimate tell. -1
+        // if unknown.
+        int predicted(unsigned capture);
+
+        // The longest latency considered
+        enum {MaxLatency = 4};
+
+    private:
+        // The value in the register at each of the last History
+        // captures. Must cover the captures in flight plus MaxLatency.
+        enum {History = 16};
+        int value[History];
+        unsigned lastCapture;
+        bool started;
+
+        // Exponentially decaying count of the frames each candidate
+        // latency explained, out of those that told the candidates
+        // apart
+        int score[MaxLatency + 1];
+        int informative;
+
+        int latency_;
+        pthread_mutex_t mutex;
+
+        // The value in effect at the given capture, -1 if unknown or
+        // too old. Called with the mutex held.
+        int valueAt(unsigned capture) const;
+    };
+
+}}
+
+#endif
@@ -302,6 +302,18 @@ namespace FCam { namespace Tegra {
 
   
     void Lens::tagFrame(FCam::Frame f) {
+        tagFrame(f, getZoom(), getAperture());
+    }
+
+    void Lens::tagFrames(const std::vector<FCam::Frame> &frames) {
+        float zoom = getZoom();
+        float aperture = getAperture();
+        for (size_t i = 0; i < frames.size(); i++) {
+            tagFrame(frames[i], zoom, aperture);
+        }
+    }
+
+    void Lens::tagFrame(FCam::Frame f, float zoom, float aperture) {
         float initialFocus = getFocus(f.exposureStartTime());
         float finalFocus = getFocus(f.exposureEndTime());
         
@@ -312,13 +324,11 @@ namespace FCam { namespace Tegra {
         f["lens.focusSpeed"] = (1000000.0f * (finalFocus - initialFocus)/
                                 (f.exposureEndTime() - f.exposureStartTime()));
 
-        float zoom = getZoom();
         f["lens.zoom"] = zoom;
         f["lens.initialZoom"] = zoom;
         f["lens.finalZoom"] = zoom;
         f["lens.zoomSpeed"] = 0.0f;
 
-        float aperture = getAperture();
         f["lens.aperture"] = aperture;
         f["lens.initialAperture"] = aperture;
         f["lens.finalAperture"] = aperture;
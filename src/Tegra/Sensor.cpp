@@ -55,13 +55,19 @@
 #include "FCam/Tegra/Sensor.h"
 
 #include "FCam/Tegra/Platform.h"
+#include "FCam/Counters.h"
 #include "Daemon.h"
+#include "FramePool.h"
 #include "../Debug.h"
 
 namespace FCam { namespace Tegra {
 
+    static Counter framesDelivered("sensor.frames_delivered");
+
     Sensor::Sensor(int index) :
             FCam::Sensor(),
+            updateVersion(0),
+            appliedVersion(0),
             daemon(NULL),
             shotsPending_(0),
             sensorIndex(index),
@@ -69,6 +75,7 @@ namespace FCam { namespace Tegra {
             pHardwareInterface(NULL)
     {
         pthread_mutex_init(&requestMutex, NULL);
+        pthread_mutex_init(&updateMutex, NULL);
         pProduct = Hal::System::openProduct();
         pHardwareInterface = pProduct->getCameraHal(this, index);
         sensorConfig = pHardwareInterface->getSensorConfig();
@@ -78,6 +85,7 @@ namespace FCam { namespace Tegra {
     Sensor::~Sensor() {
         stop();
         pthread_mutex_destroy(&requestMutex);
+        pthread_mutex_destroy(&updateMutex);
         pProduct->releaseCameraHal(pHardwareInterface);
         Hal::System::closeProduct(pProduct);
     }
@@ -190,6 +198,7 @@ namespace FCam { namespace Tegra {
         if (daemon) return;
 
         daemon = new Daemon(this);
+        enforceDropPolicy();
         pHardwareInterface->open();
         if (streamingShot.size()) daemon->launchThreads();
     }
@@ -206,7 +215,7 @@ namespace FCam { namespace Tegra {
         pthread_mutex_lock(&requestMutex);
         _Frame *req;
         while (daemon->requestQueue.tryPullBack(&req)) {
-            delete req;
+            FramePool::instance().release(req);
             shotsPending_--;
         }
         pthread_mutex_unlock(&requestMutex);
@@ -215,7 +224,7 @@ namespace FCam { namespace Tegra {
 
         // Wait for the outstanding ones to complete
         while (shotsPending_) {
-            delete daemon->frameQueue.pull();
+            FramePool::instance().release(daemon->frameQueue.pull());
             decShotsPending();
         }
 
@@ -242,7 +251,7 @@ namespace FCam { namespace Tegra {
     void Sensor::capture(const Shot &shot) {
         start();
         
-        _Frame *f = new _Frame;
+        _Frame *f = FramePool::instance().acquire();
         
         // make a deep copy of the shot to attach to the request
         f->_shot = shot;        
@@ -274,7 +283,7 @@ namespace FCam { namespace Tegra {
         std::vector<_Frame *> frames;
         
         for (size_t i = 0; i < burst.size(); i++) {
-            _Frame *f = new _Frame;
+            _Frame *f = FramePool::instance().acquire();
             f->_shot = burst[i];
             
             // clone the shot ID
@@ -304,6 +313,8 @@ namespace FCam { namespace Tegra {
         // this makes a deep copy of the shot
         streamingShot.push_back(shot);
         streamingShot[0].id = shot.id;
+        // the new shot supersedes any pending update
+        discardPendingUpdate();
         pthread_mutex_unlock(&requestMutex);
 
         start();
@@ -330,12 +341,60 @@ namespace FCam { namespace Tegra {
         for (size_t i = 0; i < burst.size(); i++) {
             streamingShot[i].id = burst[i].id;
         }
+        discardPendingUpdate();
         pthread_mutex_unlock(&requestMutex);
 
         start();
         if (daemon->requestQueue.size() == 0) capture(streamingShot);
     }
     
+    bool Sensor::updateStream(const StreamUpdate &update) {
+        if (!streaming()) return false;
+
+        pthread_mutex_lock(&updateMutex);
+        if (update.changed & StreamUpdate::Exposure) pendingUpdate.setExposure(update.exposure);
+        if (update.changed & StreamUpdate::Gain) pendingUpdate.setGain(update.gain);
+        if (update.changed & StreamUpdate::WhiteBalance) pendingUpdate.setWhiteBalance(update.whiteBalance);
+        if (update.changed & StreamUpdate::Focus) pendingUpdate.setFocus(update.lens, update.focus);
+        if (update.changed & StreamUpdate::TargetImage) pendingUpdate.setImage(update.image);
+        __sync_fetch_and_add(&updateVersion, 1);
+        pthread_mutex_unlock(&updateMutex);
+
+        return true;
+    }
+
+    Lens *Sensor::applyPendingUpdate(float *focus) {
+        // Only calls to updateStream change updateVersion, so if it
+        // matches there is nothing to do
+        if (__sync_fetch_and_add(&updateVersion, 0) == appliedVersion) return NULL;
+
+        StreamUpdate update;
+        pthread_mutex_lock(&updateMutex);
+        update = pendingUpdate;
+        pendingUpdate = StreamUpdate();
+        appliedVersion = updateVersion;
+        pthread_mutex_unlock(&updateMutex);
+
+        for (size_t i = 0; i < streamingShot.size(); i++) {
+            Shot &s = streamingShot[i];
+            if (update.changed & StreamUpdate::Exposure) s.exposure = update.exposure;
+            if (update.changed & StreamUpdate::Gain) s.gain = update.gain;
+            if (update.changed & StreamUpdate::WhiteBalance) s.whiteBalance = update.whiteBalance;
+            if (update.changed & StreamUpdate::TargetImage) s.image = update.image;
+        }
+
+        if (!(update.changed & StreamUpdate::Focus)) return NULL;
+        *focus = update.focus;
+        return update.lens;
+    }
+
+    void Sensor::discardPendingUpdate() {
+        pthread_mutex_lock(&updateMutex);
+        pendingUpdate = StreamUpdate();
+        appliedVersion = updateVersion;
+        pthread_mutex_unlock(&updateMutex);
+    }
+
     bool Sensor::streaming() {
         return streamingShot.size() > 0;
     }
@@ -343,6 +402,7 @@ namespace FCam { namespace Tegra {
     void Sensor::stopStreaming() {
         pthread_mutex_lock(&requestMutex);
         streamingShot.clear();
+        discardPendingUpdate();
         pthread_mutex_unlock(&requestMutex);
     }
 
@@ -357,19 +417,72 @@ namespace FCam { namespace Tegra {
     }
         
     Frame Sensor::getFrame() {
+        return getFrame(-1);
+    }
+
+    _Frame *Sensor::pullFrame(int timeout) {
         if (!daemon) {
-            Frame invalid;
             error(Event::SensorStoppedError, "Can't request a frame before calling capture or stream\n");
-            return invalid;
+            return NULL;
         }        
-        Frame frame(daemon->frameQueue.pull());
+
+        _Frame *f = NULL;
+        if (timeout < 0) {
+            f = daemon->frameQueue.pull();
+        } else if (timeout == 0) {
+            daemon->frameQueue.tryPull(&f);
+        } else {
+            daemon->frameQueue.timedPull(&f, timeout);
+        }
+        return f;
+    }
+
+    Frame Sensor::getFrame(int timeout) {
+        _Frame *f = pullFrame(timeout);
+        if (!f) return Frame();
+
+        Frame frame(FramePool::instance().wrap(f));
         FCam::Sensor::tagFrame(frame); // Use the base class tagFrame
         for (size_t i = 0; i < devices.size(); i++) {
             devices[i]->tagFrame(frame);
         }
+        daemon->framesPulled();
+        framesDelivered.add();
         decShotsPending();
         return frame;
     }
+
+    std::vector<Frame> Sensor::getFrames(int maxFrames, int timeout) {
+        std::vector<Frame> result;
+        if (maxFrames <= 0) return result;
+
+        _Frame *f = pullFrame(timeout);
+        if (!f) return result;
+
+        std::vector<_Frame *> pulled;
+        pulled.reserve(maxFrames);
+        pulled.push_back(f);
+        daemon->frameQueue.tryPullMany(&pulled, maxFrames - 1);
+
+        std::vector<FCam::Frame> batch;
+        batch.reserve(pulled.size());
+        result.reserve(pulled.size());
+        for (size_t i = 0; i < pulled.size(); i++) {
+            Frame frame(FramePool::instance().wrap(pulled[i]));
+            result.push_back(frame);
+            batch.push_back(frame);
+        }
+
+        // Tag the batch device by device, rather than frame by frame
+        FCam::Sensor::tagFrames(batch); // Use the base class tagFrames
+        for (size_t i = 0; i < devices.size(); i++) {
+            devices[i]->tagFrames(batch);
+        }
+        daemon->framesPulled(pulled.size());
+        framesDelivered.add(pulled.size());
+        decShotsPending(pulled.size());
+        return result;
+    }
     
     int Sensor::rollingShutterTime(const FCam::Shot &s) const {
         return rollingShutterTime(Shot(s));
@@ -385,10 +498,16 @@ namespace FCam { namespace Tegra {
     void Sensor::generateRequest() {
         pthread_mutex_lock(&requestMutex);
         if (streamingShot.size()) {
+            float focus = 0;
+            Lens *focusLens = applyPendingUpdate(&focus);
             for (size_t i = 0; i < streamingShot.size(); i++) {
-                _Frame *f = new _Frame;
+                _Frame *f = FramePool::instance().acquire();
                 f->_shot = streamingShot[i];                
                 f->_shot.id = streamingShot[i].id;
+                f->streamed = true;
+                if (focusLens && i == 0) {
+                    f->_shot.addAction(Lens::FocusAction(focusLens, 0, focus));
+                }
                 shotsPending_++;
                 daemon->requestQueue.push(f);
             }
@@ -411,9 +530,14 @@ namespace FCam { namespace Tegra {
         return shotsPending_;
     }
 
-    void Sensor::decShotsPending() {
+    DropCounters Sensor::dropCounters() const {
+        if (!daemon) return DropCounters();
+        return daemon->dropCounters();
+    }
+
+    void Sensor::decShotsPending(int count) {
         pthread_mutex_lock(&requestMutex);
-        shotsPending_--;
+        shotsPending_ -= count;
         pthread_mutex_unlock(&requestMutex);        
 
     }
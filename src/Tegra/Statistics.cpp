@@ -124,7 +124,47 @@ int Statistics::evaluateVariance(Image im, Rect region, int subsample)
 }
 
 
-Histogram Statistics::evaluateHistogram(const HistogramConfig& histoCfg, const Image& im)
+// Adds one row of histogram samples to the per-region sums. Uses the
+// same sample positions as the histogram itself, walking the region
+// columns incrementally to avoid a division per sample.
+static void accumulateRegionRow(const Rect &boundaries, const Image &im, int j, 
+                                int subsample, std::vector<int> *regionSums)
+{
+    using namespace Statistics;
+
+    int row = (j - boundaries.y) * REGION_ROWS / boundaries.height;
+    int *cell = &(*regionSums)[row * REGION_COLUMNS * 4];
+
+    unsigned int  uvrow     = j/4;
+    unsigned int  uvcol     = boundaries.x/2 + boundaries.y%4 < 2 ? 0 : im.width()/2;
+    unsigned char *dataYPtr = im(boundaries.x, j);
+    unsigned char *dataUPtr = im(uvcol, im.height() + uvrow);
+    unsigned char *dataVPtr = im(uvcol, im.height() + im.height()/4 + uvrow);
+    int subsample2 = subsample >> 1;
+
+    int column = 0;
+    int columnEnd = boundaries.x + boundaries.width / REGION_COLUMNS;
+    for (int i = boundaries.x; i < boundaries.x + boundaries.width; i += subsample) 
+    {
+        while (i >= columnEnd && column < REGION_COLUMNS - 1) 
+        {
+            column++;
+            cell += 4;
+            columnEnd = boundaries.x + (column + 1) * boundaries.width / REGION_COLUMNS;
+        }
+        cell[0]++;
+        cell[1] += dataYPtr[0];
+        cell[2] += dataUPtr[0];
+        cell[3] += dataVPtr[0];
+
+        dataYPtr += subsample;
+        dataUPtr += subsample2;
+        dataVPtr += subsample2;
+    }
+}
+
+Histogram Statistics::evaluateHistogram(const HistogramConfig& histoCfg, const Image& im,
+                                        std::vector<int> *regionSums)
 {
 
     unsigned buckets    = 1;
@@ -163,8 +203,18 @@ Histogram Statistics::evaluateHistogram(const HistogramConfig& histoCfg, const I
     int subsample2 = subsample >> 1;
     Histogram histo(buckets, 3, histoCfg.region, YpUV);
 
+    if (regionSums) 
+    {
+        regionSums->assign(REGION_COLUMNS * REGION_ROWS * 4, 0);
+    }
+
     for (int j = boundaries.y; j < boundaries.y + boundaries.height; j += subsample)
     {
+        if (regionSums) 
+        {
+            accumulateRegionRow(boundaries, im, j, subsample, regionSums);
+        }
+
         unsigned int  uvrow     = j/4;
         unsigned int  uvcol     = boundaries.x/2 + boundaries.y%4 < 2 ? 0 : im.width()/2;
         unsigned char *dataYPtr = im(boundaries.x, j);
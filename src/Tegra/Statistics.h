@@ -17,8 +17,13 @@ namespace FCam { namespace Tegra {
            interval */
         SharpnessMap evaluateSharpness(SharpnessMapConfig mapCfg, Image im);
 
-        /* Returns the YUV histogram for an image*/
-        Histogram evaluateHistogram(const HistogramConfig& histoCfg, const Image& im);
+        /* Returns the YUV histogram for an image. If regionSums is
+           not NULL, it is also filled in the same pass with the sample
+           count and the sums of Y, U and V over each cell of a
+           REGION_COLUMNS x REGION_ROWS grid covering the histogram
+           region, four ints per cell in row major order. */
+        Histogram evaluateHistogram(const HistogramConfig& histoCfg, const Image& im,
+                                    std::vector<int> *regionSums = NULL);
 
         enum { 
             // The max number of samples to avoid overflow is 65535
@@ -28,6 +33,11 @@ namespace FCam { namespace Tegra {
 
             // Just an deliberate selection.
             MAX_HISTOGRAM_SAMPLES = 32768,
+
+            // The grid of regions for the per-region color sums used
+            // by auto white balance
+            REGION_COLUMNS = 8,
+            REGION_ROWS    = 6,
          };
 
 
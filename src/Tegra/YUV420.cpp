@@ -49,10 +49,16 @@
 * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
+#include <string.h>
+
 #include "FCam/Tegra/YUV420.h"
+#include "FCam/Counters.h"
 
 namespace FCam { namespace Tegra {
 
+static Distribution rgb24Time("convert.yuv420_to_rgb24_us");
+static Distribution yv12Time("convert.yuv420_to_yv12_us");
+
 static inline char clamp(int n, int min=1, int max=255)
 {
     if (n < min)   return (char) min;
@@ -69,6 +75,8 @@ bool convertYUV420ToRGB24(Image dst, Image im) {
             return false;
     }
 
+    ScopedTimer timer(rgb24Time);
+
     Rect boundaries;
     boundaries.x = 0;
     boundaries.y = 0;
@@ -134,4 +142,30 @@ bool convertYUV420ToRGB24(Image dst, Image im) {
 }        
 
 
+bool copyYUV420ToYV12(Image dst, Image im) {
+
+    // Check src/dst compatibility
+    if (im.size().width  != dst.size().width ||
+        im.size().height != dst.size().height ||
+        im.type() != YUV420p || dst.type() != YV12) {
+            return false;
+    }
+
+    ScopedTimer timer(yv12Time);
+
+    // Luma row by row, in case either image has padded rows
+    for (unsigned int y = 0; y < im.height(); y++) {
+        memcpy(dst(0, y), im(0, y), im.width());
+    }
+
+    // The chroma planes are packed after the luma plane
+    int planeSize = (im.width()/2) * (im.height()/2);
+    unsigned char *srcU = im(0, im.height());
+    unsigned char *dstV = dst(0, dst.height());
+    memcpy(dstV, srcU + planeSize, planeSize);
+    memcpy(dstV + planeSize, srcU, planeSize);
+
+    return true;
+}
+
 }}
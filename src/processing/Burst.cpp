@@ -0,0 +1,373 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <FCam/Event.h>
+#include <FCam/processing/Burst.h>
+#include <FCam/TagMapView.h>
+
+#include "../Debug.h"
+
+namespace FCam {
+
+    // Burst file layout. All values are in native byte order.
+    //
+    //   Header: 8-byte magic "FCAMBRST", 4-byte version, 4 bytes reserved
+    //   For each frame:
+    //     Image data, width*bytesPerPixel bytes per row, allocateHeight() rows
+    //     Zero padding to a multiple of 8 bytes
+    //     Tag data: a TagMap blob made by tagMapToBlob
+    //   Index: one IndexEntry per frame
+    //   Footer: 8-byte index offset, 4-byte frame count, 4-byte version,
+    //           8-byte magic "FCAMBIDX"
+    //
+    // The footer is only written by BurstWriter::close, so a file whose
+    // writer was interrupted will not be opened by BurstReader.
+
+    const char burstMagic[8] = {'F','C','A','M','B','R','S','T'};
+    const char burstIndexMagic[8] = {'F','C','A','M','B','I','D','X'};
+    const uint32_t burstVersion = 1;
+
+    struct BurstHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    struct BurstFooter {
+        uint64_t indexOffset;
+        uint32_t frameCount;
+        uint32_t version;
+        char magic[8];
+    };
+
+    BurstWriter::BurstWriter(): fd(-1), offset(0) {
+    }
+
+    BurstWriter::~BurstWriter() {
+        if (fd >= 0) close();
+    }
+
+    bool BurstWriter::writeBytes(const void *data, size_t bytes) {
+        const char *src = (const char *)data;
+        while (bytes > 0) {
+            ssize_t count = ::write(fd, src, bytes);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                error(Event::FileSaveError, "BurstWriter: %s: Error writing data: %s",
+                      filename.c_str(), strerror(errno));
+                return false;
+            }
+            src += count;
+            bytes -= count;
+            offset += count;
+        }
+        return true;
+    }
+
+    bool BurstWriter::open(const std::string &fname, size_t reserveBytes) {
+        if (fd >= 0) close();
+
+        filename = fname;
+        offset = 0;
+        index.clear();
+
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            error(Event::FileSaveError, "BurstWriter: %s: Cannot open file for writing: %s",
+                  filename.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (reserveBytes > 0) {
+#ifdef FCAM_PLATFORM_ANDROID
+            // No posix_fallocate in bionic, so just extend the file
+            int err = ftruncate(fd, reserveBytes) ? errno : 0;
+#else
+            int err = posix_fallocate(fd, 0, reserveBytes);
+#endif
+            if (err) {
+                warning(Event::FileSaveWarning, "BurstWriter: %s: Unable to preallocate %d bytes: %s",
+                        filename.c_str(), (int)reserveBytes, strerror(err));
+            }
+        }
+
+        BurstHeader header;
+        memcpy(header.magic, burstMagic, sizeof(burstMagic));
+        header.version = burstVersion;
+        header.reserved = 0;
+        if (!writeBytes(&header, sizeof(header))) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        dprintf(DBG_MINOR, "BurstWriter: %s: Opened for writing.\n", filename.c_str());
+        return true;
+    }
+
+    bool BurstWriter::append(Frame frame) {
+        if (!frame.valid()) {
+            error(Event::FileSaveError, "BurstWriter: %s: Frame to save not valid.", filename.c_str());
+            return false;
+        }
+
+        TagMap tags = frame.tags();
+        tags["frame.exposureStartTime"] = frame.exposureStartTime();
+        tags["frame.exposureEndTime"] = frame.exposureEndTime();
+        tags["frame.processingDoneTime"] = frame.processingDoneTime();
+        tags["frame.exposure"] = frame.exposure();
+        tags["frame.frameTime"] = frame.frameTime();
+        tags["frame.gain"] = frame.gain();
+        tags["frame.whiteBalance"] = frame.whiteBalance();
+
+        tags["frame.shot.exposure"] = frame.shot().exposure;
+        tags["frame.shot.frameTime"] = frame.shot().frameTime;
+        tags["frame.shot.gain"] = frame.shot().gain;
+        tags["frame.shot.whiteBalance"] = frame.shot().whiteBalance;
+        tags["frame.shot.id"] = frame.shot().id;
+
+        return append(frame.image(), tags);
+    }
+
+    bool BurstWriter::append(Image im, const TagMap &tags) {
+        if (fd < 0) {
+            error(Event::FileSaveError, "BurstWriter: Append called on a closed file.");
+            return false;
+        }
+        if (!im.valid()) {
+            error(Event::FileSaveError, "BurstWriter: %s: Image to save not valid.", filename.c_str());
+            return false;
+        }
+
+        switch (im.type()) {
+        case RAW:
+        case RGB24:
+        case UYVY:
+        case YUV420p:
+            break;
+        default:
+            error(Event::FileSaveError, "BurstWriter: %s: Unsupported image type %d.",
+                  filename.c_str(), im.type());
+            return false;
+        }
+
+        IndexEntry entry;
+        entry.imageOffset = offset;
+        entry.width = im.width();
+        entry.height = im.height();
+        entry.type = im.type();
+
+        // Write the image data, in one go if the rows are contiguous
+        size_t widthBytes = im.width()*im.bytesPerPixel();
+        unsigned int rows = im.allocateHeight();
+        if (widthBytes == im.bytesPerRow()) {
+            if (!writeBytes(im(0,0), widthBytes*rows)) return false;
+        } else {
+            for (unsigned int y = 0; y < rows; y++) {
+                if (!writeBytes(im(0,0) + y*im.bytesPerRow(), widthBytes)) return false;
+            }
+        }
+
+        // Write the tags, aligned so that they can be viewed in place
+        static const char padding[8] = {0};
+        if (offset % 8 && !writeBytes(padding, 8 - offset % 8)) return false;
+        std::string tagBlob = tagMapToBlob(tags);
+        entry.tagOffset = offset;
+        entry.tagBytes = tagBlob.size();
+        if (!writeBytes(tagBlob.data(), tagBlob.size())) return false;
+
+        index.push_back(entry);
+        return true;
+    }
+
+    bool BurstWriter::close() {
+        if (fd < 0) return false;
+
+        bool success = true;
+        BurstFooter footer;
+        footer.indexOffset = offset;
+        footer.frameCount = index.size();
+        footer.version = burstVersion;
+        memcpy(footer.magic, burstIndexMagic, sizeof(burstIndexMagic));
+
+        if (!index.empty()) {
+            success = writeBytes(&index[0], index.size()*sizeof(IndexEntry));
+        }
+        success = success && writeBytes(&footer, sizeof(footer));
+
+        // Drop any preallocated space past the end of the footer
+        if (success && ftruncate(fd, offset)) {
+            warning(Event::FileSaveWarning, "BurstWriter: %s: Unable to trim file: %s",
+                    filename.c_str(), strerror(errno));
+        }
+        if (::close(fd)) {
+            error(Event::FileSaveError, "BurstWriter: %s: Error closing file: %s",
+                  filename.c_str(), strerror(errno));
+            success = false;
+        }
+        fd = -1;
+
+        dprintf(DBG_MINOR, "BurstWriter: %s: Closed with %d frames, %llu bytes.\n",
+                filename.c_str(), (int)index.size(), (long long unsigned)offset);
+        return success;
+    }
+
+    uint64_t BurstReader::imageBytes(const BurstWriter::IndexEntry &entry) {
+        if (entry.width <= 0 || entry.height <= 0) return 0;
+        uint64_t rows = entry.height;
+        switch (entry.type) {
+        case RAW:
+        case RGB24:
+        case UYVY:
+            break;
+        case YUV420p:
+            rows += entry.height/2;
+            break;
+        default:
+            return 0;
+        }
+        return (uint64_t)entry.width * bytesPerPixel((ImageFormat)entry.type) * rows;
+    }
+
+    BurstReader::BurstReader(): fd(-1), mapping(NULL), mappingBytes(0) {
+    }
+
+    BurstReader::~BurstReader() {
+        close();
+    }
+
+    bool BurstReader::open(const std::string &fname) {
+        close();
+        filename = fname;
+
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error(Event::FileLoadError, "BurstReader: %s: Cannot open file for reading: %s",
+                  filename.c_str(), strerror(errno));
+            return false;
+        }
+
+#define fatalError(...) do {                                            \
+            error(Event::FileLoadError, __VA_ARGS__);                   \
+            close();                                                    \
+            return false; } while(0)
+
+        struct stat st;
+        if (fstat(fd, &st)) fatalError("BurstReader: %s: Cannot stat file: %s", filename.c_str(), strerror(errno));
+        uint64_t fileSize = st.st_size;
+
+        BurstHeader header;
+        if (fileSize < sizeof(BurstHeader) + sizeof(BurstFooter) ||
+            pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header.magic, burstMagic, sizeof(burstMagic)) != 0) {
+            fatalError("BurstReader: %s: Not a burst file.", filename.c_str());
+        }
+        if (header.version > burstVersion) {
+            fatalError("BurstReader: %s: Burst file version too new: %d (can handle %d)",
+                       filename.c_str(), header.version, burstVersion);
+        }
+
+        BurstFooter footer;
+        if (pread(fd, &footer, sizeof(footer), fileSize - sizeof(footer)) != sizeof(footer) ||
+            memcmp(footer.magic, burstIndexMagic, sizeof(burstIndexMagic)) != 0) {
+            fatalError("BurstReader: %s: No frame index found. The file may not have been closed properly.",
+                       filename.c_str());
+        }
+
+        size_t indexBytes = footer.frameCount*sizeof(BurstWriter::IndexEntry);
+        if (footer.indexOffset + indexBytes + sizeof(footer) != fileSize) {
+            fatalError("BurstReader: %s: Malformed frame index.", filename.c_str());
+        }
+
+        index.resize(footer.frameCount);
+        if (footer.frameCount > 0 &&
+            pread(fd, &index[0], indexBytes, footer.indexOffset) != (ssize_t)indexBytes) {
+            fatalError("BurstReader: %s: Unexpected EOF in frame index.", filename.c_str());
+        }
+        for (size_t i = 0; i < index.size(); i++) {
+            if (index[i].tagOffset + index[i].tagBytes > footer.indexOffset) {
+                fatalError("BurstReader: %s: Tags of frame %d extend past the frame data.", filename.c_str(), (int)i);
+            }
+            uint64_t bytes = imageBytes(index[i]);
+            if (!bytes || index[i].imageOffset > footer.indexOffset ||
+                bytes > footer.indexOffset - index[i].imageOffset) {
+                fatalError("BurstReader: %s: Image of frame %d is malformed or extends past the frame data.",
+                           filename.c_str(), (int)i);
+            }
+        }
+
+        // Map the whole file read-only, so tags can be viewed in
+        // place. If that fails, tags are still available through pread.
+        void *ptr = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            warning(Event::FileLoadWarning, "BurstReader: %s: Unable to map file, tag views unavailable: %s",
+                    filename.c_str(), strerror(errno));
+        } else {
+            mapping = (const unsigned char *)ptr;
+            mappingBytes = fileSize;
+        }
+
+#undef fatalError
+
+        dprintf(DBG_MINOR, "BurstReader: %s: Opened with %d frames.\n", filename.c_str(), frames());
+        return true;
+    }
+
+    void BurstReader::close() {
+        if (mapping) munmap((void *)mapping, mappingBytes);
+        mapping = NULL;
+        mappingBytes = 0;
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        index.clear();
+    }
+
+    Image BurstReader::image(int frame) const {
+        if (frame < 0 || frame >= frames()) {
+            error(Event::OutOfRange, "BurstReader: %s: Frame %d requested, but file has %d frames.",
+                  filename.c_str(), frame, frames());
+            return Image();
+        }
+        const BurstWriter::IndexEntry &entry = index[frame];
+        return Image(fd, entry.imageOffset, Size(entry.width, entry.height), (ImageFormat)entry.type);
+    }
+
+    TagMap BurstReader::tags(int frame) const {
+        TagMap tags;
+        if (frame < 0 || frame >= frames()) {
+            error(Event::OutOfRange, "BurstReader: %s: Frame %d requested, but file has %d frames.",
+                  filename.c_str(), frame, frames());
+            return tags;
+        }
+        const BurstWriter::IndexEntry &entry = index[frame];
+
+        if (mapping) {
+            return tagMapFromBlob(mapping + entry.tagOffset, entry.tagBytes);
+        }
+
+        std::string tagBlob(entry.tagBytes, '\0');
+        if (pread(fd, &tagBlob[0], entry.tagBytes, entry.tagOffset) != (ssize_t)entry.tagBytes) {
+            error(Event::FileLoadError, "BurstReader: %s: Unexpected EOF in tags of frame %d.",
+                  filename.c_str(), frame);
+            return tags;
+        }
+        return tagMapFromBlob(tagBlob.data(), tagBlob.size());
+    }
+
+    TagMapView BurstReader::tagView(int frame) const {
+        if (frame < 0 || frame >= frames()) {
+            error(Event::OutOfRange, "BurstReader: %s: Frame %d requested, but file has %d frames.",
+                  filename.c_str(), frame, frames());
+            return TagMapView();
+        }
+        if (!mapping) return TagMapView();
+        const BurstWriter::IndexEntry &entry = index[frame];
+        return TagMapView(mapping + entry.tagOffset, entry.tagBytes);
+    }
+
+}
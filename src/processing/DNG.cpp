@@ -19,7 +19,8 @@
 
 namespace FCam {
 
-    _DNGFrame::_DNGFrame(): dngFile(NULL) {
+    _DNGFrame::_DNGFrame(): dngFile(NULL), rawIfd(NULL), thumbIfd(NULL),
+                            imageLoaded(false), thumbnailLoaded(false) {
         dngFile = new TiffFile;
     }
 
@@ -66,7 +67,29 @@ namespace FCam {
     DNGFrame::DNGFrame(_DNGFrame *f): FCam::Frame(f) {}
     
     Image DNGFrame::thumbnail() { 
-        return get()->thumbnail;
+        _DNGFrame *_f = get();
+        if (!_f->thumbnailLoaded && _f->thumbIfd) {
+            _f->thumbnail = _f->thumbIfd->getImage();
+        }
+        _f->thumbnailLoaded = true;
+        return _f->thumbnail;
+    }
+
+    bool DNGFrame::loadImage() {
+        _DNGFrame *_f = get();
+        if (!_f) return false;
+        if (_f->imageLoaded) return true;
+        if (!_f->rawIfd) return false;
+
+        Image img = _f->rawIfd->getImage();
+        if (!img.valid()) {
+            error(Event::FileLoadError, *this, "DNGFrame::loadImage: %s: Unable to read RAW image data",
+                  _f->dngFile->filename().c_str());
+            return false;
+        }
+        _f->image = img;
+        _f->imageLoaded = true;
+        return true;
     }
     
     const char tiffEPVersion[4] = {1,0,0,0};
@@ -192,8 +215,8 @@ namespace FCam {
         // Figure out the color matrices for this sensor
         std::vector<float> rawToRGB3000(12);
         std::vector<float> rawToRGB6500(12);
-        frame.platform().rawToRGBColorMatrix(3000, &rawToRGB3000.front());
-        frame.platform().rawToRGBColorMatrix(6500, &rawToRGB6500.front());
+        frame.platform().colorMatrix(3000, &rawToRGB3000.front());
+        frame.platform().colorMatrix(6500, &rawToRGB6500.front());
 
         // First map from raw to XYZ
         std::vector<double> rawToXYZ3000(9);
@@ -561,7 +584,9 @@ namespace FCam {
     }
 
 
-    DNGFrame loadDNG(const std::string &filename) {
+    // Shared by loadDNG and scanDNG. If loadPixels is false, the
+    // RAW and thumbnail IFDs are located but their data is not read.
+    static DNGFrame readDNG(const std::string &filename, bool loadPixels) {
         // Construct DNG Frame
         _DNGFrame *_f = new _DNGFrame;
         DNGFrame f(_f);
@@ -650,8 +675,20 @@ namespace FCam {
         }
 
         //
-        // Read in RAW image data 
-        _f->image = rawIfd->getImage();
+        // Read in RAW image data, or just note its size if scanning
+        _f->rawIfd = rawIfd;
+        if (loadPixels) {
+            _f->image = rawIfd->getImage();
+            _f->imageLoaded = true;
+        } else {
+            entry = rawIfd->find(TIFF_TAG_ImageWidth);
+            if (!entry) fatalError("loadDNG: %s: No image width found for RAW data", filename.c_str());
+            int width = entry->value();
+            entry = rawIfd->find(TIFF_TAG_ImageLength);
+            if (!entry) fatalError("loadDNG: %s: No image height found for RAW data", filename.c_str());
+            int height = entry->value();
+            _f->image = Image(width, height, RAW, Image::Discard);
+        }
         
         //
         // Ok, now to parse the RAW metadata
@@ -796,8 +833,12 @@ namespace FCam {
             }            
         }
 
-        if (thumbIfd) {
-            _f->thumbnail = thumbIfd->getImage();
+        _f->thumbIfd = thumbIfd;
+        if (loadPixels) {
+            if (thumbIfd) {
+                _f->thumbnail = thumbIfd->getImage();
+            }
+            _f->thumbnailLoaded = true;
         }
 
         //
@@ -956,4 +997,12 @@ namespace FCam {
         return f;
     }
 
+    DNGFrame loadDNG(const std::string &filename) {
+        return readDNG(filename, true);
+    }
+
+    DNGFrame scanDNG(const std::string &filename) {
+        return readDNG(filename, false);
+    }
+
 }
@@ -10,56 +10,26 @@
 
 #include <FCam/processing/Demosaic.h>
 #include <FCam/Sensor.h>
+#include <FCam/processing/Resample.h>
 #include <FCam/Time.h>
+#include <FCam/Counters.h>
 
+#include "LUT.h"
+#include "../Debug.h"
 
-namespace FCam {
 
-    // Make a linear luminance -> pixel value lookup table
-    void makeLUT(const Frame &f, float contrast, int blackLevel, float gamma, unsigned char *lut);
-    void makeLUT(const Frame &f, float contrast, int blackLevel, float gamma, unsigned char *lut) {
-        unsigned short minRaw = f.platform().minRawValue()+blackLevel;
-        unsigned short maxRaw = f.platform().maxRawValue();
-        
-        for (int i = 0; i <= minRaw; i++) {
-            lut[i] = 0;
-        }
-        
-        float invRange = 1.0f/(maxRaw - minRaw);
-        float b = 2 - powf(2.0f, contrast/100.0f);
-        float a = 2 - 2*b; 
-        for (int i = minRaw+1; i <= maxRaw; i++) {
-            // Get a linear luminance in the range 0-1
-            float y = (i-minRaw)*invRange;
-            // Gamma correct it
-            y = powf(y, 1.0f/gamma);
-            // Apply a piecewise quadratic contrast curve
-            if (y > 0.5) {
-                y = 1-y;
-                y = a*y*y + b*y;
-                y = 1-y;
-            } else {
-                y = a*y*y + b*y;
-            }
-            // Convert to 8 bit and save
-            y = std::floor(y * 255 + 0.5f);
-            if (y < 0) y = 0;
-            if (y > 255) y = 255;
-            lut[i] = (unsigned char)y;
-        }
-        
-        // add a guard band
-        for (int i = maxRaw+1; i < 4096; i++) {
-            lut[i] = 255;
-        }
-    }
+namespace FCam {
 
     // Some functions used by demosaic
     inline short max(short a, short b) {return a>b ? a : b;}
     inline short max(short a, short b, short c, short d) {return max(max(a, b), max(c, d));}
     inline short min(short a, short b) {return a<b ? a : b;}
 
-    Image demosaic(Frame src, float contrast, bool denoise, int blackLevel, float gamma) {
+    Image demosaicHQ(Image input, Image out, const ToneLUT &lut, const float *colorMatrix, bool denoise);
+
+    static Distribution demosaicTime("processing.demosaic_us");
+
+    Image demosaic(Frame src, float contrast, bool denoise, int blackLevel, float gamma, DemosaicMethod method) {
         if (!src.image().valid()) {
             error(Event::DemosaicError, "Cannot demosaic an invalid image");
             return Image();
@@ -68,10 +38,14 @@ namespace FCam {
             error(Event::DemosaicError, "Cannot demosaic an image with bytesPerRow not divisible by 2");
             return Image();
         }
+
+        ScopedTimer timer(demosaicTime);
        
         // We've vectorized this code for arm
         #ifdef FCAM_ARCH_ARM
-        return demosaic_ARM(src, contrast, denoise, blackLevel, gamma);
+        if (method == FastDemosaic) {
+            return demosaic_ARM(src, contrast, denoise, blackLevel, gamma);
+        }
         #endif
 
         Image input = src.image();
@@ -121,9 +95,9 @@ namespace FCam {
             }
         }           
 
-        // Prepare the lookup table
-        unsigned char lut[4096];
-        makeLUT(src, contrast, blackLevel, gamma, lut);
+        // Get the lookup table
+        shared_ptr<const ToneLUT> toneCurve = toneLUT(src, contrast, blackLevel, gamma);
+        const ToneLUT &lut = *toneCurve;
 
         // Grab the color matrix
         float colorMatrix[12];
@@ -134,7 +108,11 @@ namespace FCam {
             }
         } else {
             // Otherwise use the platform version
-            src.platform().rawToRGBColorMatrix(src.shot().whiteBalance, colorMatrix);
+            src.platform().colorMatrix(src.shot().whiteBalance, colorMatrix);
+        }
+
+        if (method == HighQualityDemosaic) {
+            return demosaicHQ(input, out, lut, colorMatrix, denoise);
         }
 
         for (int by = 0; by < rawHeight-8-BLOCK_HEIGHT+1; by += BLOCK_HEIGHT) {
@@ -470,9 +448,9 @@ namespace FCam {
         }
         #endif
 
-        // Make the response curve
-        unsigned char lut[4096];
-        makeLUT(src, contrast, blackLevel, gamma, lut);
+        // Get the response curve
+        shared_ptr<const ToneLUT> toneCurve = toneLUT(src, contrast, blackLevel, gamma);
+        const ToneLUT &lut = *toneCurve;
 
         Image thumb;
         //!TODO: Add thumbnailing support for other Bayer patterns 
@@ -507,15 +485,17 @@ namespace FCam {
         unsigned int h = src.image().height();
         unsigned int tw = thumbSize.width;
         unsigned int th = thumbSize.height;
-        short maxPixel = 1023;
-        short minPixel = 0;
         unsigned int scaleX = (int)std::floor((float)w / tw);
         unsigned int scaleY = (int)std::floor((float)h / th);
         unsigned int scale = std::min(scaleX, scaleY); // Maintain aspect ratio
-        
-        int cropX = (w-scale*tw)/2;
+        if (scale < 1) scale = 1;
+
+        // The region to use, in whole 2x2 blocks
+        unsigned int cropW = std::min(w, scale*tw) & ~1;
+        unsigned int cropH = std::min(h, scale*th) & ~1;
+        int cropX = (w-cropW)/2;
         if (cropX % 2 == 1) cropX--; // Ensure we're at start of 2x2 block
-        int cropY = (h-scale*th)/2;
+        int cropY = (h-cropH)/2;
         if (cropY % 2 == 1) cropY--; // Ensure we're at start of 2x2 block
 
         float colorMatrix[12];
@@ -526,75 +506,43 @@ namespace FCam {
             }
         } else {
             // Otherwise use the platform version
-            src.platform().rawToRGBColorMatrix(src.shot().whiteBalance, colorMatrix);
+            src.platform().colorMatrix(src.shot().whiteBalance, colorMatrix);
         }
 
-        /* A fast downsampling/demosaicing - average down color
-           channels over the whole source pixel block under a single
-           thumbnail pixel, and just use those colors directly as the
-           pixel colors. */        
+        /* A fast downsampling/demosaicing - bin the mosaic down to one
+           2x2 block per thumbnail pixel, averaging each color channel
+           over the whole source pixel block under it, and just use
+           those colors directly as the pixel colors. */
+        Image binned = resample(src.image().subImage(cropX, cropY, Size(cropW, cropH)),
+                                Size(2*tw, 2*th), AreaResample);
+        if (!binned.valid()) return Image();
+
+        // Where each color lives within a 2x2 block
+        int redY = redRowEven ? 0 : 1;
+        int redX = blueRowGreenPixelEven ? 0 : 1;
+        int blueY = 1-redY, blueX = 1-redX;
 
         for (unsigned int ty=0; ty < th; ty++) {
             unsigned char *tpix = thumb(0,ty); // Get a pointer to the beginning of the row
+            const unsigned short *rRow = (const unsigned short *)binned(0, 2*ty+redY);
+            const unsigned short *bRow = (const unsigned short *)binned(0, 2*ty+blueY);
             for (unsigned int tx=0; tx < tw; tx++) {
-                unsigned int r=0,g=0,b=0;
-                unsigned int rc=0,gc=0,bc=0;
-
-                unsigned char *rowStart = src.image()(cropX + tx*scale, cropY + ty*scale);
-
-                bool isRedRow = ((ty*scale % 2 == 0) == redRowEven);
-
-                for(unsigned int i=0; i<scale; i++, rowStart+=src.image().bytesPerRow(), isRedRow = !isRedRow) {                    
-                    unsigned short *px = (unsigned short *)((void *)rowStart);
-                    if (isRedRow) {
-                        bool isRed=((tx*scale)%2==0) == blueRowGreenPixelEven;
-                        for (unsigned int j=0; j < scale; j++, isRed=!isRed) {
-                            if (isRed) {
-                                r += *(px++);
-                                rc++;
-                            } else {
-                                g += *(px++);
-                                gc++;
-                            }
-                        }
-                    } else {
-                        bool isGreen=((tx*scale)%2==0) == blueRowGreenPixelEven;
-                        for (unsigned int j=0; j < scale; j++, isGreen=!isGreen) {
-                            if (isGreen) {
-                                g += *(px++);
-                                gc++;
-                            } else {
-                                b += *(px++);
-                                bc++;
-                            }
-                            
-                        }
-                    }
+                float r_sensor = rRow[2*tx+redX];
+                float g_sensor = 0.5f * (rRow[2*tx+1-redX] + bRow[2*tx+1-blueX]);
+                float b_sensor = bRow[2*tx+blueX];
+                for (int c = 0; c < 3; c++) {
+                    float srgb = (r_sensor * colorMatrix[c*4+0] +
+                                  g_sensor * colorMatrix[c*4+1] +
+                                  b_sensor * colorMatrix[c*4+2] +
+                                  colorMatrix[c*4+3]);
+                    int linear = (int)std::floor(srgb+0.5f);
+                    *(tpix++) = lut[linear < 0 ? 0 : (linear > 1023 ? 1023 : linear)];
                 }
-                float r_sensor = ((float)r / rc);
-                float g_sensor = ((float)g / gc);
-                float b_sensor = ((float)b / bc);
-                float r_srgb = (r_sensor * colorMatrix[0] +
-                                g_sensor * colorMatrix[1] +
-                                b_sensor * colorMatrix[2] +
-                                colorMatrix[3]);
-                float g_srgb = (r_sensor * colorMatrix[4] +
-                                g_sensor * colorMatrix[5] +
-                                b_sensor * colorMatrix[6] +
-                                colorMatrix[7]);
-                float b_srgb = (r_sensor * colorMatrix[8] +
-                                g_sensor * colorMatrix[9] +
-                                b_sensor * colorMatrix[10] +
-                                colorMatrix[11]);
-                unsigned short r_linear = std::min(maxPixel,std::max(minPixel,(short int)std::floor(r_srgb+0.5)));
-                unsigned short g_linear = std::min(maxPixel,std::max(minPixel,(short int)std::floor(g_srgb+0.5)));
-                unsigned short b_linear = std::min(maxPixel,std::max(minPixel,(short int)std::floor(b_srgb+0.5)));
-                *(tpix++) = lut[r_linear];
-                *(tpix++) = lut[g_linear];
-                *(tpix++) = lut[b_linear];
             }
         }
 
+        dprintf(DBG_MINOR, "makeThumbnailRAW: %dx%d thumbnail in %d us\n", tw, th, Time::now() - startTime);
+
         //std::cout << "Done creating thumbnail. time = " << ((Time::now()-startTime)/1000) << std::endl;
 
         return thumb;
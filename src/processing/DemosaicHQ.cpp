@@ -0,0 +1,199 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <FCam/processing/Demosaic.h>
+
+#include "LUT.h"
+
+namespace FCam {
+
+    // The number of output rows processed at once. The rows a strip
+    // needs are copied out of the raw image, hot pixel suppressed and
+    // green interpolated a strip at a time, so the working set for a
+    // 5MP frame stays within L2.
+    static const int STRIP_HEIGHT = 16;
+
+    static inline int16_t max4(int16_t a, int16_t b, int16_t c, int16_t d) {
+        int16_t ab = a > b ? a : b;
+        int16_t cd = c > d ? c : d;
+        return ab > cd ? ab : cd;
+    }
+
+    static inline int16_t clampRaw(int v) {
+        return v < 0 ? 0 : (v > 1023 ? 1023 : v);
+    }
+
+    // Suppress hot pixels in a row, by clamping each pixel to the
+    // brightest of its four nearest neighbors of the same color
+    static void suppressHotPixels(const int16_t * __restrict__ up, const int16_t * __restrict__ here,
+                                  const int16_t * __restrict__ down, int16_t * __restrict__ out, int width) {
+        out[0] = here[0];
+        out[1] = here[1];
+        for (int x = 2; x < width-2; x++) {
+            int16_t m = max4(up[x], down[x], here[x-2], here[x+2]);
+            out[x] = here[x] < m ? here[x] : m;
+        }
+        out[width-2] = here[width-2];
+        out[width-1] = here[width-1];
+    }
+
+    // Interpolate green along a row of raw data, given the four rows
+    // around it, starting at the first red or blue pixel in the row
+    // (x0). Green is estimated horizontally and vertically with a
+    // Laplacian correction from the red or blue channel, and the
+    // estimate along the direction with the smaller gradient is
+    // used (Hamilton and Adams).
+    static void interpolateGreen(const int16_t *const *r, int16_t * __restrict__ green,
+                                 int x0, int width) {
+        const int16_t * __restrict__ up2 = r[0];
+        const int16_t * __restrict__ up = r[1];
+        const int16_t * __restrict__ here = r[2];
+        const int16_t * __restrict__ down = r[3];
+        const int16_t * __restrict__ down2 = r[4];
+
+        memcpy(green, here, width*sizeof(int16_t));
+        for (int x = x0 + 2; x < width-2; x += 2) {
+            int lapH = 2*here[x] - here[x-2] - here[x+2];
+            int lapV = 2*here[x] - up2[x] - down2[x];
+            int gradH = abs(here[x-1] - here[x+1]) + abs(lapH);
+            int gradV = abs(up[x] - down[x]) + abs(lapV);
+            int gH = 2*(here[x-1] + here[x+1]) + lapH;
+            int gV = 2*(up[x] + down[x]) + lapV;
+            int g;
+            if (gradH < gradV) g = gH;
+            else if (gradV < gradH) g = gV;
+            else g = (gH + gV) >> 1;
+            green[x] = clampRaw((g + 2) >> 2);
+        }
+    }
+
+    // Demosaic a GRBG image with edge directed green interpolation
+    // and color difference interpolation of red and blue. The input
+    // has a four pixel border around the area to output.
+    Image demosaicHQ(Image input, Image out, const ToneLUT &lut, const float *colorMatrix, bool denoise);
+    Image demosaicHQ(Image input, Image out, const ToneLUT &lut, const float *colorMatrix, bool denoise) {
+        const int width = input.width();
+        const int height = input.height();
+        const int outWidth = out.width();
+        const int outHeight = out.height();
+
+        // The color matrix in 8.8 fixed point. The offsets are added
+        // rather than multiplied, so they're scaled the same way.
+        int32_t m[12];
+        for (int i = 0; i < 12; i++) {
+            float v = colorMatrix[i] * 256;
+            m[i] = (int32_t)(v < 0 ? v - 0.5f : v + 0.5f);
+        }
+
+        // Output row y is input row y+4. It needs green at input rows
+        // y+3 to y+5, which needs clean input rows y+1 to y+7, which
+        // need raw input rows y-1 to y+9.
+        const int rawRows = STRIP_HEIGHT+10;
+        const int cleanRows = STRIP_HEIGHT+6;
+        const int greenRows = STRIP_HEIGHT+2;
+        std::vector<int16_t> raw(rawRows * width);
+        std::vector<int16_t> clean(cleanRows * width);
+        std::vector<int16_t> green(greenRows * width);
+        std::vector<uint16_t> linear(outWidth * 3);
+
+        for (int sy = 0; sy < outHeight; sy += STRIP_HEIGHT) {
+            int strip = outHeight - sy < STRIP_HEIGHT ? outHeight - sy : STRIP_HEIGHT;
+
+            // Raw row i is input row sy+i-1. Rows off the edge of the
+            // image are mirrored in steps of two to keep the bayer
+            // pattern.
+            for (int i = 0; i < strip+10; i++) {
+                int y = sy+i-1;
+                if (y < 0) y += 2;
+                if (y >= height) y -= 2;
+                memcpy(&raw[i*width], input(0, y), width*sizeof(int16_t));
+            }
+
+            // Clean row i is input row sy+i+1
+            for (int i = 0; i < strip+6; i++) {
+                const int16_t *here = &raw[(i+2)*width];
+                if (denoise) {
+                    suppressHotPixels(here - 2*width, here, here + 2*width, &clean[i*width], width);
+                } else {
+                    memcpy(&clean[i*width], here, width*sizeof(int16_t));
+                }
+            }
+
+            // Green row i is input row sy+i+3. Input rows alternate G
+            // R G R ... and B G B G ... starting from an even row.
+            for (int i = 0; i < strip+2; i++) {
+                const int16_t *r[5];
+                for (int j = 0; j < 5; j++) r[j] = &clean[(i+j)*width];
+                int x0 = ((sy+i+3) & 1) ? 0 : 1;
+                interpolateGreen(r, &green[i*width], x0, width);
+            }
+
+            for (int y = 0; y < strip; y++) {
+                // Column x of these is output column x
+                const int16_t * __restrict__ c = &clean[(y+3)*width + 4];
+                const int16_t * __restrict__ cUp = c - width;
+                const int16_t * __restrict__ cDown = c + width;
+                const int16_t * __restrict__ g = &green[(y+1)*width + 4];
+                const int16_t * __restrict__ gUp = g - width;
+                const int16_t * __restrict__ gDown = g + width;
+                uint16_t * __restrict__ l = &linear[0];
+
+                // Red and blue are interpolated as differences from
+                // green, which is much smoother across edges than red
+                // and blue are themselves
+                if (((sy + y) & 1) == 0) {
+                    // G R G R ...
+                    for (int x = 0; x < outWidth; x += 2) {
+                        int G = g[x];
+                        int hDiff = ((c[x-1] - g[x-1]) + (c[x+1] - g[x+1])) >> 1;
+                        int vDiff = ((cUp[x] - gUp[x]) + (cDown[x] - gDown[x])) >> 1;
+                        l[3*x+0] = clampRaw(G + hDiff);
+                        l[3*x+1] = G;
+                        l[3*x+2] = clampRaw(G + vDiff);
+
+                        G = g[x+1];
+                        int dDiff = ((cUp[x] - gUp[x]) + (cUp[x+2] - gUp[x+2]) +
+                                     (cDown[x] - gDown[x]) + (cDown[x+2] - gDown[x+2])) >> 2;
+                        l[3*x+3] = c[x+1];
+                        l[3*x+4] = G;
+                        l[3*x+5] = clampRaw(G + dDiff);
+                    }
+                } else {
+                    // B G B G ...
+                    for (int x = 0; x < outWidth; x += 2) {
+                        int G = g[x];
+                        int dDiff = ((cUp[x-1] - gUp[x-1]) + (cUp[x+1] - gUp[x+1]) +
+                                     (cDown[x-1] - gDown[x-1]) + (cDown[x+1] - gDown[x+1])) >> 2;
+                        l[3*x+0] = clampRaw(G + dDiff);
+                        l[3*x+1] = G;
+                        l[3*x+2] = c[x];
+
+                        G = g[x+1];
+                        int hDiff = ((c[x] - g[x]) + (c[x+2] - g[x+2])) >> 1;
+                        int vDiff = ((cUp[x+1] - gUp[x+1]) + (cDown[x+1] - gDown[x+1])) >> 1;
+                        l[3*x+3] = clampRaw(G + vDiff);
+                        l[3*x+4] = G;
+                        l[3*x+5] = clampRaw(G + hDiff);
+                    }
+                }
+
+                // Color correct in place, then gamma correct into the
+                // output
+                for (int x = 0; x < outWidth*3; x += 3) {
+                    int R = l[x], G = l[x+1], B = l[x+2];
+                    for (int k = 0; k < 3; k++) {
+                        int32_t v = m[k*4+0]*R + m[k*4+1]*G + m[k*4+2]*B + m[k*4+3];
+                        v = v < 0 ? 0 : (v + 128) >> 8;
+                        l[x+k] = v > 1023 ? 1023 : v;
+                    }
+                }
+                applyLUT(lut, l, out(0, sy+y), outWidth*3);
+            }
+        }
+
+        return out;
+    }
+
+}
@@ -1,11 +1,11 @@
 #ifdef FCAM_ARCH_ARM
 #include "Demosaic_ARM.h"
 #include <arm_neon.h>
+#include <math.h>
 
-namespace FCam {
+#include "LUT.h"
 
-    // Make a linear luminance -> pixel value lookup table
-    extern void makeLUT(const Frame &f, float contrast, int blackLevel, float gamma, unsigned char *lut);
+namespace FCam {
 
     Image demosaic_ARM(Frame src, float contrast, bool denoise, int blackLevel, float gamma) {
 
@@ -64,28 +64,21 @@ namespace FCam {
         Time startTime = Time::now(); 
 
         // Prepare the color matrix in S8.8 fixed point
-        float colorMatrix_f[12];
+        int16_t colorMatrix_i[12];
         
         // Check if there's a custom color matrix
         if (src.shot().colorMatrix().size() == 12) {
             for (int i = 0; i < 12; i++) {
-                colorMatrix_f[i] = src.shot().colorMatrix()[i];
+                colorMatrix_i[i] = (int16_t)floorf(src.shot().colorMatrix()[i] * 256 + 0.5f);
             }
         } else {
-            // Otherwise use the platform version
-            src.platform().rawToRGBColorMatrix(src.shot().whiteBalance, colorMatrix_f);
+            // Otherwise use the platform's cached version
+            src.platform().colorMatrixFixed(src.shot().whiteBalance, colorMatrix_i);
         }
 
         int16x4_t colorMatrix[3];
         for (int i = 0; i < 3; i++) {
-            int16_t val = (int16_t)(colorMatrix_f[i*4+0] * 256 + 0.5);
-            colorMatrix[i] = vld1_lane_s16(&val, colorMatrix[i], 0);
-            val = (int16_t)(colorMatrix_f[i*4+1] * 256 + 0.5);
-            colorMatrix[i] = vld1_lane_s16(&val, colorMatrix[i], 1);
-            val = (int16_t)(colorMatrix_f[i*4+2] * 256 + 0.5);
-            colorMatrix[i] = vld1_lane_s16(&val, colorMatrix[i], 2);
-            val = (int16_t)(colorMatrix_f[i*4+3] * 256 + 0.5);
-            colorMatrix[i] = vld1_lane_s16(&val, colorMatrix[i], 3);
+            colorMatrix[i] = vld1_s16(colorMatrix_i + i*4);
         }
 
         // A buffer to store data after demosiac and color correction
@@ -132,9 +125,9 @@ namespace FCam {
         #define R_R_NOISY  G_R
         #define G_GB_NOISY B_GB
 
-        // Prepare the lookup table
-        unsigned char lut[4096];
-        makeLUT(src, contrast, blackLevel, gamma, lut);
+        // Get the lookup table
+        shared_ptr<const ToneLUT> toneCurve = toneLUT(src, contrast, blackLevel, gamma);
+        const ToneLUT &lut = *toneCurve;
 
         // For each block in the input
         for (int by = 0; by < rawHeight-8-BLOCK_HEIGHT+1; by += BLOCK_HEIGHT) {
@@ -649,32 +642,11 @@ namespace FCam {
 
                     asm volatile("#Gamma Correction\n");                   
                     // Gamma correction (on the CPU, not the NEON)
-                    const uint16_t * __restrict__ out16Ptr = out16;
-                    
                     for (int y = 0; y < BLOCK_HEIGHT; y++) {                    
-                        unsigned int * __restrict__ outPtr32 = (unsigned int *)(outBlockPtr + y * outWidth * 3);
-                        for (int x = 0; x < (BLOCK_WIDTH*3)/4; x++) {
-                            unsigned val = ((lut[out16Ptr[0]] << 0) |
-                                            (lut[out16Ptr[1]] << 8) | 
-                                            (lut[out16Ptr[2]] << 16) |
-                                            (lut[out16Ptr[3]] << 24));
-                            *outPtr32++ = val;
-                            out16Ptr += 4;
-                            // *outPtr++ = lut[*out16Ptr++];
-                        }
+                        applyLUT(lut, out16 + y * BLOCK_WIDTH * 3, 
+                                 outBlockPtr + y * outWidth * 3, BLOCK_WIDTH * 3);
                     }           
                     asm volatile("#end of Gamma Correction\n");                   
-                    
-                    /*
-                    const uint16_t * __restrict__ out16Ptr = out16;                 
-                    for (int y = 0; y < BLOCK_HEIGHT; y++) {                    
-                        unsigned char * __restrict__ outPtr = (outBlockPtr + y * outWidth * 3);
-                        for (int x = 0; x < (BLOCK_WIDTH*3); x++) {
-                            *outPtr++ = lut[*out16Ptr++];
-                        }
-                    }
-                    */
-                    
                 }
                 
 
@@ -711,9 +683,9 @@ namespace FCam {
         const unsigned int startY = (h-ch)/2;        
         const unsigned int bytesPerRow = src.image().bytesPerRow();
 
-        // Make the response curve
-        unsigned char lut[4096];
-        makeLUT(src, contrast, blackLevel, gamma, lut);
+        // Get the response curve
+        shared_ptr<const ToneLUT> toneCurve = toneLUT(src, contrast, blackLevel, gamma);
+        const unsigned char *lut = toneCurve->table;
 
         unsigned char *row = src.image()(startX, startY);
 
@@ -728,7 +700,7 @@ namespace FCam {
             printf("Making thumbnail with custom WB\n");
         } else {
             // Otherwise use the platform version
-            src.platform().rawToRGBColorMatrix(src.shot().whiteBalance, colorMatrix_f);
+            src.platform().colorMatrix(src.shot().whiteBalance, colorMatrix_f);
             printf("Making thumbnail with platform WB\n");
         }
 
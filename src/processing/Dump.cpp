@@ -1,12 +1,16 @@
 #include <stdio.h>
 
 #include <FCam/Event.h>
+#include <FCam/Counters.h>
 #include <FCam/processing/Dump.h>
 
 #include "../Debug.h"
 
 namespace FCam {
 
+    static Counter filesWritten("file.files_written");
+    static Counter bytesWritten("file.bytes_written");
+
     Image loadDump(std::string filename) {
         FILE *fp = fopen(filename.c_str(), "rb");
 
@@ -129,6 +133,8 @@ namespace FCam {
 
         dprintf(DBG_MINOR,"saveDump: %s: Done.\n", filename.c_str());
         fclose(fp);
+        filesWritten.add();
+        bytesWritten.add(sizeof(header) + widthBytes*height);
     }
 
 }
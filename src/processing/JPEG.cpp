@@ -1,10 +1,12 @@
 #include <stdio.h>
+#include <algorithm>
 
 extern "C" {
 #include <jpeglib.h>
 }
 
 #include <FCam/Event.h>
+#include <FCam/Counters.h>
 #include <FCam/processing/JPEG.h>
 #include <FCam/processing/Demosaic.h>
 
@@ -14,6 +16,9 @@ using namespace std;
 
 
 namespace FCam {
+    static Counter filesWritten("file.files_written");
+    static Counter bytesWritten("file.bytes_written");
+
     void saveJPEG(Image im, string filename, int quality) {
         struct jpeg_compress_struct cinfo;
         struct jpeg_error_mgr jerr;
@@ -68,7 +73,11 @@ namespace FCam {
                 rowPtr = &row[0];
                 jpeg_write_scanlines(&cinfo, &rowPtr, 1);
             }
-        } else if (im.type() == YUV420p) {
+        } else if (im.type() == YUV420p || im.type() == YV12) {
+            // YV12 just has the chroma planes the other way round
+            unsigned int uPlane = im.height(), vPlane = im.height() + im.height()/4;
+            if (im.type() == YV12) std::swap(uPlane, vPlane);
+
 
             std::vector<JSAMPLE> row(cinfo.image_width*3);
             while (cinfo.next_scanline < cinfo.image_height) {
@@ -78,8 +87,8 @@ namespace FCam {
                 unsigned int  uvrow    = cinfo.next_scanline/4;
                 unsigned int  uvcol    = cinfo.next_scanline%4 < 2 ? 0 : im.width()/2;
                 unsigned char *dataYPtr = im(0, cinfo.next_scanline);
-                unsigned char *dataUPtr = im(uvcol, im.height() + uvrow);
-                unsigned char *dataVPtr = im(uvcol, im.height() + im.height()/4 + uvrow);
+                unsigned char *dataUPtr = im(uvcol, uPlane + uvrow);
+                unsigned char *dataVPtr = im(uvcol, vPlane + uvrow);
 
                 for (size_t i = 0; i < cinfo.image_width/2; i++) {
                     rowPtr[0] = dataYPtr[0];
@@ -99,7 +108,10 @@ namespace FCam {
         }
 
         jpeg_finish_compress(&cinfo);
+        long bytes = ftell(f);
         fclose(f);
+        filesWritten.add();
+        if (bytes > 0) bytesWritten.add(bytes);
         jpeg_destroy_compress(&cinfo);
 
         dprintf(DBG_MINOR, "saveJPEG: Done saving JPEG to %s\n", filename.c_str());
@@ -121,7 +133,7 @@ namespace FCam {
                 return;
             }
             // fall through to rgb24
-        case RGB24: case YUV24: case UYVY: case YUV420p:
+        case RGB24: case YUV24: case UYVY: case YUV420p: case YV12:
             saveJPEG(im, filename, quality);
             break;
         default:
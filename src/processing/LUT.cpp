@@ -0,0 +1,149 @@
+#include <cmath>
+#include <list>
+#include <pthread.h>
+#include <string.h>
+
+#include "LUT.h"
+#include "../Debug.h"
+
+namespace FCam {
+
+    // Make a linear luminance -> pixel value lookup table
+    static void makeLUT(unsigned short minRaw, unsigned short maxRaw, float contrast, float gamma, 
+                        unsigned char *lut) {
+        if (maxRaw >= ToneLUT::Size) maxRaw = ToneLUT::Size-1;
+
+        for (int i = 0; i <= minRaw; i++) {
+            lut[i] = 0;
+        }
+        
+        float invRange = 1.0f/(maxRaw - minRaw);
+        float b = 2 - powf(2.0f, contrast/100.0f);
+        float a = 2 - 2*b; 
+        for (int i = minRaw+1; i <= maxRaw; i++) {
+            // Get a linear luminance in the range 0-1
+            float y = (i-minRaw)*invRange;
+            // Gamma correct it
+            y = powf(y, 1.0f/gamma);
+            // Apply a piecewise quadratic contrast curve
+            if (y > 0.5) {
+                y = 1-y;
+                y = a*y*y + b*y;
+                y = 1-y;
+            } else {
+                y = a*y*y + b*y;
+            }
+            // Convert to 8 bit and save
+            y = std::floor(y * 255 + 0.5f);
+            if (y < 0) y = 0;
+            if (y > 255) y = 255;
+            lut[i] = (unsigned char)y;
+        }
+        
+        // add a guard band
+        for (int i = maxRaw+1; i < ToneLUT::Size; i++) {
+            lut[i] = 255;
+        }
+    }
+
+    // The most recently used tone curves, most recent first
+    class ToneLUTCache {
+    public:
+        static ToneLUTCache &instance() {
+            // Never destroyed, so that processing threads still
+            // running at exit can use it
+            static ToneLUTCache *cache = new ToneLUTCache;
+            return *cache;
+        }
+
+        shared_ptr<const ToneLUT> get(unsigned short minRaw, unsigned short maxRaw, 
+                                      float contrast, float gamma) {
+            pthread_mutex_lock(&mutex);
+            for (std::list<Entry>::iterator i = entries.begin(); i != entries.end(); i++) {
+                if (i->minRaw == minRaw && i->maxRaw == maxRaw &&
+                    i->contrast == contrast && i->gamma == gamma) {
+                    entries.splice(entries.begin(), entries, i);
+                    shared_ptr<const ToneLUT> lut = entries.front().lut;
+                    pthread_mutex_unlock(&mutex);
+                    return lut;
+                }
+            }
+            pthread_mutex_unlock(&mutex);
+
+            // Build it outside the lock. If two threads race to build
+            // the same curve, both results are identical, and the
+            // extra entry just ages out.
+            ToneLUT *lut = new ToneLUT;
+            makeLUT(minRaw, maxRaw, contrast, gamma, lut->table);
+            dprintf(DBG_MINOR, "toneLUT: Built curve for raw range %d-%d, contrast %f, gamma %f\n",
+                    minRaw, maxRaw, contrast, gamma);
+
+            Entry e;
+            e.minRaw = minRaw;
+            e.maxRaw = maxRaw;
+            e.contrast = contrast;
+            e.gamma = gamma;
+            e.lut = shared_ptr<const ToneLUT>(lut);
+
+            pthread_mutex_lock(&mutex);
+            entries.push_front(e);
+            if (entries.size() > MaxEntries) entries.pop_back();
+            pthread_mutex_unlock(&mutex);
+            return e.lut;
+        }
+
+    private:
+        ToneLUTCache() {
+            pthread_mutex_init(&mutex, NULL);
+        }
+
+        // Curves are 4K each, and an application rarely uses more
+        // than a couple of settings at once
+        enum {MaxEntries = 8};
+
+        struct Entry {
+            unsigned short minRaw, maxRaw;
+            float contrast, gamma;
+            shared_ptr<const ToneLUT> lut;
+        };
+
+        std::list<Entry> entries;
+        pthread_mutex_t mutex;
+    };
+
+    shared_ptr<const ToneLUT> toneLUT(const Frame &f, float contrast, int blackLevel, float gamma) {
+        unsigned short minRaw = f.platform().minRawValue()+blackLevel;
+        unsigned short maxRaw = f.platform().maxRawValue();
+        return ToneLUTCache::instance().get(minRaw, maxRaw, contrast, gamma);
+    }
+
+    void applyLUT(const ToneLUT &lut, const uint16_t *in, unsigned char *out, int n) {
+        const unsigned char * __restrict__ table = lut.table;
+        const unsigned max = ToneLUT::Size-1;
+
+        // There's no gather on NEON, and the table is far too big for
+        // vtbl, so look up four values at a time and write them out
+        // as a single (little endian) word when the output is
+        // aligned.
+        int i = 0;
+        if (((size_t)out & 3) == 0) {
+            uint32_t * __restrict__ out32 = (uint32_t *)out;
+            for (; i + 4 <= n; i += 4) {
+                unsigned a = in[i+0], b = in[i+1], c = in[i+2], d = in[i+3];
+                if (a > max) a = max;
+                if (b > max) b = max;
+                if (c > max) c = max;
+                if (d > max) d = max;
+                uint32_t val = ((uint32_t)table[a] << 0) | ((uint32_t)table[b] << 8) |
+                    ((uint32_t)table[c] << 16) | ((uint32_t)table[d] << 24);
+                *out32++ = val;
+            }
+        }
+        for (; i < n; i++) {
+            unsigned a = in[i];
+            if (a > max) a = max;
+            out[i] = table[a];
+        }
+    }
+
+}
@@ -0,0 +1,32 @@
+#ifndef FCAM_LUT_H
+#define FCAM_LUT_H
+
+#include <stdint.h>
+
+#include <FCam/Frame.h>
+
+namespace FCam {
+
+    // A raw value -> 8 bit pixel value lookup table, with a guard band
+    // up to 4096 entries so any 12 bit value can be looked up directly
+    struct ToneLUT {
+        enum {Size = 4096};
+        unsigned char table[Size];
+
+        unsigned char operator[](unsigned i) const {return table[i];}
+    };
+
+    // Get the tone curve for a frame's platform with the given
+    // post-processing parameters. Each curve is built once and shared
+    // by later calls with the same parameters, so repeated bursts
+    // don't recompute it. Thread-safe.
+    shared_ptr<const ToneLUT> toneLUT(const Frame &f, float contrast, int blackLevel, float gamma);
+
+    // Look up n 16 bit values in a table, and write out n 8 bit
+    // results. Values past the end of the table are clamped to its
+    // last entry.
+    void applyLUT(const ToneLUT &lut, const uint16_t *in, unsigned char *out, int n);
+
+}
+
+#endif
@@ -0,0 +1,315 @@
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <FCam/processing/Resample.h>
+#include <FCam/Event.h>
+#include <FCam/Time.h>
+
+#include "../Debug.h"
+
+namespace FCam {
+
+    // Filter weights are in 1.14 fixed point
+    static const int WEIGHT_BITS = 14;
+
+    // The filter taps along one axis. Output pixel i is the sum over
+    // k < n of weight[i*n+k] times input pixel start[i]+k. Every
+    // output uses the same number of taps (some of them zero), and
+    // all taps are inside the input, so the inner loops need no
+    // bounds checks.
+    struct Taps {
+        int n;
+        std::vector<int> start;
+        std::vector<int16_t> weight;
+    };
+
+    static float lanczos3(float x) {
+        if (x < 0) x = -x;
+        if (x < 1e-5f) return 1;
+        if (x >= 3) return 0;
+        float px = (float)M_PI * x;
+        return 3 * sinf(px) * sinf(px / 3) / (px * px);
+    }
+
+    // The weight of input pixel j in output pixel i, for the given
+    // method and input pixels per output pixel
+    static float filterWeight(ResampleMethod method, int i, int j, float scale) {
+        float center = (i + 0.5f) * scale - 0.5f;
+        if (method == AreaResample && scale > 1) {
+            // How much of input pixel j is covered by output pixel i
+            float lo = i * scale, hi = (i + 1) * scale;
+            float a = lo > j ? lo : j, b = hi < j + 1 ? hi : j + 1;
+            return b > a ? b - a : 0;
+        } else if (method == LanczosResample) {
+            float s = scale > 1 ? scale : 1;
+            return lanczos3((j - center) / s);
+        }
+        // Bilinear, and area when upsampling
+        float d = fabsf(j - center);
+        return d < 1 ? 1 - d : 0;
+    }
+
+    // The input support of the filter on either side of an output
+    // pixel's center, in input pixels
+    static float filterRadius(ResampleMethod method, float scale) {
+        float s = scale > 1 ? scale : 1;
+        switch (method) {
+        case AreaResample: return scale > 1 ? scale / 2 + 1 : 1;
+        case LanczosResample: return 3 * s;
+        default: return 1;
+        }
+    }
+
+    static Taps makeTaps(ResampleMethod method, int srcLen, int dstLen) {
+        float scale = (float)srcLen / dstLen;
+        float radius = filterRadius(method, scale);
+
+        // Find the weights of each output pixel, with taps off either
+        // end of the input folded onto the edge pixels, and the
+        // widest span of input pixels any output pixel uses
+        int maxTaps = (int)ceilf(2 * radius) + 2;
+        std::vector<float> w(dstLen * maxTaps, 0.0f);
+        std::vector<int> first(dstLen), last(dstLen);
+        int n = 1;
+        for (int i = 0; i < dstLen; i++) {
+            float center = (i + 0.5f) * scale - 0.5f;
+            int lo = (int)floorf(center - radius);
+            first[i] = srcLen;
+            last[i] = -1;
+            for (int j = lo; j < lo + maxTaps; j++) {
+                float v = filterWeight(method, i, j, scale);
+                if (v == 0) continue;
+                int k = j < 0 ? 0 : (j >= srcLen ? srcLen - 1 : j);
+                w[i*maxTaps + j - lo] = v;
+                if (k < first[i]) first[i] = k;
+                if (k > last[i]) last[i] = k;
+            }
+            if (last[i] - first[i] + 1 > n) n = last[i] - first[i] + 1;
+        }
+
+        Taps taps;
+        taps.n = n;
+        taps.start.resize(dstLen);
+        taps.weight.assign(dstLen * n, 0);
+
+        std::vector<float> q(n);
+        for (int i = 0; i < dstLen; i++) {
+            float center = (i + 0.5f) * scale - 0.5f;
+            int lo = (int)floorf(center - radius);
+            int start = first[i];
+            if (start > srcLen - n) start = srcLen - n;
+            taps.start[i] = start;
+
+            float sum = 0;
+            for (int k = 0; k < n; k++) q[k] = 0;
+            for (int j = lo; j < lo + maxTaps; j++) {
+                float v = w[i*maxTaps + j - lo];
+                if (v == 0) continue;
+                int k = j < 0 ? 0 : (j >= srcLen ? srcLen - 1 : j);
+                q[k - start] += v;
+                sum += v;
+            }
+
+            // Normalize and quantize, putting any rounding error on
+            // the biggest tap so that flat areas stay exactly flat
+            int total = 0, biggest = 0;
+            for (int k = 0; k < n; k++) {
+                int v = (int)floorf(q[k] / sum * (1 << WEIGHT_BITS) + 0.5f);
+                taps.weight[i*n + k] = v;
+                total += v;
+                if (q[k] > q[biggest]) biggest = k;
+            }
+            taps.weight[i*n + biggest] += (1 << WEIGHT_BITS) - total;
+        }
+        return taps;
+    }
+
+    // Vertical pass: combine n input rows into one intermediate row
+    // of width values. Intermediate values for 8 bit data are kept in
+    // 16 bits with 6 fractional bits, so the vertical pass can use 16
+    // bit multiplies. 16 bit data is kept in 32 bits.
+    static void vertical(const uint8_t *const *rows, const int16_t *w, int n, int16_t *out, int width) {
+        const int shift = WEIGHT_BITS - 6;
+        int x = 0;
+#if defined(__ARM_NEON__)
+        for (; x + 8 <= width; x += 8) {
+            int32x4_t lo = vdupq_n_s32(0), hi = vdupq_n_s32(0);
+            for (int k = 0; k < n; k++) {
+                int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows[k] + x)));
+                lo = vmlal_n_s16(lo, vget_low_s16(r), w[k]);
+                hi = vmlal_n_s16(hi, vget_high_s16(r), w[k]);
+            }
+            vst1q_s16(out + x, vcombine_s16(vqmovn_s32(vrshrq_n_s32(lo, shift)),
+                                            vqmovn_s32(vrshrq_n_s32(hi, shift))));
+        }
+#elif defined(__SSE2__)
+        const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 8 <= width; x += 8) {
+            __m128i lo = round, hi = round;
+            // Multiply-add two rows at a time, interleaving them so
+            // each 32 bit lane gets both products
+            for (int k = 0; k < n; k += 2) {
+                __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[k] + x)), zero);
+                __m128i b = zero;
+                uint32_t wb = 0;
+                if (k + 1 < n) {
+                    b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[k+1] + x)), zero);
+                    wb = (uint16_t)w[k+1];
+                }
+                __m128i wv = _mm_set1_epi32((int)((wb << 16) | (uint16_t)w[k]));
+                lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wv));
+                hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wv));
+            }
+            _mm_storeu_si128((__m128i *)(out + x),
+                             _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift)));
+        }
+#endif
+        for (; x < width; x++) {
+            int32_t sum = 1 << (shift - 1);
+            for (int k = 0; k < n; k++) sum += w[k] * rows[k][x];
+            out[x] = (int16_t)(sum >> shift);
+        }
+    }
+
+    static void vertical(const uint16_t *const *rows, const int16_t *w, int n, int32_t *out, int width) {
+        const int shift = WEIGHT_BITS;
+        for (int x = 0; x < width; x++) {
+            int32_t sum = 1 << (shift - 1);
+            for (int k = 0; k < n; k++) sum += w[k] * rows[k][x];
+            out[x] = sum >> shift;
+        }
+    }
+
+    // Horizontal pass: filter an intermediate row of interleaved
+    // channels down (or up) to the output width
+    static void horizontal(const int16_t *src, int channels, const Taps &taps, uint8_t *out, int dstLen) {
+        const int shift = WEIGHT_BITS + 6;
+        for (int i = 0; i < dstLen; i++) {
+            const int16_t *w = &taps.weight[i*taps.n];
+            const int16_t *s = src + taps.start[i]*channels;
+            for (int c = 0; c < channels; c++) {
+                int32_t sum = 1 << (shift - 1);
+                for (int k = 0; k < taps.n; k++) sum += w[k] * s[k*channels + c];
+                sum >>= shift;
+                *out++ = sum < 0 ? 0 : (sum > 255 ? 255 : sum);
+            }
+        }
+    }
+
+    static void horizontal(const int32_t *src, int channels, const Taps &taps, uint16_t *out, int dstLen) {
+        const int shift = WEIGHT_BITS;
+        for (int i = 0; i < dstLen; i++) {
+            const int16_t *w = &taps.weight[i*taps.n];
+            const int32_t *s = src + taps.start[i]*channels;
+            for (int c = 0; c < channels; c++) {
+                int32_t sum = 1 << (shift - 1);
+                for (int k = 0; k < taps.n; k++) sum += w[k] * s[k*channels + c];
+                sum >>= shift;
+                *out++ = sum < 0 ? 0 : (sum > 65535 ? 65535 : sum);
+            }
+        }
+    }
+
+    // Resample one plane of interleaved channels. Sizes are in
+    // pixels, and strides in bytes. The vertical pass goes first, as
+    // it's the one that's vectorized, and when shrinking it leaves
+    // the horizontal pass only the output rows to do.
+    template<typename T, typename I>
+    static void resamplePlane(const unsigned char *src, int srcStride, int sw, int sh,
+                              unsigned char *dst, int dstStride, int dw, int dh,
+                              int channels, ResampleMethod method) {
+        Taps hTaps = makeTaps(method, sw, dw);
+        Taps vTaps = makeTaps(method, sh, dh);
+
+        std::vector<I> row(sw * channels);
+        std::vector<const T *> rows(vTaps.n);
+
+        for (int y = 0; y < dh; y++) {
+            for (int k = 0; k < vTaps.n; k++) {
+                rows[k] = (const T *)(src + (vTaps.start[y] + k) * srcStride);
+            }
+            vertical(&rows[0], &vTaps.weight[y * vTaps.n], vTaps.n, &row[0], sw * channels);
+            horizontal(&row[0], channels, hTaps, (T *)(dst + y * dstStride), dw);
+        }
+    }
+
+    bool resample(Image src, Image dst, ResampleMethod method) {
+        if (!src.valid() || !dst.valid()) {
+            error(Event::InternalError, "resample: Invalid image");
+            return false;
+        }
+        if (src.type() != dst.type()) {
+            error(Event::FormatMismatch, "resample: Source and destination formats differ (%d vs %d)",
+                  src.type(), dst.type());
+            return false;
+        }
+
+        int sw = src.width(), sh = src.height();
+        int dw = dst.width(), dh = dst.height();
+        Time start = Time::now();
+
+        switch (src.type()) {
+        case RGB24:
+            resamplePlane<uint8_t, int16_t>(src(0, 0), src.bytesPerRow(), sw, sh,
+                                            dst(0, 0), dst.bytesPerRow(), dw, dh, 3, method);
+            break;
+        case YUV420p: case YV12: {
+            if ((sw | sh | dw | dh) & 1) {
+                error(Event::ResolutionMismatch, "resample: Planar YUV images must have even dimensions");
+                return false;
+            }
+            if ((int)src.bytesPerRow() != sw || (int)dst.bytesPerRow() != dw) {
+                error(Event::ResolutionMismatch, "resample: Planar YUV images can't have padded rows");
+                return false;
+            }
+            unsigned char *s = src(0, 0), *d = dst(0, 0);
+            resamplePlane<uint8_t, int16_t>(s, sw, sw, sh, d, dw, dw, dh, 1, method);
+            s += sw * sh;
+            d += dw * dh;
+            for (int plane = 0; plane < 2; plane++) {
+                resamplePlane<uint8_t, int16_t>(s, sw/2, sw/2, sh/2, d, dw/2, dw/2, dh/2, 1, method);
+                s += (sw/2) * (sh/2);
+                d += (dw/2) * (dh/2);
+            }
+            break;
+        }
+        case RAW:
+            if ((sw | sh | dw | dh) & 1) {
+                error(Event::ResolutionMismatch, "resample: RAW images must have even dimensions");
+                return false;
+            }
+            // Even and odd rows separately, each as pairs of pixels
+            // from alternating columns
+            for (int p = 0; p < 2; p++) {
+                resamplePlane<uint16_t, int32_t>(src(0, p), src.bytesPerRow()*2, sw/2, sh/2,
+                                                 dst(0, p), dst.bytesPerRow()*2, dw/2, dh/2, 2, method);
+            }
+            break;
+        default:
+            error(Event::FormatMismatch, "resample: Unsupported image format %d", src.type());
+            return false;
+        }
+
+        dprintf(DBG_MINOR, "resample: %dx%d -> %dx%d in %d us\n", sw, sh, dw, dh, Time::now() - start);
+        return true;
+    }
+
+    Image resample(Image src, Size size, ResampleMethod method) {
+        if (!src.valid()) {
+            error(Event::InternalError, "resample: Invalid image");
+            return Image();
+        }
+        Image dst(size, src.type());
+        if (!resample(src, dst, method)) return Image();
+        return dst;
+    }
+
+}
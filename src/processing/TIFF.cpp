@@ -5,11 +5,15 @@
 #include "FCam/processing/TIFF.h" 
 #include <FCam/processing/Demosaic.h>
 #include <FCam/Tegra/YUV420.h>
+#include <FCam/Counters.h>
 #include "TIFF.h"
 #include "../Debug.h"
 
 namespace FCam {
 
+    static Counter filesWritten("file.files_written");
+    static Counter bytesWritten("file.bytes_written");
+
     void saveTIFF(Frame frame, std::string filename) 
     {
         Image im = frame.image();
@@ -1160,6 +1164,7 @@ namespace FCam {
         case UYVY:
         case YUV24:
         case YUV420p:
+        case YV12:
             error(Event::FileSaveError, "TiffIfd::writeImage: UYVY/YUV images not supported yet.\n");
             return false;
             break;
@@ -1353,7 +1358,11 @@ namespace FCam {
             return false;
         }
 
+        fseek(fw, 0, SEEK_END);
+        long bytes = ftell(fw);
         fclose(fw);
+        filesWritten.add();
+        if (bytes > 0) bytesWritten.add(bytes);
         return true;
     }
 
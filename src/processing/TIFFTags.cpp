@@ -1,7 +1,7 @@
-#include <map>
-#include "pthread.h"
+#include <string.h>
 
 #include "TIFFTags.h"
+#include "../Debug.h"
 
 namespace FCam {
     const TiffEntryInfo tiffEntryTypes[]={
@@ -3138,56 +3138,124 @@ namespace FCam {
     };
 
 
-    TiffEntryInfo const* tiffEntryLookup(uint16_t tag) {
-        static std::map<uint16_t, TiffEntryInfo const*> entriesByTag;
-        static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-        static bool initialized = false;
+    // Indices into tiffEntryTypes, sorted by tag number and by name
+    // (in strcmp order), so that both lookups below are plain binary
+    // searches with no locking or lazy initialization. These tables
+    // must be regenerated whenever an entry is added to, removed
+    // from, or reordered in tiffEntryTypes; tiffEntryTablesSorted
+    // below catches tables left out of date. Entries with equal tags
+    // are kept in table order; the lookup returns the last of them.
+    static const uint16_t tiffEntriesByTag[] = {
+        14, 11, 12, 25, 4, 8, 21, 31, 16, 15, 1, 5, 23, 32, 3, 2, 9, 17, 20,
+        30, 22, 27, 26, 29, 19, 18, 33, 34, 24, 10, 28, 7, 0, 13, 36, 37, 38,
+        39, 35, 42, 41, 6, 136, 137, 138, 141, 142, 139, 143, 144, 145, 122,
+        131, 132, 127, 128, 146, 147, 148, 149, 150, 151, 152, 153, 154, 156,
+        155, 40, 129, 130, 133, 134, 135, 123, 124, 125, 126, 140, 157, 158,
+        159, 160, 161, 162, 163, 164, 165, 166, 167, 168, 169, 170, 171, 172,
+        173, 174, 175, 176, 177, 178, 179, 180, 43, 44, 45, 46, 47, 48, 49, 50,
+        51, 52, 53, 54, 55, 57, 58, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+        72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 59, 60, 56, 82, 83, 84, 85, 86,
+        87, 88, 89, 90, 91, 92, 93, 94, 95, 96, 97, 98, 99, 100, 101, 102, 103,
+        104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116, 117,
+        118, 119, 120, 121
+    };
 
-        // Build map if not yet initialized. Annoying thread-safety mutex
-        if (!initialized) {
-            pthread_mutex_lock(&mutex);
-            if (!initialized) {
-                for (unsigned int i=0; i < sizeof(tiffEntryTypes)/sizeof(TiffEntryInfo); i++) {
-                    entriesByTag[tiffEntryTypes[i].tag] = tiffEntryTypes+i;
-                }
-                initialized = true;
-            }
-            pthread_mutex_unlock(&mutex);
+    static const uint16_t tiffEntriesByName[] = {
+        85, 67, 78, 147, 0, 87, 68, 88, 95, 69, 70, 71, 72, 73, 56, 1, 51, 52,
+        53, 50, 148, 48, 41, 167, 47, 42, 59, 60, 63, 64, 92, 75, 2, 3, 77, 4,
+        61, 62, 124, 91, 127, 128, 5, 175, 6, 89, 90, 168, 44, 80, 43, 7, 132,
+        131, 57, 58, 55, 178, 171, 138, 122, 149, 163, 169, 141, 136, 94, 8,
+        137, 165, 9, 154, 157, 123, 156, 172, 161, 159, 160, 104, 105, 10, 139,
+        174, 11, 12, 13, 143, 14, 15, 180, 16, 140, 76, 153, 74, 49, 46, 17,
+        129, 81, 86, 150, 18, 152, 19, 20, 21, 121, 96, 144, 118, 119, 120, 22,
+        84, 113, 83, 23, 125, 126, 24, 106, 107, 110, 111, 109, 108, 93, 103,
+        102, 99, 100, 98, 117, 116, 97, 101, 82, 112, 65, 66, 25, 115, 26, 27,
+        176, 166, 164, 145, 79, 177, 146, 28, 158, 142, 29, 30, 35, 114, 31,
+        155, 151, 179, 162, 133, 135, 134, 40, 173, 32, 39, 37, 38, 36, 45,
+        130, 170, 54, 33, 34
+    };
+
+    // Compile-time check that the index tables cover the whole entry table
+    static const unsigned int tiffEntryCount = sizeof(tiffEntryTypes)/sizeof(TiffEntryInfo);
+    typedef char tiffEntriesByTagSizeCheck[
+        sizeof(tiffEntriesByTag)/sizeof(uint16_t) == tiffEntryCount ? 1 : -1];
+    typedef char tiffEntriesByNameSizeCheck[
+        sizeof(tiffEntriesByName)/sizeof(uint16_t) == tiffEntryCount ? 1 : -1];
+
+    // Check that the index tables are permutations of tiffEntryTypes in
+    // the order the lookups expect: by tag, with equal tags in table
+    // order, and strictly by name.
+    static bool tiffEntryTablesSorted() {
+        std::vector<bool> byTag(tiffEntryCount), byName(tiffEntryCount);
+        for (unsigned int i = 0; i < tiffEntryCount; i++) {
+            unsigned int t = tiffEntriesByTag[i], n = tiffEntriesByName[i];
+            if (t >= tiffEntryCount || byTag[t] || n >= tiffEntryCount || byName[n]) return false;
+            byTag[t] = byName[n] = true;
+            if (i == 0) continue;
+            unsigned int pt = tiffEntriesByTag[i-1], pn = tiffEntriesByName[i-1];
+            if (tiffEntryTypes[pt].tag > tiffEntryTypes[t].tag ||
+                (tiffEntryTypes[pt].tag == tiffEntryTypes[t].tag && pt > t)) return false;
+            if (strcmp(tiffEntryTypes[pn].name, tiffEntryTypes[n].name) >= 0) return false;
         }
+        return true;
+    }
 
-        std::map<uint16_t, TiffEntryInfo const*>::iterator it = entriesByTag.find(tag);
-        if (it == entriesByTag.end()) return NULL;
-        return it->second;
+    // Checked once, when the library is loaded. Should the tables ever
+    // get out of step with tiffEntryTypes, the lookups fall back to a
+    // linear scan rather than silently missing entries. (Lookups made
+    // before this initializer has run also take the slow path.)
+    static const bool tiffEntryTablesOk = tiffEntryTablesSorted();
+
+    static void reportUnsortedTables() {
+        static volatile int reported = 0;
+        if (__sync_bool_compare_and_swap(&reported, 0, 1)) {
+            dprintf(DBG_ERROR, "TIFF tag index tables are out of order and need regenerating\n");
+        }
     }
 
-    // The lookup by entry name is done using basic c char arrays, to avoid having to make duplicate strings of the whole big tiffEntryTypes table.
+    TiffEntryInfo const* tiffEntryLookup(uint16_t tag) {
+        if (!tiffEntryTablesOk) {
+            reportUnsortedTables();
+            TiffEntryInfo const *found = NULL;
+            for (unsigned int i = 0; i < tiffEntryCount; i++) {
+                if (tiffEntryTypes[i].tag == tag) found = tiffEntryTypes + i;
+            }
+            return found;
+        }
 
-    // Need to compare const char* as strings, not pointers.
-    struct TiffNameLess {
-        bool operator()(const char *l, const char *r) const {
-            return strcmp(l, r) < 0;
+        // Find the first entry with a tag greater than the one requested
+        unsigned int lo = 0, hi = tiffEntryCount;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            if (tiffEntryTypes[tiffEntriesByTag[mid]].tag <= tag) lo = mid + 1;
+            else hi = mid;
         }
-    };
+        if (lo == 0) return NULL;
+        TiffEntryInfo const *info = tiffEntryTypes + tiffEntriesByTag[lo-1];
+        if (info->tag != tag) return NULL;
+        return info;
+    }
 
     TiffEntryInfo const* tiffEntryLookup(const std::string &entryName) {
-        static std::map<const char*, TiffEntryInfo const*, TiffNameLess> entriesByName;
-        static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-        static bool initialized = false;
-
-        // Build map if not yet initialized. Annoying thread-safety mutex
-        if (!initialized) {
-            pthread_mutex_lock(&mutex);
-            if (!initialized) {
-                for (unsigned int i=0; i < sizeof(tiffEntryTypes)/sizeof(TiffEntryInfo); i++) {
-                    entriesByName[tiffEntryTypes[i].name] = tiffEntryTypes+i;
-                }
-                initialized = true;
+        const char *name = entryName.c_str();
+        if (!tiffEntryTablesOk) {
+            reportUnsortedTables();
+            for (unsigned int i = 0; i < tiffEntryCount; i++) {
+                if (strcmp(tiffEntryTypes[i].name, name) == 0) return tiffEntryTypes + i;
             }
-            pthread_mutex_unlock(&mutex);
+            return NULL;
+        }
+
+        unsigned int lo = 0, hi = tiffEntryCount;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            TiffEntryInfo const *info = tiffEntryTypes + tiffEntriesByName[mid];
+            int cmp = strcmp(info->name, name);
+            if (cmp == 0) return info;
+            if (cmp < 0) lo = mid + 1;
+            else hi = mid;
         }
-        std::map<const char*, TiffEntryInfo const*, TiffNameLess>::iterator it = entriesByName.find(entryName.c_str());
-        if (it == entriesByName.end()) return NULL;
-        return it->second;
+        return NULL;
     }
 
 }